@@ -1,6 +1,6 @@
 #include "sim86.h"
 
-#include <cmath>
+#include <cstdlib>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
@@ -8,684 +8,273 @@
 #include "sim86_display.h"
 #include "sim86_table.h"
 #include "sim86_execute.h"
-
+#include "sim86_loader.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+#include "sim86_memory.h"
+#include "sim86_decode.h"
+#include "sim86_length.h"
+#include "sim86_parallel.h"
+#include "sim86_flow.h"
+#include "sim86_cache.h"
+#include "sim86_clocks.h"
+#include "sim86_format.h"
+#include "sim86_timer.h"
+#include "sim86_stats.h"
+#include "sim86_snapshot.h"
+#include "sim86_lockstep.h"
+#include "sim86_run.h"
+#include "sim86_batch.h"
+#include "sim86_server.h"
+
+#include "sim86_output.cpp"
+#include "sim86_arena.cpp"
+#include "sim86_memory.cpp"
+#include "sim86_stats.cpp"
+#include "sim86_decode.cpp"
+#include "sim86_length.cpp"
 #include "sim86_display.cpp"
+#include "sim86_format.cpp"
+#include "sim86_loader.cpp"
+#include "sim86_parallel.cpp"
+#include "sim86_flow.cpp"
+#include "sim86_clocks.cpp"
+#include "sim86_cache.cpp"
+#include "sim86_execute.cpp"
+#include "sim86_snapshot.cpp"
+#include "sim86_lockstep.cpp"
+#include "sim86_run.cpp"
+#include "sim86_batch.cpp"
+#include "sim86_server.cpp"
 
-static u8 LoadFileFromMemory(char *FileName, buffer *Buffer)
-{
-    u8 Result = 0;
-    FILE *FilePtr = fopen(FileName, "rb");
-    if(FilePtr)
-    {
-        // Fread returns the number of filled elements in the buffer
-        Result = fread(Buffer, 1, ArrayCount(Buffer->Bytes), FilePtr);
-        fclose(FilePtr);
-    }
-    else
-    {
-        fprintf(stderr, "ERROR: Could not open file");
-    }
-
-    return Result;
-}
-
-// NOTE (Pedro): Copy contents of buffer into instruction bits stream
-static void CopyInstruction(instruction *Instruction, buffer *Buffer, u8 Size)
-{
-    // Start pointer, points at the first element of the buffer array
-    u8 *StartPtr = Buffer->Bytes + Buffer->IndexPtr;
-
-    // Instruction pointer, points at the first element of the array bytes inside instruction, which will hold the bytes per assembly instruction
-    memcpy(Instruction->Bits.BytePtr, StartPtr, Size);
-
-    // Increment instruction and buffer pointers
-    Instruction->Bits.BytePtr += Size;
-    Buffer->IndexPtr += Size;
-}
-
-static void ParseRmEncoding(instruction *Instruction,
-                            instruction_operand *Operand,
-                            buffer *Buffer)
+int main(int ArgCount, char **Args)
 {
-    // Memory mode: no displacement follows
-    if(Instruction->ModBits == 0b00)
+    run_options Options = {};
+    Options.UseCache = true;
+    Options.ThreadCount = 1;
+
+    bool Batch = false;
+    bool Tagged = false;
+    u32 ThreadCount = 0;            // 0 until -threads, batch and server modes then use every core
+    char *ServePath = 0;            // Unix socket to listen on, "-" for stdin/stdout
+    char *ConnectPath = 0;          // Unix socket of a running server to send the files to
+    u32 Repeat = 1;
+    int ExitCode = 0;
+    const char *StatsFormat = 0;    // "text" or "json" with --stats
+
+    char **Paths = (char **)calloc(ArgCount, sizeof(char *));
+    u32 PathCount = 0;
+
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
     {
-        Operand->Type = Operand_Memory;
-        Operand->Memory = {};
-
-        // NOTE (pedro): Special case, 16-bit displacement follows
-        if(Instruction->RmBits == 0x6)
+        if(strcmp(Args[ArgIndex], "-exec") == 0)
         {
-            Operand->Memory.Flags.Memory_HasDirectAddress = 0x1;
-
-            // NOTE (pedro): Is direct address always a 16-bit value?
-            CopyInstruction(Instruction, Buffer, 2);
-
-            Operand->Memory.DirectAddress =
-                (Instruction->Bits.Byte3 << 8) | Instruction->Bits.Byte2;
+            Options.Execute = true;
         }
-        else
+        else if((strcmp(Args[ArgIndex], "-threads") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            Operand->Memory.Register = RegisterLookup[2][Instruction->RmBits];
+            ThreadCount = atoi(Args[++ArgIndex]);
+            if(ThreadCount < 1)
+            {
+                ThreadCount = 1;
+            }
         }
-    }
-
-    // Memory mode: 8-bit displacement follows
-    else if(Instruction->ModBits == 0b01)
-    {
-        Operand->Type = Operand_Memory;
-        Operand->Memory = {};
-        Operand->Memory.Flags.Memory_HasDisplacement = 0x1;
-
-        // Read 8-bit displacement
-        CopyInstruction(Instruction, Buffer, 1);
-        Operand->Memory.Displacement = Instruction->Bits.Byte2;
-
-        Operand->Memory.Register = RegisterLookup[2][Instruction->RmBits];
-
-    }
-
-    // Memory mode: 16-bit displacement follows
-    else if(Instruction->ModBits == 0b10)
-    {
-        Operand->Type = Operand_Memory;
-        Operand->Memory = {};
-        Operand->Memory.Flags.Memory_HasDisplacement = 0x1;
-
-        // Read 16-bit displacement
-        CopyInstruction(Instruction, Buffer, 2);
-        Operand->Memory.Displacement =
-            (Instruction->Bits.Byte3 << 8) | Instruction->Bits.Byte2;
-
-        Operand->Memory.Register = RegisterLookup[2][Instruction->RmBits];
-    }
-
-    // Register mode: No displacement follows
-    else
-    {
-        Operand->Type = Operand_Register;
-        Operand->Register = RegisterLookup[Instruction->WBit][Instruction->RmBits];
-    }
-}
-
-static instruction ParseInstruction(buffer *Buffer)
-{
-    instruction Instruction = {};
-
-    // Read first byte
-    CopyInstruction(&Instruction, Buffer, 1);
-
-    // Register/memory to/from register
-    if((Instruction.Bits.Byte0 >> 2) == 0b100010)
-    {
-        Instruction.OpType = mov;
-
-        Instruction.DBit = Instruction.Bits.Byte0 >> 1 & 0b1;
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        // Read second byte
-        CopyInstruction(&Instruction, Buffer, 1);
-
-        Instruction.ModBits = Instruction.Bits.Byte1 >> 6 & 0b11;
-        Instruction.RegBits = Instruction.Bits.Byte1 >> 3 & 0b111;
-        Instruction.RmBits = Instruction.Bits.Byte1 & 0b111;
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        // Parse the R/M bits;
-        ParseRmEncoding(&Instruction, &RightOperand, Buffer);
-
-        // Left operand is destination and right is source if D bit is on, else the opposite
-        if(Instruction.DBit)
+        else if((strcmp(Args[ArgIndex], "-limit") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            Instruction.Operands[0] = LeftOperand;
-            Instruction.Operands[1] = RightOperand;
+            Options.InstructionLimit = strtoull(Args[++ArgIndex], 0, 10);
         }
-        else
+        else if((strcmp(Args[ArgIndex], "-lanes") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            Instruction.Operands[0] = RightOperand;
-            Instruction.Operands[1] = LeftOperand;
+            s64 LaneCount = atoll(Args[++ArgIndex]);
+            Options.LaneCount = (LaneCount < 1) ? 1 : (LaneCount > LOCKSTEP_MAX_LANES) ? LOCKSTEP_MAX_LANES : (u32)LaneCount;
+            Options.Execute = true;
         }
-    }
-
-    // Immediate to register/memory
-    if((Instruction.Bits.Byte0 >> 1) == 0b1100011)
-    {
-        Instruction.OpType = mov;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        // Read second byte
-        CopyInstruction(&Instruction, Buffer, 1);
-
-        Instruction.ModBits = Instruction.Bits.Byte1 >> 6 & 0b11;
-        Instruction.RmBits = Instruction.Bits.Byte1 & 0b111;
-
-        // Parse the R/M bits;
-        ParseRmEncoding(&Instruction, &LeftOperand, Buffer);
-
-        RightOperand.Type = Operand_Immediate;
-
-        // TODO (Pedro): FIX WORD BYTE OPERATION!!!
-        if(Instruction.WBit)
+        else if((strcmp(Args[ArgIndex], "-laneseed") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            // Specify word operation
-            RightOperand.Immediate.Flags.Memory_IsWide = 0x2;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                (Instruction.Bits.Byte3 << 8) | Instruction.Bits.Byte2;
+            Options.LaneSeed = strtoull(Args[++ArgIndex], 0, 0);
         }
-        else
+        else if(strcmp(Args[ArgIndex], "-scalarlanes") == 0)
         {
-            // Specify byte operation
-            RightOperand.Immediate.Flags.Memory_IsWide = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte2;
+            Options.ScalarLanes = true;
         }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
-    }
-
-    // Immediate to register
-    if((Instruction.Bits.Byte0 >> 4) == 0b1011)
-    {
-        Instruction.OpType = mov;
-
-        Instruction.WBit = Instruction.Bits.Byte0 >> 3 & 0b1;
-        Instruction.RegBits = Instruction.Bits.Byte0 & 0b111;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Immediate;
-
-        if(Instruction.WBit)
+        else if((strcmp(Args[ArgIndex], "-snapshot") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
+            Options.SnapshotPath = Args[++ArgIndex];
         }
-        else
+        else if(strcmp(Args[ArgIndex], "-resume") == 0)
         {
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte1;
+            Options.Resume = true;
+            Options.Execute = true;
         }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
-    }
-
-    // Memory to accumulator
-    if((Instruction.Bits.Byte0 >> 1) == 0b1010000)
-    {
-        Instruction.OpType = mov;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-        Instruction.RegBits = Instruction.Bits.Byte0 >> 2 & 0b111;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Memory;
-
-        if(Instruction.WBit)
+        else if(strcmp(Args[ArgIndex], "-nocache") == 0)
         {
-            RightOperand.Memory.Flags.Memory_HasDirectAddress = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Memory.DirectAddress =
-                (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
+            Options.UseCache = false;
         }
-        else
+        else if(strcmp(Args[ArgIndex], "-cachestats") == 0)
         {
-            RightOperand.Memory.Flags.Memory_HasDirectAddress = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Memory.DirectAddress = Instruction.Bits.Byte1;
+            Options.CacheStats = true;
         }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
-
-    }
-
-    // Accumulator to memory
-    if((Instruction.Bits.Byte0 >> 1) == 0b1010001)
-    {
-        Instruction.OpType = mov;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-        Instruction.RegBits = Instruction.Bits.Byte0 >> 2 & 0b111;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Memory;
-
-        // Read address
-        if(Instruction.WBit)
+        else if(strcmp(Args[ArgIndex], "-generic") == 0)
         {
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Memory.DirectAddress =
-                (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
-            RightOperand.Memory.Flags.Memory_HasDirectAddress = 0x1;
+            Options.Dispatch = Dispatch_Generic;
         }
-        else
+        else if((strcmp(Args[ArgIndex], "-dispatch") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Memory.DirectAddress = Instruction.Bits.Byte1;
-            RightOperand.Memory.Flags.Memory_HasDirectAddress = 0x1;
+            if(!ParseDispatch(Args[++ArgIndex], &Options.Dispatch))
+            {
+                fprintf(stderr, "WARNING: Unknown dispatch %s, expected call, switch, goto, tail or generic\n", Args[ArgIndex]);
+            }
         }
-
-        Instruction.Operands[0] = RightOperand;
-        Instruction.Operands[1] = LeftOperand;
-    }
-
-    // ADD / SUB / CMP - Reg/memory with register to either
-    if(((Instruction.Bits.Byte0 >> 2) == 0b000000) ||
-       ((Instruction.Bits.Byte0 >> 2) == 0b001010) ||
-       ((Instruction.Bits.Byte0 >> 2) == 0b001110))
-    {
-        if((Instruction.Bits.Byte0 >> 3) == 0b000)
+        else if(strcmp(Args[ArgIndex], "-arenastats") == 0)
         {
-            Instruction.OpType = add;
+            Options.ArenaStats = true;
         }
-        else if((Instruction.Bits.Byte0 >> 3) == 0b101)
+        else if(strcmp(Args[ArgIndex], "-clocks") == 0)
         {
-            Instruction.OpType = sub;
+            Options.Clocks = true;
         }
-        else if((Instruction.Bits.Byte0 >> 3) == 0b111)
+        else if((strcmp(Args[ArgIndex], "--stats") == 0) || (strcmp(Args[ArgIndex], "--stats=json") == 0))
         {
-            Instruction.OpType = cmp;
+            StatsFormat = (Args[ArgIndex][7] == '=') ? "json" : "text";
         }
-
-        Instruction.DBit = Instruction.Bits.Byte0 >> 1 & 0b1;
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        // Read second byte
-        CopyInstruction(&Instruction, Buffer, 1);
-
-        Instruction.ModBits = Instruction.Bits.Byte1 >> 6 & 0b11;
-        Instruction.RegBits = Instruction.Bits.Byte1 >> 3 & 0b111;
-        Instruction.RmBits = Instruction.Bits.Byte1 & 0b111;
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        // Parse the R/M bits;
-        ParseRmEncoding(&Instruction, &RightOperand, Buffer);
-
-        if(Instruction.DBit)
+        else if((strcmp(Args[ArgIndex], "-format") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            Instruction.Operands[0] = LeftOperand;
-            Instruction.Operands[1] = RightOperand;
+            if(!ParseOutputFormat(Args[++ArgIndex], &Options.Format))
+            {
+                fprintf(stderr, "WARNING: Unknown format %s, expected text, binary or jsonl\n", Args[ArgIndex]);
+            }
         }
-        else
+        else if(strcmp(Args[ArgIndex], "-flow") == 0)
         {
-            Instruction.Operands[0] = RightOperand;
-            Instruction.Operands[1] = LeftOperand;
+            Options.Flow = true;
         }
-    }
-
-    // ADD / SUB / CMP - Immediate to register/memory
-    if((Instruction.Bits.Byte0 >> 2) == 0b100000)
-    {
-        // Read second byte to determine opcode
-        CopyInstruction(&Instruction, Buffer, 1);
-
-        Instruction.SBit = Instruction.Bits.Byte0 >> 1 & 0b1;
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        Instruction.ModBits = Instruction.Bits.Byte1 >> 6 & 0b11;
-        Instruction.RegBits = Instruction.Bits.Byte1 >> 3 & 0b111;
-        Instruction.RmBits = Instruction.Bits.Byte1 & 0b111;
-
-        if(Instruction.RegBits == 0b000)
+        else if(strcmp(Args[ArgIndex], "-scaling") == 0)
         {
-            Instruction.OpType = add;
+            Options.Scaling = true;
         }
-        else if(Instruction.RegBits == 0b101)
+        else if(strcmp(Args[ArgIndex], "-batch") == 0)
         {
-            Instruction.OpType = sub;
+            Batch = true;
         }
-        else if(Instruction.RegBits == 0b111)
+        else if((strcmp(Args[ArgIndex], "-serve") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            Instruction.OpType = cmp;
+            ServePath = Args[++ArgIndex];
         }
-
-        // One operand is an immediate value
-        RightOperand.Type = Operand_Immediate;
-
-        // Parse the R/M bits;
-        ParseRmEncoding(&Instruction, &LeftOperand, Buffer);
-
-        if(!Instruction.SBit && Instruction.WBit)
+        else if((strcmp(Args[ArgIndex], "-connect") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            // Specify word operation
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x2;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                (Instruction.Bits.Byte3 << 8) | Instruction.Bits.Byte2;
+            ConnectPath = Args[++ArgIndex];
         }
-        else
+        else if((strcmp(Args[ArgIndex], "-repeat") == 0) && (ArgIndex + 1 < ArgCount))
         {
-            // Specify byte operation
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte2;
+            Repeat = atoi(Args[++ArgIndex]);
+            if(Repeat < 1)
+            {
+                Repeat = 1;
+            }
         }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
-    }
-
-    // ADD - Immediate to accumulator
-    if((Instruction.Bits.Byte0 >> 1) == 0b0000010)
-    {
-        Instruction.OpType = add;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-        Instruction.RegBits = Instruction.Bits.Byte0 >> 3 & 0b111;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Immediate;
-
-        if(Instruction.WBit)
+        else if(strcmp(Args[ArgIndex], "-tagged") == 0)
         {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x2;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
+            Tagged = true;
         }
         else
         {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte1;
+            Paths[PathCount++] = Args[ArgIndex];
         }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
     }
 
-    // SUB - Immediate to accumulator
-    if((Instruction.Bits.Byte0 >> 1) == 0b0010110)
+#ifdef SIM86_STATS
+    BeginStats();
+#else
+    if(StatsFormat)
     {
-        Instruction.OpType = sub;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-        Instruction.RegBits = 0b000;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Immediate;
-
-        if(Instruction.WBit)
-        {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x2;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
-        }
-        else
-        {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte1;
-        }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
+        fprintf(stderr, "WARNING: --stats needs a build with SIM86_STATS (make STATS=1)\n");
     }
+#endif
 
-    // CMP - Immediate to accumulator
-    if((Instruction.Bits.Byte0 >> 1) == 0b0011110)
+    if(Options.LaneCount && Options.Clocks)
     {
-        Instruction.OpType = cmp;
-
-        Instruction.WBit = Instruction.Bits.Byte0 & 0b1;
-        Instruction.RegBits = 0b000;
-
-        // Create source and destination operands
-        instruction_operand LeftOperand = {};
-        instruction_operand RightOperand = {};
-
-        LeftOperand.Type = Operand_Register;
-        LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
-
-        RightOperand.Type = Operand_Immediate;
-
-        if(Instruction.WBit)
-        {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x2;
-
-            CopyInstruction(&Instruction, Buffer, 2);
-            RightOperand.Immediate.Value =
-                    (Instruction.Bits.Byte2 << 8) | Instruction.Bits.Byte1;
-        }
-        else
-        {
-            //RightOperand.Immediate.Flags.Memory_IsWide = 0x1;
-
-            CopyInstruction(&Instruction, Buffer, 1);
-            RightOperand.Immediate.Value = Instruction.Bits.Byte1;
-        }
-
-        Instruction.Operands[0] = LeftOperand;
-        Instruction.Operands[1] = RightOperand;
+        fprintf(stderr, "WARNING: -clocks is not counted for -lanes\n");
     }
 
-    switch(Instruction.Bits.Byte0)
+    if(Options.SnapshotPath && (Options.LaneCount || !Options.Execute))
     {
-        case 0b01110100:
-            Instruction.OpType = je; // JE/JZ
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111100:
-            Instruction.OpType = jl; // JL/JNGE
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111110:
-            Instruction.OpType = jle; // JLE/JNG
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110010:
-            Instruction.OpType = jb; // JB/JNAE
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110110:
-            Instruction.OpType = jbe; // JBE/JNA
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111010:
-            Instruction.OpType = jp; // JP/JPE
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110000:
-            Instruction.OpType = jo; // JO
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111000:
-            Instruction.OpType = js; // JS
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110101:
-            Instruction.OpType = jne; // JNE/JNZ
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111101:
-            Instruction.OpType = jnl; // JNL/JGE
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111111:
-            Instruction.OpType = jg; // JNGE/JG
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110011:
-            Instruction.OpType = jnb; // JNB/JAE
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110111:
-            Instruction.OpType = ja; // JNBE/JA
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111011:
-            Instruction.OpType = jnp; // JNP/JPO
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01110001:
-            Instruction.OpType = jno; // JNO
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b01111001:
-            Instruction.OpType = jns; // JNS
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b11100010:
-            Instruction.OpType = loop; // LOOP
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b11100001:
-            Instruction.OpType = loopz; // LOOPZ
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b11100000:
-            Instruction.OpType = loopnz; // LOOPNZ
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
-
-        case 0b11100011:
-            Instruction.OpType = jcxz; // JCXZ
-            CopyInstruction(&Instruction, Buffer, 1);
-            break;
+        fprintf(stderr, "WARNING: -snapshot only saves a plain -exec run\n");
     }
 
-    return Instruction;
-}
+    // NOTE (Pedro): A record file is one header and one image, so readers can index it by size
+    if(Batch && (Options.Format == Format_Binary))
+    {
+        fprintf(stderr, "ERROR: -format binary holds a single image, use -format jsonl with -batch\n");
+        ExitCode = 1;
+    }
+    // NOTE (Pedro): One snapshot path for every file would have the workers overwrite each other
+    else if(Options.SnapshotPath && (Batch || ConnectPath || ServePath))
+    {
+        fprintf(stderr, "ERROR: -snapshot saves a single -exec run, it can't be used with -batch, -connect or -serve\n");
+        ExitCode = 1;
+    }
+    else if(ServePath)
+    {
+        ExitCode = RunServer(ServePath, ThreadCount, Options.InstructionLimit);
+    }
+    else if(ConnectPath)
+    {
+        ExitCode = RunClient(ConnectPath, &Options, Paths, PathCount, Repeat);
+    }
+    else if(Batch)
+    {
+        // Threads go to files, each file is disassembled on one
+        Options.Scaling = false;
 
-static void DisAsm8086(u8 BytesRead, buffer *Buffer)
-{
-    u8 Count = BytesRead;
+        output_buffer Out;
+        InitOutput(&Out, STDOUT_FILENO);
+        u32 FailedCount = RunBatch(&Options, Paths, PathCount, ThreadCount, Tagged, &Out);
+        FreeOutput(&Out);
 
-    // TODO (PEDRO): FIX WHILE LOOP!
-    while(Buffer->IndexPtr < Count)
-    {
-        instruction Instruction = ParseInstruction(Buffer);
-        if(Instruction.OpType != op_unknown)
+        if(FailedCount)
         {
-            PrintInstruction(Instruction);
-        }
-        else
-        {
-            // TODO (PEDRO): Test for unrecognized input; make sure it works
-            //fprintf(stderr, "ERROR: Unrecognized input stream\n");
-            break;
+            fprintf(stderr, "ERROR: %u of the files couldn't be run\n", FailedCount);
+            ExitCode = 1;
         }
     }
-}
-
-int main(int ArgCount, char **Args)
-{
-    bool Execute = false;
-    // Allocate memory for each instruction byte
-    buffer *Buffer = (buffer *)malloc(sizeof(buffer));
-
-    if(ArgCount > 1)
+    else if(PathCount)
     {
-        char *FileName = Args[1];
+        Options.ThreadCount = ThreadCount ? ThreadCount : 1;
 
-        if(strcmp(FileName, "-exec") == 0)
+        run_context Context;
+        if(InitRunContext(&Context, STDOUT_FILENO))
         {
-            // TODO (PEDRO): Add execution state
-            Execute = true;
+            if(!RunImage(&Options, Paths[PathCount - 1], &Context))
+            {
+                ExitCode = 1;
+            }
+            FreeRunContext(&Context);
         }
         else
         {
-            u8 BytesRead = LoadFileFromMemory(FileName, Buffer);
-
-            if(Execute)
-            {
-                printf("Bits 16\n\n");
-                //ExecuteInstruction(BytesRead, Buffer);
-            }
-            else
-            {
-                printf("\nDisassembling File: %s\n\n", FileName);
-                printf("Bits 16\n\n");
-                DisAsm8086(BytesRead, Buffer);
-            }
+            ExitCode = 1;
         }
-
     }
     else
     {
-        fprintf(stderr, "USAGE: %s FileName", Args[0]);
+        fprintf(stderr, "USAGE: %s [-exec [-limit N] [-nocache] [-cachestats] [-dispatch call|switch|goto|tail|generic] [-lanes N [-laneseed S] [-scalarlanes]] [-snapshot File]] [-resume] [-clocks] [-flow] [-format text|binary|jsonl] [--stats[=json]] [-arenastats] [-threads N] [-scaling] FileName (- for stdin)\n"
+                        "       %s -batch [-tagged] [-threads N] [other options] [Files or directories, or a manifest on stdin]\n"
+                        "       %s -serve SocketPath (- for stdin/stdout) [-threads N] [-limit MaxInstructions]\n"
+                        "       %s -connect SocketPath [-repeat N] [-exec [-limit N] [-nocache] [-cachestats]] [-clocks] [-flow] [-format text|binary|jsonl] Files\n",
+                Args[0], Args[0], Args[0], Args[0]);
+    }
+
+#ifdef SIM86_STATS
+    // Stats go to stderr so they never mix with the listing
+    if(StatsFormat)
+    {
+        output_buffer StatsOut;
+        InitOutput(&StatsOut, STDERR_FILENO);
+        PrintStats(&StatsOut, strcmp(StatsFormat, "json") == 0);
+        FreeOutput(&StatsOut);
     }
-    return 0;
+#endif
+
+    free(Paths);
+    return ExitCode;
 }
@@ -6,65 +6,81 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef int8_t s8;
 typedef int16_t s16;
 typedef int32_t s32;
+typedef int64_t s64;
 
 #define ArrayCount(Array) (sizeof(Array) / sizeof(Array)[0])
 
+// NOTE (Pedro): Longest encoding we decode: opcode, ModRM, 16-bit displacement, 16-bit data
+#define MAX_INSTRUCTION_SIZE 6
+
+// NOTE (Pedro): Each list is the one place an enum value and its printed name are written down.
+// The enums and the name tables in sim86_table.h are both expanded from them, so they can't drift.
+#define REGISTER_LIST(X) \
+    X(al, "al") \
+    X(cl, "cl") \
+    X(dl, "dl") \
+    X(bl, "bl") \
+    X(ah, "ah") \
+    X(ch, "ch") \
+    X(dh, "dh") \
+    X(bh, "bh") \
+    X(ax, "ax") \
+    X(cx, "cx") \
+    X(dx, "dx") \
+    X(bx, "bx") \
+    X(sp, "sp") \
+    X(bp, "bp") \
+    X(si, "si") \
+    X(di, "di") \
+    X(bx_si, "bx + si") \
+    X(bx_di, "bx + di") \
+    X(bp_si, "bp + si") \
+    X(bp_di, "bp + di")
+
+#define OPERATION_LIST(X) \
+    X(mov, "mov") \
+    X(add, "add") \
+    X(sub, "sub") \
+    X(cmp, "cmp") \
+    X(jne, "jne") \
+    X(je, "je") \
+    X(jl, "jl") \
+    X(jle, "jle") \
+    X(jb, "jb") \
+    X(jbe, "jbe") \
+    X(jp, "jp") \
+    X(jo, "jo") \
+    X(js, "js") \
+    X(jnl, "jnl") \
+    X(jg, "jg") \
+    X(jnb, "jnb") \
+    X(ja, "ja") \
+    X(jnp, "jnp") \
+    X(jno, "jno") \
+    X(jns, "jns") \
+    X(loop, "LOOP") \
+    X(loopz, "LOOPZ") \
+    X(loopnz, "LOOPNZ") \
+    X(jcxz, "JCXZ") \
+    X(ret, "ret")
+
+#define LIST_ENUM_VALUE(Name, Text) Name,
+#define LIST_NAME_TEXT(Name, Text) Text,
+
 typedef enum register_id
 {
-    al,
-    cl,
-    dl,
-    bl,
-    ah,
-    ch,
-    dh,
-    bh,
-    ax,
-    cx,
-    dx,
-    bx,
-    sp,
-    bp,
-    si,
-    di,
-    bx_si,
-    bx_di,
-    bp_si,
-    bp_di,
+    REGISTER_LIST(LIST_ENUM_VALUE)
     unknown,
 } register_id;
 
 typedef enum operation_types
 {
-    mov,
-    add,
-    sub,
-    cmp,
-    jne,
-    je,
-    jl,
-    jle,
-    jb,
-    jbe,
-    jp,
-    jo,
-    js,
-    jnl,
-    jg,
-    jnb,
-    ja,
-    jnp,
-    jno,
-    jns,
-    loop,
-    loopz,
-    loopnz,
-    jcxz,
-    ret,
+    OPERATION_LIST(LIST_ENUM_VALUE)
     op_unknown,
 } operation_types;
 
@@ -102,6 +118,46 @@ static register_id RegisterLookup[3][8] =
     }
 };
 
+// NOTE (Pedro): How the bytes following the first opcode byte are laid out
+typedef enum opcode_layout
+{
+    Layout_None,
+    Layout_RegRm,       // mod reg r/m [disp-lo] [disp-hi]
+    Layout_ImmToRm,     // mod xxx r/m [disp-lo] [disp-hi] data [data]
+    Layout_ImmToReg,    // reg in low bits of the opcode, data [data]
+    Layout_ImmToAcc,    // data [data]
+    Layout_MemToAcc,    // addr-lo addr-hi
+    Layout_AccToMem,    // addr-lo addr-hi
+    Layout_Jump,        // 8-bit signed IP increment
+} opcode_layout;
+
+// NOTE (Pedro): Encoding bits already resolved for a given opcode byte
+typedef enum opcode_flags
+{
+    Opcode_W = 0x1,
+    Opcode_D = 0x2,
+    Opcode_S = 0x4,
+    Opcode_ModRM = 0x8,
+    Opcode_Group = 0x10, // OpType is an index into OpcodeGroupTable, reg field picks the operation
+} opcode_flags;
+
+// NOTE (Pedro): Groups are numbered in the order their first byte shows up in EncodingSpec
+typedef enum opcode_group
+{
+    OpcodeGroup_MovImm, // 0xC6 - 0xC7
+    OpcodeGroup_Arith,  // 0x80 - 0x83
+    OpcodeGroup_Count,
+} opcode_group;
+
+typedef struct opcode_entry
+{
+    u8 OpType;      // operation_types, or opcode_group when Opcode_Group is set
+    u8 Layout;      // opcode_layout
+    u8 Flags;       // opcode_flags
+    u8 DispSize;    // Bytes of fixed displacement/address (ModRM displacements are not counted)
+    u8 ImmSize;     // Bytes of immediate data
+} opcode_entry;
+
 typedef enum memory_keyword
 {
     byte,
@@ -118,8 +174,10 @@ typedef enum operand_types
 
 typedef struct buffer
 {
-    u8 Bytes[300];
-    int IndexPtr;
+    u8 *Bytes;
+    u64 Count;          // Valid bytes in Bytes
+    u64 IndexPtr;       // Read position inside Bytes
+    u64 BaseOffset;     // Image offset of Bytes[0]
 } buffer;
 
 typedef struct memory_flags
@@ -132,6 +190,7 @@ typedef struct memory_flags
 typedef struct immediate_flags
 {
     u8 Memory_IsWide;
+    u8 Immediate_IsRelative;   // Signed IP increment of a jump, relative to the next instruction
 } immediate_flags;
 
 typedef struct operand_memory
@@ -159,31 +218,16 @@ typedef struct instruction_operand
     };
 } instruction_operand;
 
-typedef struct instruction_bits
-{
-    union
-    {
-        u8 Bytes[6];
-        struct
-        {
-            u8 Byte0;
-            u8 Byte1;
-            u8 Byte2;
-            u8 Byte3;
-            u8 Byte4;
-            u8 Byte5;
-        };
-    };
-    u8 *BytePtr = Bytes;
-} instruction_bits;
-
 typedef struct instruction
 {
-    u32 Address;
+    u64 Address;
 
     operation_types OpType = op_unknown;
     instruction_operand Operands[2] = {};
-    instruction_bits Bits;
+
+    // The encoding stays in the image, Address and Size are the view onto it
+    u8 Size;
+    u8 Layout;      // opcode_layout of the first byte
 
     u8 DBit;
     u8 WBit;
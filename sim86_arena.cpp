@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sim86_arena.h"
+
+// NOTE (Pedro): Reserves address space only. Under an address space limit the reservation is
+// halved until it fits, down to the size an arena is worth having at.
+bool InitArena(memory_arena *Arena, u64 ReserveSize)
+{
+    *Arena = {};
+
+    while(ReserveSize >= ARENA_RETAIN_SIZE)
+    {
+        void *Base = mmap(0, ReserveSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(Base != MAP_FAILED)
+        {
+            Arena->Base = (u8 *)Base;
+            Arena->Reserved = ReserveSize;
+            return true;
+        }
+
+        ReserveSize /= 2;
+    }
+
+    fprintf(stderr, "ERROR: Could not reserve arena memory\n");
+    return false;
+}
+
+void FreeArena(memory_arena *Arena)
+{
+    if(Arena->Base)
+    {
+        munmap(Arena->Base, Arena->Reserved);
+    }
+
+    *Arena = {};
+}
+
+// NOTE (Pedro): Constant time, the pages stay mapped for the next image. Only an image that
+// went past ARENA_RETAIN_SIZE costs a madvise to give the excess back.
+void ResetArena(memory_arena *Arena)
+{
+    if(Arena->Touched > ARENA_RETAIN_SIZE)
+    {
+        madvise(Arena->Base + ARENA_RETAIN_SIZE, Arena->Touched - ARENA_RETAIN_SIZE, MADV_DONTNEED);
+        Arena->Touched = ARENA_RETAIN_SIZE;
+    }
+
+    Arena->Used = 0;
+    Arena->LastPush = 0;
+    Arena->PushCount = 0;
+    Arena->ResetCount++;
+}
+
+// NOTE (Pedro): Bytes below Touched may hold whatever the last image left there, pages past it
+// are still fresh from mmap (or madvise), so zeroing only has to cover the dirty part. A push
+// that doesn't fit leaves the arena as it was, so an OutOfSpace handler can keep using it.
+static void *PushAligned(memory_arena *Arena, u64 Size, bool Zero)
+{
+    u64 AlignedSize = (Size + ARENA_ALIGNMENT - 1) & ~(u64)(ARENA_ALIGNMENT - 1);
+    if(AlignedSize > (Arena->Reserved - Arena->Used))
+    {
+        fprintf(stderr, "ERROR: Arena out of space pushing %llu bytes (%llu of %llu used)\n",
+                (unsigned long long)Size, (unsigned long long)Arena->Used, (unsigned long long)Arena->Reserved);
+        if(Arena->OutOfSpace)
+        {
+            longjmp(*Arena->OutOfSpace, 1);
+        }
+        exit(1);
+    }
+
+    u64 Offset = Arena->Used;
+    u8 *Result = Arena->Base + Offset;
+
+    if(Zero && (Offset < Arena->Touched))
+    {
+        u64 Dirty = Arena->Touched - Offset;
+        memset(Result, 0, (Dirty < Size) ? Dirty : Size);
+    }
+
+    Arena->Used += AlignedSize;
+    Arena->LastPush = Result;
+
+    if(Arena->Used > Arena->Touched)
+    {
+        Arena->Touched = Arena->Used;
+    }
+
+    Arena->PushCount++;
+    Arena->TotalPushes++;
+    if(Arena->Used > Arena->PeakUsed)
+    {
+        Arena->PeakUsed = Arena->Used;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Uninitialized, contents are whatever the last image left there
+void *PushSize(memory_arena *Arena, u64 Size)
+{
+    void *Result = PushAligned(Arena, Size, false);
+    return Result;
+}
+
+void *PushZeroSize(memory_arena *Arena, u64 Size)
+{
+    void *Result = PushAligned(Arena, Size, true);
+    return Result;
+}
+
+// NOTE (Pedro): Grows Old to NewSize, in place when nothing was pushed after it, otherwise as a
+// copy (the old bytes are only given back by the next reset)
+void *GrowPush(memory_arena *Arena, void *Old, u64 OldSize, u64 NewSize)
+{
+    if(Old && (Old == Arena->LastPush))
+    {
+        u64 Offset = (u8 *)Old - Arena->Base;
+        Arena->Used = Offset;
+
+        u8 *Result = (u8 *)PushSize(Arena, NewSize);
+        Arena->PushCount--;
+        Arena->TotalPushes--;
+        return Result;
+    }
+
+    void *Result = PushSize(Arena, NewSize);
+    if(Old)
+    {
+        memcpy(Result, Old, OldSize);
+    }
+
+    return Result;
+}
+
+temporary_memory BeginTemporaryMemory(memory_arena *Arena)
+{
+    temporary_memory Result = {Arena, Arena->Used};
+    return Result;
+}
+
+void EndTemporaryMemory(temporary_memory Temp)
+{
+    Temp.Arena->Used = Temp.Used;
+    Temp.Arena->LastPush = 0;
+}
+
+// NOTE (Pedro): One line on stderr per image for -arenastats, so it never mixes with the listing
+// and a batch of files shows which ones set the peak
+void PrintArenaStats(memory_arena *Arena, const char *Name)
+{
+    fprintf(stderr, "Arena: %s used %llu bytes in %llu pushes, peak %llu bytes, %llu resets, %llu bytes reserved\n",
+            Name, (unsigned long long)Arena->Used, (unsigned long long)Arena->PushCount,
+            (unsigned long long)Arena->PeakUsed, (unsigned long long)Arena->ResetCount,
+            (unsigned long long)Arena->Reserved);
+}
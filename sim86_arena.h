@@ -0,0 +1,64 @@
+#ifndef SIM86_ARENA_H
+#define SIM86_ARENA_H
+
+#include <setjmp.h>
+
+#include "sim86.h"
+
+// NOTE (Pedro): Every push starts on its own cache line, so arrays handed to different threads
+// never share one
+#define ARENA_ALIGNMENT 64
+
+// NOTE (Pedro): Address space reserved up front, pages only become real memory when touched.
+// Image arenas hold everything one image needs (bitmaps, chunk tables, read windows), context
+// arenas the machine memory and block cache a worker keeps between images.
+#define ARENA_IMAGE_RESERVE ((u64)64 << 30)
+#define ARENA_CONTEXT_RESERVE ((u64)64 << 20)
+
+// NOTE (Pedro): Resets hand everything past this back to the OS when an image went over it, so
+// one huge file doesn't pin its memory in a long-running server
+#define ARENA_RETAIN_SIZE ((u64)64 << 20)
+
+typedef struct memory_arena
+{
+    u8 *Base;
+    u64 Reserved;
+    u64 Used;
+    u64 Touched;            // High water since the pages were last fresh, everything past it is still zero
+
+    u8 *LastPush;           // Grows in place when it is the one being grown
+    jmp_buf *OutOfSpace;    // Where a push that doesn't fit jumps to, 0 exits the process
+
+    // Stats, PeakUsed and TotalPushes cover the arena's whole life
+    u64 PushCount;          // Since the last reset
+    u64 TotalPushes;
+    u64 PeakUsed;
+    u64 ResetCount;
+} memory_arena;
+
+// NOTE (Pedro): Everything pushed between Begin and End is dropped at End, for scratch work that
+// repeats inside one image
+typedef struct temporary_memory
+{
+    memory_arena *Arena;
+    u64 Used;
+} temporary_memory;
+
+bool InitArena(memory_arena *Arena, u64 ReserveSize);
+void FreeArena(memory_arena *Arena);
+void ResetArena(memory_arena *Arena);
+
+void *PushSize(memory_arena *Arena, u64 Size);
+void *PushZeroSize(memory_arena *Arena, u64 Size);
+void *GrowPush(memory_arena *Arena, void *Old, u64 OldSize, u64 NewSize);
+
+temporary_memory BeginTemporaryMemory(memory_arena *Arena);
+void EndTemporaryMemory(temporary_memory Temp);
+
+void PrintArenaStats(memory_arena *Arena, const char *Name);
+
+#define PushArray(Arena, Count, type) (type *)PushSize((Arena), (Count) * sizeof(type))
+#define PushZeroArray(Arena, Count, type) (type *)PushZeroSize((Arena), (Count) * sizeof(type))
+#define PushStruct(Arena, type) (type *)PushZeroSize((Arena), sizeof(type))
+
+#endif
@@ -0,0 +1,330 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim86_batch.h"
+#include "sim86_stats.h"
+
+typedef struct batch_worker
+{
+    batch *Batch;
+    u32 Index;
+} batch_worker;
+
+typedef struct job_list
+{
+    batch_job *Jobs;
+    u32 Count;
+    u32 Capacity;
+} job_list;
+
+static void AddJob(job_list *List, char *FileName)
+{
+    if(List->Count == List->Capacity)
+    {
+        List->Capacity = List->Capacity ? (2 * List->Capacity) : 256;
+        List->Jobs = (batch_job *)realloc(List->Jobs, List->Capacity * sizeof(batch_job));
+    }
+
+    batch_job *Job = &List->Jobs[List->Count++];
+    *Job = {};
+    Job->FileName = FileName;
+}
+
+static int CompareJobNames(const void *A, const void *B)
+{
+    int Result = strcmp(((batch_job *)A)->FileName, ((batch_job *)B)->FileName);
+    return Result;
+}
+
+// NOTE (Pedro): Regular files directly inside Path, sorted by name so runs are repeatable
+static void AddDirectory(job_list *List, char *Path)
+{
+    DIR *Directory = opendir(Path);
+    if(!Directory)
+    {
+        fprintf(stderr, "ERROR: Could not open directory %s\n", Path);
+        return;
+    }
+
+    u32 First = List->Count;
+    u64 PathLength = strlen(Path);
+
+    struct dirent *Entry;
+    while((Entry = readdir(Directory)))
+    {
+        if(Entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char *FileName = (char *)malloc(PathLength + strlen(Entry->d_name) + 2);
+        sprintf(FileName, (PathLength && (Path[PathLength - 1] == '/')) ? "%s%s" : "%s/%s", Path, Entry->d_name);
+
+        struct stat FileStat;
+        if((stat(FileName, &FileStat) == 0) && S_ISREG(FileStat.st_mode))
+        {
+            AddJob(List, FileName);
+        }
+        else
+        {
+            free(FileName);
+        }
+    }
+
+    closedir(Directory);
+    qsort(List->Jobs + First, List->Count - First, sizeof(batch_job), CompareJobNames);
+}
+
+// NOTE (Pedro): One path per line, blank lines are skipped
+static void ReadManifest(job_list *List, FILE *Manifest)
+{
+    char Line[BATCH_MAX_PATH];
+    while(fgets(Line, sizeof(Line), Manifest))
+    {
+        u64 Length = strcspn(Line, "\r\n");
+        Line[Length] = 0;
+
+        if(Length)
+        {
+            AddJob(List, strdup(Line));
+        }
+    }
+}
+
+// NOTE (Pedro): Own queue first, then steal the top half of the first other queue with work left
+static bool TakeJob(batch *Batch, u32 WorkerIndex, u32 *JobIndex)
+{
+    batch_queue *Own = &Batch->Queues[WorkerIndex];
+
+    pthread_mutex_lock(&Own->Lock);
+    bool Found = (Own->Next < Own->End);
+    if(Found)
+    {
+        *JobIndex = Own->Next++;
+    }
+    pthread_mutex_unlock(&Own->Lock);
+
+    for(u32 Offset = 1; !Found && (Offset < Batch->ThreadCount); Offset++)
+    {
+        batch_queue *Victim = &Batch->Queues[(WorkerIndex + Offset) % Batch->ThreadCount];
+
+        pthread_mutex_lock(&Victim->Lock);
+        u32 Left = Victim->End - Victim->Next;
+        u32 Stolen = (Left + 1) / 2;
+        u32 Begin = Victim->End - Stolen;
+        Victim->End = Begin;
+        pthread_mutex_unlock(&Victim->Lock);
+
+        if(Stolen)
+        {
+            pthread_mutex_lock(&Own->Lock);
+            Own->Next = Begin + 1;
+            Own->End = Begin + Stolen;
+            pthread_mutex_unlock(&Own->Lock);
+
+            *JobIndex = Begin;
+            Found = true;
+        }
+    }
+
+    return Found;
+}
+
+// NOTE (Pedro): Tagged output drops the blank lines and prefixes the rest with the file name
+static void AppendTagged(output_buffer *Tagged, char *FileName, output_buffer *Text)
+{
+    u64 NameLength = strlen(FileName);
+    u8 *At = Text->Base;
+    u8 *End = Text->Base + Text->Used;
+
+    while(At < End)
+    {
+        u8 *LineEnd = (u8 *)memchr(At, '\n', End - At);
+        if(!LineEnd)
+        {
+            LineEnd = End;
+        }
+
+        if(LineEnd > At)
+        {
+            AppendBytes(Tagged, (u8 *)FileName, NameLength);
+            AppendBytes(Tagged, (u8 *)": ", 2);
+            AppendBytes(Tagged, At, LineEnd - At);
+            AppendBytes(Tagged, (u8 *)"\n", 1);
+        }
+
+        At = LineEnd + 1;
+    }
+}
+
+static void *BatchWorker(void *Param)
+{
+    batch_worker *Worker = (batch_worker *)Param;
+    batch *Batch = Worker->Batch;
+
+    // Everything a file needs is owned by this worker and reused from one file to the next. A
+    // worker without one still takes its jobs, so the writer isn't left waiting on them.
+    run_context Context;
+    bool Ready = InitRunContext(&Context, -1);
+
+    output_buffer Tagged;
+    InitOutput(&Tagged, -1);
+
+    u32 JobIndex;
+    while(TakeJob(Batch, Worker->Index, &JobIndex))
+    {
+        batch_job *Job = &Batch->Jobs[JobIndex];
+
+        Context.Out.Used = 0;
+        Job->Failed = !Ready || !RunImage(Batch->Options, Job->FileName, &Context);
+
+        if(Batch->Tagged)
+        {
+            // JSON lines already start with their file, they only need to go out as a whole
+            output_buffer *Text = &Context.Out;
+            if(Batch->Options->Format == Format_Text)
+            {
+                Tagged.Used = 0;
+                AppendTagged(&Tagged, Job->FileName, &Context.Out);
+                Text = &Tagged;
+            }
+
+            pthread_mutex_lock(&Batch->Lock);
+            AppendBytes(Batch->Out, Text->Base, Text->Used);
+            pthread_mutex_unlock(&Batch->Lock);
+        }
+        else
+        {
+            u8 *Text = (u8 *)malloc(Context.Out.Used ? Context.Out.Used : 1);
+            memcpy(Text, Context.Out.Base, Context.Out.Used);
+
+            pthread_mutex_lock(&Batch->Lock);
+            Job->Text = Text;
+            Job->TextSize = Context.Out.Used;
+            Job->Done = true;
+            pthread_cond_signal(&Batch->JobDone);
+            pthread_mutex_unlock(&Batch->Lock);
+        }
+    }
+
+    FreeOutput(&Tagged);
+    if(Ready)
+    {
+        FreeRunContext(&Context);
+    }
+
+    STATS_MERGE_THREAD();
+    return 0;
+}
+
+// NOTE (Pedro): Paths are files or directories, no paths reads a manifest from stdin. Jobs are
+// dealt out to the workers in contiguous ranges and rebalanced by stealing. Output is written in
+// input order by this thread as soon as the next file is done, or by the workers when tagged.
+// Returns how many files couldn't be run.
+u32 RunBatch(run_options *Options, char **Paths, u32 PathCount, u32 ThreadCount, bool Tagged, output_buffer *Out)
+{
+    job_list List = {};
+    for(u32 PathIndex = 0; PathIndex < PathCount; PathIndex++)
+    {
+        struct stat FileStat;
+        if((stat(Paths[PathIndex], &FileStat) == 0) && S_ISDIR(FileStat.st_mode))
+        {
+            AddDirectory(&List, Paths[PathIndex]);
+        }
+        else
+        {
+            AddJob(&List, strdup(Paths[PathIndex]));
+        }
+    }
+
+    if(PathCount == 0)
+    {
+        ReadManifest(&List, stdin);
+    }
+
+    if(List.Count == 0)
+    {
+        free(List.Jobs);
+        return 0;
+    }
+
+    if(ThreadCount == 0)
+    {
+        ThreadCount = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    ThreadCount = (ThreadCount < 1) ? 1 : ThreadCount;
+    ThreadCount = (ThreadCount > BATCH_MAX_THREADS) ? BATCH_MAX_THREADS : ThreadCount;
+    ThreadCount = (ThreadCount > List.Count) ? List.Count : ThreadCount;
+
+    batch *Batch = (batch *)calloc(1, sizeof(batch));
+    Batch->Options = Options;
+    Batch->Tagged = Tagged;
+    Batch->Out = Out;
+    Batch->Jobs = List.Jobs;
+    Batch->JobCount = List.Count;
+    Batch->ThreadCount = ThreadCount;
+    pthread_mutex_init(&Batch->Lock, 0);
+    pthread_cond_init(&Batch->JobDone, 0);
+
+    batch_worker Workers[BATCH_MAX_THREADS];
+    pthread_t Threads[BATCH_MAX_THREADS];
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+    {
+        batch_queue *Queue = &Batch->Queues[ThreadIndex];
+        pthread_mutex_init(&Queue->Lock, 0);
+        Queue->Next = (u32)(((u64)List.Count * ThreadIndex) / ThreadCount);
+        Queue->End = (u32)(((u64)List.Count * (ThreadIndex + 1)) / ThreadCount);
+    }
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+    {
+        Workers[ThreadIndex] = {Batch, ThreadIndex};
+        pthread_create(&Threads[ThreadIndex], 0, BatchWorker, &Workers[ThreadIndex]);
+    }
+
+    if(!Tagged)
+    {
+        for(u32 JobIndex = 0; JobIndex < Batch->JobCount; JobIndex++)
+        {
+            batch_job *Job = &Batch->Jobs[JobIndex];
+
+            pthread_mutex_lock(&Batch->Lock);
+            while(!Job->Done)
+            {
+                pthread_cond_wait(&Batch->JobDone, &Batch->Lock);
+            }
+            pthread_mutex_unlock(&Batch->Lock);
+
+            AppendBytes(Out, Job->Text, Job->TextSize);
+            free(Job->Text);
+            Job->Text = 0;
+        }
+    }
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+    {
+        pthread_join(Threads[ThreadIndex], 0);
+        pthread_mutex_destroy(&Batch->Queues[ThreadIndex].Lock);
+    }
+
+    pthread_cond_destroy(&Batch->JobDone);
+    pthread_mutex_destroy(&Batch->Lock);
+
+    // The workers are joined, so every Failed flag is in
+    u32 FailedCount = 0;
+    for(u32 JobIndex = 0; JobIndex < Batch->JobCount; JobIndex++)
+    {
+        FailedCount += Batch->Jobs[JobIndex].Failed;
+        free(Batch->Jobs[JobIndex].FileName);
+    }
+    free(Batch->Jobs);
+    free(Batch);
+
+    return FailedCount;
+}
@@ -0,0 +1,54 @@
+#ifndef SIM86_BATCH_H
+#define SIM86_BATCH_H
+
+#include <pthread.h>
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_run.h"
+
+#define BATCH_MAX_THREADS 64
+
+// NOTE (Pedro): Longest line read from a stdin manifest
+#define BATCH_MAX_PATH 4096
+
+typedef struct batch_job
+{
+    char *FileName;
+
+    // Finished text, handed from the worker to whoever writes it out
+    u8 *Text;
+    u64 TextSize;
+    bool Done;
+    bool Failed;            // Couldn't be run, set by the worker that took the job
+} batch_job;
+
+// NOTE (Pedro): A worker's share of the job list, [Next, End). The owner takes from Next,
+// thieves take the top half from End, so both ends only meet when the range is nearly empty.
+typedef struct batch_queue
+{
+    pthread_mutex_t Lock;
+    u32 Next;
+    u32 End;
+} batch_queue;
+
+typedef struct batch
+{
+    run_options *Options;
+    bool Tagged;            // Prefix every line with its file and write as soon as it's done
+    output_buffer *Out;
+
+    batch_job *Jobs;
+    u32 JobCount;
+
+    batch_queue Queues[BATCH_MAX_THREADS];
+    u32 ThreadCount;
+
+    // Guards the Done flags for the in-order writer, or Out itself when tagged
+    pthread_mutex_t Lock;
+    pthread_cond_t JobDone;
+} batch;
+
+u32 RunBatch(run_options *Options, char **Paths, u32 PathCount, u32 ThreadCount, bool Tagged, output_buffer *Out);
+
+#endif
@@ -0,0 +1,889 @@
+// NOTE (Pedro): Benchmark driver, a second unity build next to sim86.cpp. Generates synthetic
+// instruction streams and times the decoder, the printer and the executor on them.
+#include "sim86.h"
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "sim86_display.h"
+#include "sim86_table.h"
+#include "sim86_execute.h"
+#include "sim86_loader.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+#include "sim86_memory.h"
+#include "sim86_decode.h"
+#include "sim86_length.h"
+#include "sim86_parallel.h"
+#include "sim86_cache.h"
+#include "sim86_clocks.h"
+#include "sim86_timer.h"
+#include "sim86_stats.h"
+#include "sim86_snapshot.h"
+#include "sim86_lockstep.h"
+
+#include "sim86_output.cpp"
+#include "sim86_arena.cpp"
+#include "sim86_memory.cpp"
+#include "sim86_stats.cpp"
+#include "sim86_decode.cpp"
+#include "sim86_length.cpp"
+#include "sim86_display.cpp"
+#include "sim86_loader.cpp"
+#include "sim86_parallel.cpp"
+#include "sim86_clocks.cpp"
+#include "sim86_cache.cpp"
+#include "sim86_execute.cpp"
+#include "sim86_snapshot.cpp"
+#include "sim86_lockstep.cpp"
+
+#define BENCH_MAX_REPS 256
+#define BENCH_MAX_RESULTS 16
+#define BENCH_PRINT_INSTRUCTIONS (256 * 1024)
+#define BENCH_BATCH_INSTRUCTIONS 4096
+
+// NOTE (Pedro): The lane benchmarks run this many copies of the executable image, each looping
+// BENCH_LANE_LOOP_DIVISOR times less so the total stays near the single-machine run
+#define BENCH_LANES 1024
+#define BENCH_LANE_LOOP_DIVISOR 64
+
+// NOTE (Pedro): Executable images keep code below this and point every base register above it,
+// so memory operands never land on code and the block cache stays warm
+#define BENCH_CODE_LIMIT 0x3000
+#define BENCH_DATA_START 0x4000
+
+typedef enum bench_family
+{
+    Family_Mov,
+    Family_Add,
+    Family_Sub,
+    Family_Cmp,
+    Family_Jump,
+    Family_Count,
+} bench_family;
+
+// NOTE (Pedro): ModRM modes, the two displacement sizes are their own modes
+typedef enum bench_mode
+{
+    Mode_Register,      // mod 11
+    Mode_Memory,        // mod 00, including the direct address form
+    Mode_Disp8,         // mod 01
+    Mode_Disp16,        // mod 10
+    Mode_Count,
+} bench_mode;
+
+typedef struct bench_config
+{
+    u32 FamilyWeights[Family_Count];
+    u32 ModeWeights[Mode_Count];
+    u32 ImmediatePercent;   // Share of mov/add/sub/cmp that take an immediate source
+
+    u64 ImageSize;
+    u64 Seed;
+    u32 Warmup;
+    u32 Reps;
+    u32 LoopCount;          // Times each executable segment loops
+    double Threshold;       // Slowdown, in percent, reported as a regression
+} bench_config;
+
+typedef struct random_series
+{
+    u64 State;
+} random_series;
+
+typedef struct bench_result
+{
+    const char *Name;
+    u64 Bytes;
+    u64 Instructions;
+    double Seconds[BENCH_MAX_REPS];
+    u32 Reps;
+} bench_result;
+
+static u32 RandomU32(random_series *Series)
+{
+    // xorshift64*
+    u64 X = Series->State;
+    X ^= X >> 12;
+    X ^= X << 25;
+    X ^= X >> 27;
+    Series->State = X;
+
+    u32 Result = (u32)((X * 0x2545F4914F6CDD1Dull) >> 32);
+    return Result;
+}
+
+static u32 RandomChoice(random_series *Series, u32 Count)
+{
+    u32 Result = RandomU32(Series) % Count;
+    return Result;
+}
+
+static u32 RandomWeighted(random_series *Series, u32 *Weights, u32 Count)
+{
+    u32 Total = 0;
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        Total += Weights[Index];
+    }
+
+    u32 Pick = RandomChoice(Series, Total ? Total : 1);
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        if(Pick < Weights[Index])
+        {
+            return Index;
+        }
+        Pick -= Weights[Index];
+    }
+
+    return 0;
+}
+
+// NOTE (Pedro): reg field of the 0x80 - 0x83 group and the base of the reg/rm and accumulator forms
+static const u8 GroupReg[Family_Count] = {0, 0, 5, 7, 0};
+static const u8 RegRmBase[Family_Count] = {0x88, 0x00, 0x28, 0x38, 0};
+
+// NOTE (Pedro): Writes mod, r/m and the displacement. Executable images keep direct addresses
+// and 16-bit displacements small enough that every address stays in the data area.
+static u32 EmitModRm(random_series *Series, bench_config *Config, u8 *Dest, u8 Reg, bool Executable)
+{
+    u32 Mode = RandomWeighted(Series, Config->ModeWeights, Mode_Count);
+    u8 Rm = (u8)RandomChoice(Series, 8);
+    u32 Size = 1;
+
+    switch(Mode)
+    {
+        case Mode_Register:
+        {
+            // Executable images only write ax and dx, cx counts the loop and the rest are bases
+            if(Executable)
+            {
+                Rm = RandomChoice(Series, 2) ? 0 : 2;
+            }
+            Dest[0] = 0xC0 | (Reg << 3) | Rm;
+        } break;
+
+        case Mode_Memory:
+        {
+            Dest[0] = (Reg << 3) | Rm;
+            if(Rm == 0b110)
+            {
+                u16 Address = Executable ? (BENCH_DATA_START + RandomChoice(Series, 0x4000)) : (u16)RandomU32(Series);
+                Dest[1] = (u8)Address;
+                Dest[2] = (u8)(Address >> 8);
+                Size += 2;
+            }
+        } break;
+
+        case Mode_Disp8:
+        {
+            Dest[0] = 0x40 | (Reg << 3) | Rm;
+            Dest[1] = (u8)RandomU32(Series);
+            Size += 1;
+        } break;
+
+        case Mode_Disp16:
+        {
+            u16 Disp = Executable ? (u16)RandomChoice(Series, 0x4000) : (u16)RandomU32(Series);
+            Dest[0] = 0x80 | (Reg << 3) | Rm;
+            Dest[1] = (u8)Disp;
+            Dest[2] = (u8)(Disp >> 8);
+            Size += 2;
+        } break;
+    }
+
+    return Size;
+}
+
+static u32 EmitImmediate(random_series *Series, u8 *Dest, u32 Size)
+{
+    u32 Value = RandomU32(Series);
+    Dest[0] = (u8)Value;
+    if(Size == 2)
+    {
+        Dest[1] = (u8)(Value >> 8);
+    }
+
+    return Size;
+}
+
+// NOTE (Pedro): One instruction from the configured mix. Jumps in executable images are
+// "jcc $+2" so they branch to the next instruction whichever way they go.
+static u32 EmitInstruction(random_series *Series, bench_config *Config, u8 *Dest, bool Executable)
+{
+    u32 Family = RandomWeighted(Series, Config->FamilyWeights, Family_Count);
+    u8 W = (u8)RandomChoice(Series, 2);
+    u32 Size = 0;
+
+    if(Family == Family_Jump)
+    {
+        Dest[0] = 0x70 | (u8)RandomChoice(Series, 16);
+        Dest[1] = Executable ? 0 : (u8)RandomU32(Series);
+        return 2;
+    }
+
+    bool Immediate = RandomChoice(Series, 100) < Config->ImmediatePercent;
+    if(Immediate)
+    {
+        u32 Form = RandomChoice(Series, 3);
+        if((Family == Family_Mov) && (Form == 0))
+        {
+            // mov reg, imm with the register in the opcode
+            u8 Reg = Executable ? (RandomChoice(Series, 2) ? 0 : 2) : (u8)RandomChoice(Series, 8);
+            Dest[0] = 0xB0 | (W << 3) | Reg;
+            Size = 1 + EmitImmediate(Series, Dest + 1, W ? 2 : 1);
+        }
+        else if((Family != Family_Mov) && (Form == 0))
+        {
+            // Accumulator form
+            Dest[0] = (RegRmBase[Family] + 4) | W;
+            Size = 1 + EmitImmediate(Series, Dest + 1, W ? 2 : 1);
+        }
+        else if(Family == Family_Mov)
+        {
+            Dest[0] = 0xC6 | W;
+            Size = 1 + EmitModRm(Series, Config, Dest + 1, 0, Executable);
+            Size += EmitImmediate(Series, Dest + Size, W ? 2 : 1);
+        }
+        else
+        {
+            // 0x83 sign-extends a byte into a word destination
+            u8 S = W ? (u8)RandomChoice(Series, 2) : 0;
+            Dest[0] = 0x80 | (S << 1) | W;
+            Size = 1 + EmitModRm(Series, Config, Dest + 1, GroupReg[Family], Executable);
+            Size += EmitImmediate(Series, Dest + Size, (W && !S) ? 2 : 1);
+        }
+    }
+    else
+    {
+        // The reg field is the destination when D is set, executable images only let it be ax/dx
+        u8 D = (u8)RandomChoice(Series, 2);
+        u8 Reg = (u8)RandomChoice(Series, 8);
+        if(Executable && D)
+        {
+            Reg = RandomChoice(Series, 2) ? 0 : 2;
+        }
+
+        Dest[0] = RegRmBase[Family] | (D << 1) | W;
+        Size = 1 + EmitModRm(Series, Config, Dest + 1, Reg, Executable && !D);
+    }
+
+    return Size;
+}
+
+// NOTE (Pedro): Straight-line stream for the decoder and printer, never executed
+static u8 *GenerateImage(bench_config *Config, u64 *ImageSize)
+{
+    random_series Series = {Config->Seed};
+    u64 Size = 0;
+
+    u8 *Image = (u8 *)malloc(Config->ImageSize + MAX_INSTRUCTION_SIZE);
+    while(Size < Config->ImageSize)
+    {
+        Size += EmitInstruction(&Series, Config, Image + Size, false);
+    }
+
+    *ImageSize = Size;
+    return Image;
+}
+
+// NOTE (Pedro): Segments of "mov cx, N / body / loop body" laid back to back. Base registers are
+// set once up front and never written, so every memory operand hits the data area.
+static u32 GenerateProgram(bench_config *Config, u8 *Memory)
+{
+    random_series Series = {Config->Seed ^ 0x9E3779B97F4A7C15ull};
+    u32 Size = 0;
+
+    // mov bx, 5000h / mov bp, 6000h / mov si, 4100h / mov di, 4200h
+    u8 Prologue[] = {0xBB, 0x00, 0x50, 0xBD, 0x00, 0x60, 0xBE, 0x00, 0x41, 0xBF, 0x00, 0x42};
+    memcpy(Memory, Prologue, sizeof(Prologue));
+    Size += sizeof(Prologue);
+
+    while((Size + 128) < BENCH_CODE_LIMIT)
+    {
+        Memory[Size++] = 0xB9;
+        Memory[Size++] = (u8)Config->LoopCount;
+        Memory[Size++] = (u8)(Config->LoopCount >> 8);
+
+        u32 BodyStart = Size;
+        while((Size - BodyStart) < (120 - MAX_INSTRUCTION_SIZE))
+        {
+            Size += EmitInstruction(&Series, Config, Memory + Size, true);
+        }
+
+        Memory[Size] = 0xE2;
+        Memory[Size + 1] = (u8)(s8)-(s32)(Size + 2 - BodyStart);
+        Size += 2;
+    }
+
+    return Size;
+}
+
+static void BenchParse(bench_config *Config, u8 *Image, u64 ImageSize, bench_result *Result)
+{
+    Result->Name = "parse";
+    Result->Bytes = ImageSize;
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        buffer Buffer = {Image, ImageSize, 0, 0};
+        u64 Count = 0;
+
+        double StartTime = GetSeconds();
+        while(Buffer.IndexPtr < Buffer.Count)
+        {
+            instruction Instruction = ParseInstruction(&Buffer);
+            if(Instruction.OpType == op_unknown)
+            {
+                break;
+            }
+            Count++;
+        }
+        double Seconds = GetSeconds() - StartTime;
+
+        Result->Instructions = Count;
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+}
+
+// NOTE (Pedro): The whole image through DecodeBatch a batch at a time, the way an analysis would
+// stream it. The lengths are summed to check the batches cover every byte they decoded.
+static void BenchDecodeBatch(bench_config *Config, u8 *Image, u64 ImageSize, bench_result *Result)
+{
+    Result->Name = "decode-batch";
+    Result->Bytes = ImageSize;
+
+    u32 Capacity = BENCH_BATCH_INSTRUCTIONS;
+    u64 RowSize = sizeof(u32) + sizeof(s16) + sizeof(u16) + 6 * sizeof(u8);
+    u8 *Columns = (u8 *)malloc(Capacity * RowSize);
+
+    decoded_batch Batch = {};
+    Batch.Capacity = Capacity;
+    Batch.Offset = (u32 *)Columns;
+    Batch.Displacement = (s16 *)(Batch.Offset + Capacity);
+    Batch.Immediate = (u16 *)(Batch.Displacement + Capacity);
+    Batch.OpType = (u8 *)(Batch.Immediate + Capacity);
+    Batch.OperandKinds = Batch.OpType + Capacity;
+    Batch.Register0 = Batch.OperandKinds + Capacity;
+    Batch.Register1 = Batch.Register0 + Capacity;
+    Batch.Flags = Batch.Register1 + Capacity;
+    Batch.Length = Batch.Flags + Capacity;
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        buffer Buffer = {Image, ImageSize, 0, 0};
+        u64 Count = 0;
+        u64 Covered = 0;
+
+        double StartTime = GetSeconds();
+        while(DecodeBatch(&Buffer, Capacity, &Batch))
+        {
+            for(u32 Index = 0; Index < Batch.Count; Index++)
+            {
+                Covered += Batch.Length[Index];
+            }
+            Count += Batch.Count;
+        }
+        double Seconds = GetSeconds() - StartTime;
+
+        if(Covered != Buffer.IndexPtr)
+        {
+            fprintf(stderr, "ERROR: Decoded batches cover %llu of %llu bytes\n",
+                    (unsigned long long)Covered, (unsigned long long)Buffer.IndexPtr);
+        }
+
+        Result->Instructions = Count;
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+
+    free(Columns);
+}
+
+static void BenchLength(bench_config *Config, u8 *Image, u64 ImageSize, bench_result *Result)
+{
+    Result->Name = "length";
+    Result->Bytes = ImageSize;
+
+    memory_arena Arena;
+    InitArena(&Arena, ARENA_IMAGE_RESERVE);
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        boundary_index Index;
+        ResetArena(&Arena);
+
+        double StartTime = GetSeconds();
+        BuildBoundaryIndex(Image, ImageSize, &Index, &Arena);
+        double Seconds = GetSeconds() - StartTime;
+
+        Result->Instructions = Index.InstructionCount;
+
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+
+    FreeArena(&Arena);
+}
+
+// NOTE (Pedro): Prints pre-decoded instructions into memory so decoding and write() stay out of it
+static void BenchPrint(bench_config *Config, u8 *Image, u64 ImageSize, bench_result *Result)
+{
+    instruction *Instructions = (instruction *)malloc(BENCH_PRINT_INSTRUCTIONS * sizeof(instruction));
+    buffer Buffer = {Image, ImageSize, 0, 0};
+
+    u32 Count = 0;
+    while((Count < BENCH_PRINT_INSTRUCTIONS) && (Buffer.IndexPtr < Buffer.Count))
+    {
+        Instructions[Count] = ParseInstruction(&Buffer);
+        if(Instructions[Count].OpType == op_unknown)
+        {
+            break;
+        }
+        Count++;
+    }
+
+    Result->Name = "print";
+    Result->Bytes = Buffer.IndexPtr;
+    Result->Instructions = Count;
+
+    output_buffer Out;
+    InitOutput(&Out, -1);
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        double StartTime = GetSeconds();
+        for(u32 Index = 0; Index < Count; Index++)
+        {
+            if(Out.Used > (OUTPUT_BUFFER_SIZE - MAX_OUTPUT_LINE))
+            {
+                Out.Used = 0;
+            }
+            PrintInstruction(&Instructions[Index], &Out);
+        }
+        double Seconds = GetSeconds() - StartTime;
+
+        Out.Used = 0;
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+
+    FreeOutput(&Out);
+    free(Instructions);
+}
+
+// NOTE (Pedro): "execute" is whatever back end the build defaults to, so the baseline keeps
+// tracking the one that ships. The others are listed by name to compare side by side.
+static const char *ExecuteNames[Dispatch_Count] =
+{
+    "execute",
+    "execute-call",
+    "execute-switch",
+    "execute-goto",
+    "execute-tail",
+    "execute-generic",
+};
+
+static void BenchExecute(bench_config *Config, bool UseCache, execute_dispatch Dispatch, bench_result *Result)
+{
+    memory_arena Arena;
+    InitArena(&Arena, ARENA_CONTEXT_RESERVE);
+
+    machine Machine;
+    InitMachine(&Machine, &Arena);
+    Machine.Image.ProgramSize = GenerateProgram(Config, Machine.Image.Bytes);
+    Machine.ProgramSize = Machine.Image.ProgramSize;
+    ForkMemory(&Machine.Memory, &Machine.Image, &Machine.Pool);
+    Machine.Cache = UseCache ? CreateBlockCache(&Arena) : 0;
+    Machine.Dispatch = Dispatch;
+
+    Result->Name = UseCache ? ExecuteNames[Dispatch] : "execute-nocache";
+    Result->Bytes = 0;
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        Machine.Regs = {};
+        Machine.IP = 0;
+        Machine.Flags = 0;
+        Machine.LazyFlags = {};
+        Machine.InstructionCount = 0;
+
+        double StartTime = GetSeconds();
+        ExecuteProgram(&Machine);
+        double Seconds = GetSeconds() - StartTime;
+
+        Result->Instructions = Machine.InstructionCount;
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+
+    FreeArena(&Arena);
+}
+
+// NOTE (Pedro): The second half of the program, over and over from a snapshot taken halfway. Every
+// rep restores the snapshot first, so this is the run plus the pages it dirtied being dropped.
+static void BenchRestore(bench_config *Config, bench_result *Result)
+{
+    memory_arena Arena;
+    InitArena(&Arena, ARENA_CONTEXT_RESERVE);
+
+    machine Machine;
+    InitMachine(&Machine, &Arena);
+    Machine.Image.ProgramSize = GenerateProgram(Config, Machine.Image.Bytes);
+    Machine.ProgramSize = Machine.Image.ProgramSize;
+    ForkMemory(&Machine.Memory, &Machine.Image, &Machine.Pool);
+    Machine.Cache = CreateBlockCache(&Arena);
+
+    machine_snapshot Start;
+    TakeSnapshot(&Machine, &Start);
+    ExecuteProgram(&Machine);
+
+    u64 Total = Machine.InstructionCount;
+    RestoreSnapshot(&Machine, &Start);
+    Machine.InstructionLimit = Total / 2;
+    ExecuteProgram(&Machine);
+    Machine.InstructionLimit = 0;
+
+    machine_snapshot Halfway;
+    TakeSnapshot(&Machine, &Halfway);
+
+    Result->Name = "execute-restore";
+    Result->Bytes = 0;
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        double StartTime = GetSeconds();
+        RestoreSnapshot(&Machine, &Halfway);
+        ExecuteProgram(&Machine);
+        double Seconds = GetSeconds() - StartTime;
+
+        Result->Instructions = Machine.InstructionCount - Halfway.InstructionCount;
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+    }
+
+    FreeArena(&Arena);
+}
+
+// NOTE (Pedro): The same lanes through RunLockstep, or one after another on the plain executor
+static void BenchLanes(bench_config *Config, bool Lockstep, bench_result *Result)
+{
+    memory_arena Arena;
+    InitArena(&Arena, ARENA_IMAGE_RESERVE);
+
+    machine Scratch;
+    InitMachine(&Scratch, &Arena);
+    Scratch.Cache = CreateBlockCache(&Arena);
+
+    bench_config LaneConfig = *Config;
+    LaneConfig.LoopCount = (Config->LoopCount > BENCH_LANE_LOOP_DIVISOR) ? (Config->LoopCount / BENCH_LANE_LOOP_DIVISOR) : 1;
+
+    Scratch.Image.ProgramSize = GenerateProgram(&LaneConfig, Scratch.Image.Bytes);
+    Scratch.ProgramSize = Scratch.Image.ProgramSize;
+    ForkMemory(&Scratch.Memory, &Scratch.Image, &Scratch.Pool);
+
+    Result->Name = Lockstep ? "lanes-lockstep" : "lanes-scalar";
+    Result->Bytes = 0;
+
+    for(u32 Rep = 0; Rep < (Config->Warmup + Config->Reps); Rep++)
+    {
+        temporary_memory Temp = BeginTemporaryMemory(&Arena);
+
+        lockstep_batch Batch;
+        InitLockstepBatch(&Batch, BENCH_LANES, &Scratch, &Arena);
+        SeedLaneRegisters(&Batch, Config->Seed);
+
+        double StartTime = GetSeconds();
+        if(Lockstep)
+        {
+            RunLockstep(&Batch, &Scratch);
+        }
+        else
+        {
+            RunLanesScalar(&Batch, &Scratch);
+        }
+        double Seconds = GetSeconds() - StartTime;
+
+        Result->Instructions = 0;
+        for(u32 Lane = 0; Lane < Batch.LaneCount; Lane++)
+        {
+            Result->Instructions += Batch.InstructionCount[Lane];
+        }
+
+        if(Rep >= Config->Warmup)
+        {
+            Result->Seconds[Result->Reps++] = Seconds;
+        }
+
+        EndTemporaryMemory(Temp);
+    }
+
+    FreeArena(&Arena);
+}
+
+static int CompareSeconds(const void *A, const void *B)
+{
+    double Left = *(double *)A;
+    double Right = *(double *)B;
+    return (Left > Right) - (Left < Right);
+}
+
+// NOTE (Pedro): Seconds must already be sorted
+static double GetPercentile(bench_result *Bench, u32 Percent)
+{
+    double Result = Bench->Seconds[((Bench->Reps - 1) * Percent) / 100];
+    return Result;
+}
+
+static double GetNsPerInstruction(bench_result *Bench)
+{
+    double Result = Bench->Instructions ? (GetPercentile(Bench, 50) * 1e9) / Bench->Instructions : 0;
+    return Result;
+}
+
+static void ReportResult(bench_result *Result)
+{
+    qsort(Result->Seconds, Result->Reps, sizeof(double), CompareSeconds);
+
+    double Median = GetPercentile(Result, 50);
+    printf("%-16s %10llu instr  min %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f ms  ",
+           Result->Name, (unsigned long long)Result->Instructions,
+           Result->Seconds[0] * 1e3, Median * 1e3,
+           GetPercentile(Result, 90) * 1e3, GetPercentile(Result, 99) * 1e3);
+
+    if(Result->Bytes)
+    {
+        printf("%8.2f MB/s  ", (Result->Bytes / (1024.0 * 1024.0)) / Median);
+    }
+    printf("%8.2f M instr/s  %6.2f ns/instr\n", (Result->Instructions / 1e6) / Median, GetNsPerInstruction(Result));
+}
+
+// NOTE (Pedro): Baseline lines are "name ns_per_instruction", the p50 of each harness
+static void SaveBaseline(const char *FileName, bench_result *Results, u32 ResultCount)
+{
+    FILE *File = fopen(FileName, "w");
+    if(!File)
+    {
+        fprintf(stderr, "ERROR: Unable to write baseline %s\n", FileName);
+        return;
+    }
+
+    for(u32 Index = 0; Index < ResultCount; Index++)
+    {
+        fprintf(File, "%s %.4f\n", Results[Index].Name, GetNsPerInstruction(&Results[Index]));
+    }
+
+    fclose(File);
+    printf("\nSaved baseline to %s\n", FileName);
+}
+
+// NOTE (Pedro): Returns the number of harnesses slower than the baseline by more than the threshold
+static u32 CompareBaseline(FILE *File, bench_config *Config, bench_result *Results, u32 ResultCount)
+{
+    u32 Regressions = 0;
+    char Name[64];
+    double BaselineNs;
+
+    printf("\n%-16s %10s %10s %8s\n", "baseline", "ns/instr", "now", "change");
+    while(fscanf(File, "%63s %lf", Name, &BaselineNs) == 2)
+    {
+        for(u32 Index = 0; Index < ResultCount; Index++)
+        {
+            if(strcmp(Results[Index].Name, Name) == 0)
+            {
+                double Now = GetNsPerInstruction(&Results[Index]);
+                double Change = BaselineNs ? ((Now - BaselineNs) * 100.0) / BaselineNs : 0;
+                bool Regressed = Change > Config->Threshold;
+                Regressions += Regressed;
+
+                printf("%-16s %10.2f %10.2f %+7.1f%%%s\n", Name, BaselineNs, Now, Change,
+                       Regressed ? "  REGRESSION" : "");
+            }
+        }
+    }
+
+    return Regressions;
+}
+
+static bool ParseWeights(char *String, u32 *Weights, u32 Count)
+{
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        char *End;
+        Weights[Index] = strtoul(String, &End, 10);
+        if((End == String) || ((Index + 1 < Count) && (*End != ',')))
+        {
+            return false;
+        }
+        String = End + 1;
+    }
+
+    return true;
+}
+
+int main(int ArgCount, char **Args)
+{
+    bench_config Config = {};
+    u32 DefaultFamilies[Family_Count] = {40, 20, 15, 15, 10};
+    u32 DefaultModes[Mode_Count] = {40, 20, 25, 15};
+    memcpy(Config.FamilyWeights, DefaultFamilies, sizeof(DefaultFamilies));
+    memcpy(Config.ModeWeights, DefaultModes, sizeof(DefaultModes));
+    Config.ImmediatePercent = 30;
+    Config.ImageSize = 8 * 1024 * 1024;
+    Config.Seed = 0x8086;
+    Config.Warmup = 2;
+    Config.Reps = 15;
+    Config.LoopCount = 1000;
+    Config.Threshold = 10.0;
+
+    char *BaselineName = 0;
+    bool Save = false;
+    bool Usage = false;
+
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+    {
+        char *Arg = Args[ArgIndex];
+        char *Value = (ArgIndex + 1 < ArgCount) ? Args[ArgIndex + 1] : 0;
+
+        if(strcmp(Arg, "-save") == 0)
+        {
+            Save = true;
+        }
+        else if(!Value)
+        {
+            Usage = true;
+        }
+        else if(strcmp(Arg, "-size") == 0)
+        {
+            Config.ImageSize = strtoull(Value, 0, 10) * 1024 * 1024;
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-seed") == 0)
+        {
+            Config.Seed = strtoull(Value, 0, 0);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-warmup") == 0)
+        {
+            Config.Warmup = atoi(Value);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-reps") == 0)
+        {
+            Config.Reps = atoi(Value);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-loops") == 0)
+        {
+            Config.LoopCount = atoi(Value);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-imm") == 0)
+        {
+            Config.ImmediatePercent = atoi(Value);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-threshold") == 0)
+        {
+            Config.Threshold = atof(Value);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-mix") == 0)
+        {
+            Usage |= !ParseWeights(Value, Config.FamilyWeights, Family_Count);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-modes") == 0)
+        {
+            Usage |= !ParseWeights(Value, Config.ModeWeights, Mode_Count);
+            ArgIndex++;
+        }
+        else if(strcmp(Arg, "-baseline") == 0)
+        {
+            BaselineName = Value;
+            ArgIndex++;
+        }
+        else
+        {
+            Usage = true;
+        }
+    }
+
+    if((Config.Reps < 1) || ((Config.Reps + Config.Warmup) > BENCH_MAX_REPS) ||
+       (Config.LoopCount < 1) || (Config.LoopCount > 0xFFFF) || (Config.ImageSize == 0))
+    {
+        Usage = true;
+    }
+
+    if(Usage)
+    {
+        fprintf(stderr, "USAGE: %s [-size MB] [-seed N] [-warmup N] [-reps N] [-loops N]\n"
+                        "       [-mix mov,add,sub,cmp,jcc] [-modes reg,mem,disp8,disp16] [-imm PERCENT]\n"
+                        "       [-baseline FILE [-save] [-threshold PERCENT]]\n", Args[0]);
+        return 1;
+    }
+
+    u64 ImageSize;
+    u8 *Image = GenerateImage(&Config, &ImageSize);
+
+    printf("Image: %.2f MB, seed 0x%llx, %u warmup + %u reps\n\n",
+           ImageSize / (1024.0 * 1024.0), (unsigned long long)Config.Seed, Config.Warmup, Config.Reps);
+
+    bench_result *Results = (bench_result *)calloc(BENCH_MAX_RESULTS, sizeof(bench_result));
+    u32 ResultCount = 0;
+
+    BenchParse(&Config, Image, ImageSize, &Results[ResultCount++]);
+    BenchDecodeBatch(&Config, Image, ImageSize, &Results[ResultCount++]);
+    BenchLength(&Config, Image, ImageSize, &Results[ResultCount++]);
+    BenchPrint(&Config, Image, ImageSize, &Results[ResultCount++]);
+    for(u32 Dispatch = Dispatch_Default; Dispatch < Dispatch_Count; Dispatch++)
+    {
+        BenchExecute(&Config, true, (execute_dispatch)Dispatch, &Results[ResultCount++]);
+    }
+    BenchExecute(&Config, false, Dispatch_Default, &Results[ResultCount++]);
+    BenchRestore(&Config, &Results[ResultCount++]);
+    BenchLanes(&Config, true, &Results[ResultCount++]);
+    BenchLanes(&Config, false, &Results[ResultCount++]);
+
+    for(u32 Index = 0; Index < ResultCount; Index++)
+    {
+        ReportResult(&Results[Index]);
+    }
+
+    // A missing baseline is written by this run, -save replaces an existing one
+    u32 Regressions = 0;
+    if(BaselineName)
+    {
+        FILE *Baseline = Save ? 0 : fopen(BaselineName, "r");
+        if(Baseline)
+        {
+            Regressions = CompareBaseline(Baseline, &Config, Results, ResultCount);
+            fclose(Baseline);
+        }
+        else
+        {
+            SaveBaseline(BaselineName, Results, ResultCount);
+        }
+    }
+
+    free(Results);
+    free(Image);
+
+    return Regressions ? 1 : 0;
+}
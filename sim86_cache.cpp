@@ -0,0 +1,280 @@
+#include <string.h>
+
+#include "sim86_cache.h"
+#include "sim86_decode.h"
+#include "sim86_display.h"
+#include "sim86_clocks.h"
+
+// NOTE (Pedro): The cache and its pools come from Arena and live as long as it does
+block_cache *CreateBlockCache(memory_arena *Arena)
+{
+    block_cache *Cache = PushStruct(Arena, block_cache);
+    Cache->Blocks = PushArray(Arena, BLOCK_POOL_SIZE, code_block);
+    Cache->Ops = PushArray(Arena, MICRO_OP_POOL_SIZE, micro_op);
+
+    return Cache;
+}
+
+// NOTE (Pedro): Pools are bump allocated, invalidated blocks are only reclaimed when everything is
+// dropped. A few blocks only touched a few slots, clearing just those keeps resets between small
+// programs cheap. Invalidated blocks are cleared again, which is harmless.
+void FlushBlockCache(block_cache *Cache)
+{
+    if((Cache->BlockCount * MAX_BLOCK_BYTES) < CODE_SEGMENT_SIZE)
+    {
+        for(u32 BlockIndex = 0; BlockIndex < Cache->BlockCount; BlockIndex++)
+        {
+            code_block *Block = &Cache->Blocks[BlockIndex];
+            Cache->BlockIndex[Block->StartIP] = 0;
+            memset(Cache->CodeBytes + Block->StartIP, 0, (Block->EndIP - Block->StartIP) * sizeof(u16));
+        }
+    }
+    else
+    {
+        memset(Cache->BlockIndex, 0, sizeof(Cache->BlockIndex));
+        memset(Cache->CodeBytes, 0, sizeof(Cache->CodeBytes));
+    }
+    Cache->BlockCount = 0;
+    Cache->OpCount = 0;
+    Cache->Flushes++;
+}
+
+// NOTE (Pedro): Flush plus cleared counters, for reusing a cache on another program
+void ResetBlockCache(block_cache *Cache)
+{
+    FlushBlockCache(Cache);
+
+    Cache->Lookups = 0;
+    Cache->Misses = 0;
+    Cache->Invalidations = 0;
+    Cache->Flushes = 0;
+    memset(Cache->FusionHits, 0, sizeof(Cache->FusionHits));
+}
+
+static void DecodeMicroOperand(instruction_operand *Operand, micro_op *Op, u8 *Kind, u8 *Register)
+{
+    *Kind = Operand->Type;
+    *Register = unknown;
+
+    switch(Operand->Type)
+    {
+        case Operand_Register:
+        {
+            *Register = Operand->Register;
+        } break;
+
+        case Operand_Memory:
+        {
+            if(Operand->Memory.Flags.Memory_HasDirectAddress)
+            {
+                Op->Disp = Operand->Memory.DirectAddress;
+            }
+            else
+            {
+                *Register = Operand->Memory.Register;
+                Op->Disp = Operand->Memory.Displacement;
+            }
+        } break;
+
+        case Operand_Immediate:
+        {
+            Op->Imm = Operand->Immediate.Value;
+        } break;
+
+        default:
+        {
+        } break;
+    }
+}
+
+micro_op DecodeMicroOp(instruction *Instruction)
+{
+    micro_op Op = {};
+    Op.OpType = Instruction->OpType;
+    Op.Flags = Instruction->WBit ? MicroOp_Wide : 0;
+    Op.Length = Instruction->Size;
+
+    DecodeMicroOperand(&Instruction->Operands[0], &Op, &Op.DestKind, &Op.DestReg);
+    DecodeMicroOperand(&Instruction->Operands[1], &Op, &Op.SourceKind, &Op.SourceReg);
+
+    instruction_clocks Clocks = GetInstructionClocks(Instruction);
+    Op.Clocks = Clocks.Base + Clocks.EA;
+
+    Op.Handler = (u8)GetHandlerIndex(Op.OpType, Op.DestKind, Op.SourceKind, Op.Flags & MicroOp_Wide);
+
+    return Op;
+}
+
+static bool IsBlockEnd(operation_types OpType)
+{
+    bool Result = (OpType >= jne) && (OpType <= jcxz);
+    return Result;
+}
+
+// NOTE (Pedro): Folds a jump into the cmp/sub right before it. The compare keeps its operands,
+// the jump rides along in BranchOp/BranchDisp and the lengths add up so IP lands past both.
+// A sub into memory can rewrite its own jump, which then has to be decoded again, so it stays apart.
+static bool TryFuseBranch(micro_op *Compare, micro_op *Jump)
+{
+    if((Compare->OpType != cmp) && (Compare->OpType != sub))
+    {
+        return false;
+    }
+
+    if((Compare->OpType == sub) && (Compare->DestKind == Operand_Memory))
+    {
+        return false;
+    }
+
+    Compare->OpType = (Compare->OpType == cmp) ? MicroOp_FusedCmp : MicroOp_FusedSub;
+    Compare->BranchOp = Jump->OpType;
+    Compare->BranchDisp = (s8)Jump->Imm;
+    Compare->Length += Jump->Length;
+    Compare->Handler = (u8)GetHandlerIndex(Compare->OpType, Compare->DestKind, Compare->SourceKind,
+                                           Compare->Flags & MicroOp_Wide);
+
+    return true;
+}
+
+static code_block *BuildBlock(block_cache *Cache, u8 *Memory, u32 ProgramSize, u16 IP)
+{
+    if(((Cache->OpCount + MAX_BLOCK_OPS) > MICRO_OP_POOL_SIZE) || (Cache->BlockCount == BLOCK_POOL_SIZE))
+    {
+        FlushBlockCache(Cache);
+    }
+
+    code_block *Block = &Cache->Blocks[Cache->BlockCount];
+    Block->StartIP = IP;
+    Block->FirstOp = Cache->OpCount;
+    Block->OpCount = 0;
+    Block->InstructionCount = 0;
+
+    // Instructions can't run past the loaded program, a truncated one decodes as unknown
+    buffer Buffer = {Memory, ProgramSize, IP, 0};
+    while((Block->OpCount < MAX_BLOCK_OPS) &&
+          (Buffer.IndexPtr < ProgramSize) &&
+          ((Buffer.IndexPtr - IP) <= (MAX_BLOCK_BYTES - MAX_INSTRUCTION_SIZE)))
+    {
+        instruction Instruction = ParseInstruction(&Buffer);
+        if(Instruction.OpType == op_unknown)
+        {
+            break;
+        }
+
+        micro_op *Op = &Cache->Ops[Block->FirstOp + Block->OpCount];
+        *Op = DecodeMicroOp(&Instruction);
+        Block->InstructionCount++;
+
+        if(IsBlockEnd(Instruction.OpType))
+        {
+            if(!Block->OpCount || !TryFuseBranch(Op - 1, Op))
+            {
+                Block->OpCount++;
+            }
+            break;
+        }
+
+        Block->OpCount++;
+    }
+
+    if(Block->OpCount == 0)
+    {
+        return 0;
+    }
+
+    Block->EndIP = (u32)Buffer.IndexPtr;
+    for(u32 Address = Block->StartIP; Address < Block->EndIP; Address++)
+    {
+        Cache->CodeBytes[Address]++;
+    }
+
+    Cache->OpCount += Block->OpCount;
+    Cache->BlockIndex[IP] = ++Cache->BlockCount;
+
+    return Block;
+}
+
+// NOTE (Pedro): Returns 0 if no instruction at IP can be decoded
+code_block *GetBlock(block_cache *Cache, u8 *Memory, u32 ProgramSize, u16 IP)
+{
+    Cache->Lookups++;
+
+    u32 Index = Cache->BlockIndex[IP];
+    if(Index)
+    {
+        return &Cache->Blocks[Index - 1];
+    }
+
+    Cache->Misses++;
+    return BuildBlock(Cache, Memory, ProgramSize, IP);
+}
+
+// NOTE (Pedro): Drops every block covering Address. Returns true if any did, so the executor
+// knows the ops it is running may be stale
+bool InvalidateCode(block_cache *Cache, u16 Address)
+{
+    if(!Cache->CodeBytes[Address])
+    {
+        return false;
+    }
+
+    u32 FirstStart = (Address >= MAX_BLOCK_BYTES) ? (Address - MAX_BLOCK_BYTES + 1) : 0;
+    for(u32 Start = FirstStart; Start <= Address; Start++)
+    {
+        u32 Index = Cache->BlockIndex[Start];
+        if(Index && (Cache->Blocks[Index - 1].EndIP > Address))
+        {
+            code_block *Block = &Cache->Blocks[Index - 1];
+            for(u32 Covered = Block->StartIP; Covered < Block->EndIP; Covered++)
+            {
+                Cache->CodeBytes[Covered]--;
+            }
+
+            Cache->BlockIndex[Start] = 0;
+            Cache->Invalidations++;
+        }
+    }
+
+    return true;
+}
+
+void PrintCacheStats(block_cache *Cache, output_buffer *Out)
+{
+    u64 Hits = Cache->Lookups - Cache->Misses;
+
+    ReserveOutput(Out, 2 * MAX_OUTPUT_LINE);
+    AppendString(Out, "Block cache: ");
+    AppendU64(Out, Cache->Lookups);
+    AppendString(Out, " lookups, ");
+    AppendU64(Out, Hits);
+    AppendString(Out, " hits (");
+    AppendU32(Out, Cache->Lookups ? (u32)((Hits * 1000) / Cache->Lookups) / 10 : 0);
+    AppendString(Out, ".");
+    AppendU32(Out, Cache->Lookups ? (u32)((Hits * 1000) / Cache->Lookups) % 10 : 0);
+    AppendString(Out, "%), ");
+    AppendU64(Out, Cache->Misses);
+    AppendString(Out, " blocks built, ");
+    AppendU64(Out, Cache->Invalidations);
+    AppendString(Out, " invalidated, ");
+    AppendU64(Out, Cache->Flushes);
+    AppendString(Out, " flushes\n");
+
+    for(u32 FusedIndex = 0; FusedIndex < FUSED_OP_COUNT; FusedIndex++)
+    {
+        for(u32 Branch = 0; Branch < op_unknown; Branch++)
+        {
+            u64 Hits = Cache->FusionHits[FusedIndex][Branch];
+            if(Hits)
+            {
+                ReserveOutput(Out, MAX_OUTPUT_LINE);
+                AppendString(Out, "Fused ");
+                AppendString(Out, (FusedIndex == 0) ? "cmp" : "sub");
+                AppendString(Out, " + ");
+                AppendString(Out, GetMnemonic((operation_types)Branch));
+                AppendString(Out, ": ");
+                AppendU64(Out, Hits);
+                AppendString(Out, "\n");
+            }
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef SIM86_CACHE_H
+#define SIM86_CACHE_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+
+// NOTE (Pedro): A block is straight-line code ending at a jump/loop, capped so that the blocks
+// covering any byte can be found by scanning at most MAX_BLOCK_BYTES start addresses
+#define MAX_BLOCK_OPS 64
+#define MAX_BLOCK_BYTES 256
+
+#define BLOCK_POOL_SIZE (16 * 1024)
+#define MICRO_OP_POOL_SIZE (256 * 1024)
+
+// NOTE (Pedro): Code lives in the first 64 KB (CS = 0), so every IP gets a slot
+#define CODE_SEGMENT_SIZE 0x10000
+
+typedef enum micro_op_flags
+{
+    MicroOp_Wide = 0x1,
+} micro_op_flags;
+
+// NOTE (Pedro): Micro-op types past operation_types. A cmp or sub immediately followed by a
+// jump/loop runs as one op that branches straight off the compared values.
+typedef enum fused_op_types
+{
+    MicroOp_FusedCmp = op_unknown + 1,
+    MicroOp_FusedSub,
+} fused_op_types;
+
+#define FUSED_OP_COUNT 2
+
+// NOTE (Pedro): Every op is bound to a handler compiled for its exact operation, destination
+// kind, source kind and width, so running it never switches on any of them. Data ops (mov, add,
+// sub, cmp and the two fused ops) take 2 destination kinds * 3 source kinds * 2 widths slots
+// each, jumps one per operation. Anything else runs the generic handler.
+#define HANDLER_DATA_OPS 6
+#define HANDLER_JUMP_BASE (HANDLER_DATA_OPS * 2 * 3 * 2)
+#define HANDLER_GENERIC (HANDLER_JUMP_BASE + (ret - jne + 1))
+#define HANDLER_COUNT (HANDLER_GENERIC + 1)
+
+// NOTE (Pedro): Decoded form the executor runs from. Memory operands are a base register
+// (unknown for a direct address) plus Disp, so computing the address never branches on the mode
+typedef struct micro_op
+{
+    u8 OpType;      // operation_types
+    u8 Flags;       // micro_op_flags
+    u8 Length;      // Encoded size, added to IP before the op runs
+    u8 DestKind;    // operand_types
+    u8 SourceKind;
+    u8 DestReg;     // register_id, effective address base when the operand is memory
+    u8 SourceReg;
+    u8 BranchOp;    // Fused jump/loop operation_types
+    s8 BranchDisp;  // Its IP increment
+    u8 Clocks;      // 8086 clocks including EA, not taken for jumps. Only the cmp/sub of a fused op
+    u8 Handler;     // Index of the specialized handler, see GetHandlerIndex
+    u16 Disp;       // Memory displacement or direct address
+    u16 Imm;        // Immediate data or jump displacement
+} micro_op;
+
+// NOTE (Pedro): Shared by the binding in the decode cache and the handler table the executor
+// builds at compile time, which decodes the index back into template arguments
+static constexpr u32 GetHandlerIndex(u32 OpType, u32 DestKind, u32 SourceKind, u32 Wide)
+{
+    if((OpType >= jne) && (OpType <= ret))
+    {
+        return HANDLER_JUMP_BASE + (OpType - jne);
+    }
+
+    u32 DataOp = (OpType <= cmp) ? OpType :
+                 (OpType == MicroOp_FusedCmp) ? 4 :
+                 (OpType == MicroOp_FusedSub) ? 5 : HANDLER_DATA_OPS;
+
+    bool Valid = (DataOp < HANDLER_DATA_OPS) &&
+                 ((DestKind == Operand_Register) || (DestKind == Operand_Memory)) &&
+                 ((SourceKind == Operand_Register) || (SourceKind == Operand_Memory) || (SourceKind == Operand_Immediate));
+    if(!Valid)
+    {
+        return HANDLER_GENERIC;
+    }
+
+    u32 Result = (DataOp * 12) + ((DestKind - Operand_Register) * 6) + ((SourceKind - Operand_Register) * 2) + (Wide ? 1 : 0);
+    return Result;
+}
+
+typedef struct code_block
+{
+    u32 StartIP;
+    u32 EndIP;      // One past the last byte
+    u32 FirstOp;    // Index into block_cache::Ops
+    u32 OpCount;
+    u32 InstructionCount;   // 8086 instructions, fused ops count twice
+} code_block;
+
+typedef struct block_cache
+{
+    u32 BlockIndex[CODE_SEGMENT_SIZE];  // Index into Blocks + 1, 0 when no block starts there
+    u16 CodeBytes[CODE_SEGMENT_SIZE];   // Number of live blocks covering each byte
+
+    code_block *Blocks;
+    u32 BlockCount;
+
+    micro_op *Ops;
+    u32 OpCount;
+
+    u64 Lookups;
+    u64 Misses;
+    u64 Invalidations;
+    u64 Flushes;
+
+    // Executions of each fused pair, indexed by fused op and jump operation
+    u64 FusionHits[FUSED_OP_COUNT][op_unknown];
+} block_cache;
+
+block_cache *CreateBlockCache(memory_arena *Arena);
+void FlushBlockCache(block_cache *Cache);
+void ResetBlockCache(block_cache *Cache);
+
+micro_op DecodeMicroOp(instruction *Instruction);
+code_block *GetBlock(block_cache *Cache, u8 *Memory, u32 ProgramSize, u16 IP);
+bool InvalidateCode(block_cache *Cache, u16 Address);
+
+void PrintCacheStats(block_cache *Cache, output_buffer *Out);
+
+#endif
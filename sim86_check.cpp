@@ -0,0 +1,833 @@
+// NOTE (Pedro): Check driver, a third unity build next to sim86.cpp and sim86_bench.cpp. Runs
+// seeded random programs and images down paths that have to agree with each other, and prints
+// every seed that doesn't. "make check" runs it along with the listing checks.
+#include "sim86.h"
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sim86_display.h"
+#include "sim86_table.h"
+#include "sim86_execute.h"
+#include "sim86_loader.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+#include "sim86_memory.h"
+#include "sim86_decode.h"
+#include "sim86_length.h"
+#include "sim86_parallel.h"
+#include "sim86_flow.h"
+#include "sim86_cache.h"
+#include "sim86_clocks.h"
+#include "sim86_format.h"
+#include "sim86_timer.h"
+#include "sim86_stats.h"
+#include "sim86_snapshot.h"
+#include "sim86_lockstep.h"
+#include "sim86_run.h"
+
+#include "sim86_output.cpp"
+#include "sim86_arena.cpp"
+#include "sim86_memory.cpp"
+#include "sim86_stats.cpp"
+#include "sim86_decode.cpp"
+#include "sim86_length.cpp"
+#include "sim86_display.cpp"
+#include "sim86_format.cpp"
+#include "sim86_loader.cpp"
+#include "sim86_parallel.cpp"
+#include "sim86_flow.cpp"
+#include "sim86_clocks.cpp"
+#include "sim86_cache.cpp"
+#include "sim86_execute.cpp"
+#include "sim86_snapshot.cpp"
+#include "sim86_lockstep.cpp"
+#include "sim86_run.cpp"
+
+#define CHECK_PROGRAM_SEEDS 200
+#define CHECK_IMAGE_SEEDS 60
+
+// NOTE (Pedro): Programs stay well inside the segment so stores above 8000h land on data. Every
+// other image seed is big enough for the boundary index to split it between streams.
+#define CHECK_PROGRAM_SIZE 2048
+#define CHECK_SMALL_IMAGE_SIZE 4096
+#define CHECK_LARGE_IMAGE_SIZE (256 * 1024)
+#define CHECK_INSTRUCTION_LIMIT 30000
+
+// NOTE (Pedro): Small enough that batches split every image in many places
+#define CHECK_BATCH_CAPACITY 7
+
+typedef struct random_series
+{
+    u64 State;
+} random_series;
+
+static u32 RandomU32(random_series *Series)
+{
+    // xorshift64*
+    u64 X = Series->State;
+    X ^= X >> 12;
+    X ^= X << 25;
+    X ^= X >> 27;
+    Series->State = X;
+
+    u32 Result = (u32)((X * 0x2545F4914F6CDD1Dull) >> 32);
+    return Result;
+}
+
+static u32 RandomChoice(random_series *Series, u32 Count)
+{
+    u32 Result = RandomU32(Series) % Count;
+    return Result;
+}
+
+static random_series SeedSeries(u64 Seed, u64 Stream)
+{
+    random_series Result = {(Seed + 1) * 0x9E3779B97F4A7C15ull ^ Stream};
+    return Result;
+}
+
+static u32 FailureCount;
+
+// NOTE (Pedro): On stdout, stderr is off while the programs run
+static void ReportFailure(const char *Check, u64 Seed, const char *Detail, u64 Value)
+{
+    printf("FAILED: %s, seed %llu: %s (%llu)\n", Check, (unsigned long long)Seed, Detail,
+            (unsigned long long)Value);
+    FailureCount++;
+}
+
+//
+// NOTE (Pedro): Generators
+//
+
+static const u8 RegRmOps[] = {0x00, 0x01, 0x02, 0x03, 0x28, 0x29, 0x2A, 0x2B, 0x38, 0x39, 0x3A, 0x3B, 0x88, 0x89, 0x8A, 0x8B};
+static const u8 LoadOps[] = {0x02, 0x03, 0x2A, 0x2B, 0x3A, 0x3B, 0x8A, 0x8B};
+static const u8 StoreOps[] = {0x00, 0x01, 0x28, 0x29, 0x88, 0x89};
+static const u8 AccOps[] = {0x04, 0x05, 0x2C, 0x2D, 0x3C, 0x3D};
+static const u8 ImmOps[] = {0x80, 0x81, 0x82, 0x83, 0xC6, 0xC7};
+static const u8 GroupRegs[] = {0, 5, 7};    // add, sub, cmp
+static const u8 ModBits[] = {0x00, 0x40, 0x80};
+
+static bool IsJumpOpcode(u8 Opcode)
+{
+    bool Result = ((Opcode >= 0x70) && (Opcode <= 0x7F)) || ((Opcode >= 0xE0) && (Opcode <= 0xE3));
+    return Result;
+}
+
+static u32 GetDisplacementSize(u8 ModRM)
+{
+    u32 Mod = ModRM >> 6;
+    u32 Rm = ModRM & 0b111;
+    u32 Result = (Mod == 0b01) ? 1 : ((Mod == 0b10) || ((Mod == 0b00) && (Rm == 0b110))) ? 2 : 0;
+    return Result;
+}
+
+static u32 EmitRandomBytes(random_series *Series, u8 *Dest, u32 Count)
+{
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        Dest[Index] = (u8)RandomU32(Series);
+    }
+
+    return Count;
+}
+
+// NOTE (Pedro): Only what the executor runs. Stores go through [bx + 8000h..bfffh], so most land
+// on data, and a bx that wraps them onto the code checks invalidation as well. Immediates to
+// memory are often followed by a jump, which is what gets fused.
+static u32 EmitProgramInstruction(random_series *Series, u8 *Dest)
+{
+    u32 Size = 0;
+
+    switch(RandomChoice(Series, 9))
+    {
+        case 0:
+        case 1:
+        {
+            Dest[0] = RegRmOps[RandomChoice(Series, ArrayCount(RegRmOps))];
+            Dest[1] = (u8)(0xC0 | RandomChoice(Series, 64));
+            Size = 2;
+        } break;
+
+        case 2:
+        {
+            Dest[0] = LoadOps[RandomChoice(Series, ArrayCount(LoadOps))];
+            Dest[1] = (u8)(ModBits[RandomChoice(Series, ArrayCount(ModBits))] | RandomChoice(Series, 64));
+            Size = 2 + EmitRandomBytes(Series, Dest + 2, GetDisplacementSize(Dest[1]));
+        } break;
+
+        case 3:
+        {
+            Dest[0] = ImmOps[RandomChoice(Series, 4)];
+            Dest[1] = (u8)(0xC0 | (GroupRegs[RandomChoice(Series, ArrayCount(GroupRegs))] << 3) | RandomChoice(Series, 8));
+            Size = 2 + EmitRandomBytes(Series, Dest + 2, (Dest[0] == 0x81) ? 2 : 1);
+        } break;
+
+        case 4:
+        {
+            Dest[0] = (u8)(0xB0 + RandomChoice(Series, 16));
+            Size = 1 + EmitRandomBytes(Series, Dest + 1, (Dest[0] & 0x8) ? 2 : 1);
+        } break;
+
+        case 5:
+        {
+            Dest[0] = AccOps[RandomChoice(Series, ArrayCount(AccOps))];
+            Size = 1 + EmitRandomBytes(Series, Dest + 1, (Dest[0] & 1) ? 2 : 1);
+        } break;
+
+        case 6:
+        {
+            Dest[0] = StoreOps[RandomChoice(Series, ArrayCount(StoreOps))];
+            Dest[1] = (u8)(0x87 | (RandomChoice(Series, 8) << 3));
+            Dest[2] = 0;
+            Dest[3] = (u8)(0x80 | RandomChoice(Series, 0x40));
+            Size = 4;
+        } break;
+
+        case 7:
+        {
+            Dest[0] = ImmOps[RandomChoice(Series, ArrayCount(ImmOps))];
+            u8 Reg = (Dest[0] < 0xC6) ? GroupRegs[RandomChoice(Series, ArrayCount(GroupRegs))] : 0;
+            Dest[1] = (u8)(0x87 | (Reg << 3));
+            Dest[2] = 0;
+            Dest[3] = (u8)(0x80 | RandomChoice(Series, 0x40));
+            Size = 4 + EmitRandomBytes(Series, Dest + 4, ((Dest[0] == 0x81) || (Dest[0] == 0xC7)) ? 2 : 1);
+        } break;
+
+        default:
+        {
+            // Target filled in once every instruction is placed
+            Dest[0] = (u8)((RandomChoice(Series, 5) == 0) ? (0xE0 + RandomChoice(Series, 4)) : (0x70 + RandomChoice(Series, 16)));
+            Dest[1] = 0;
+            Size = 2;
+        } break;
+    }
+
+    return Size;
+}
+
+// NOTE (Pedro): Jumps land on an instruction start in reach, or just past the end, so only a
+// program that rewrites itself is ever decoded from the middle of an instruction
+static u32 GenerateProgram(random_series *Series, u8 *Program)
+{
+    u32 Starts[CHECK_PROGRAM_SIZE + 1];
+    u32 Count = 0;
+    u32 Size = 0;
+
+    u32 TargetSize = 64 + RandomChoice(Series, CHECK_PROGRAM_SIZE - 64 - MAX_INSTRUCTION_SIZE);
+    while(Size < TargetSize)
+    {
+        Starts[Count++] = Size;
+        Size += EmitProgramInstruction(Series, Program + Size);
+    }
+    Starts[Count] = Size;
+
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        u8 *At = Program + Starts[Index];
+        if(((Starts[Index + 1] - Starts[Index]) != 2) || !IsJumpOpcode(At[0]))
+        {
+            continue;
+        }
+
+        s32 Next = (s32)Starts[Index + 1];
+        u32 First = Index + 1;
+        while((First > 0) && ((Next - (s32)Starts[First - 1]) <= 128))
+        {
+            First--;
+        }
+        u32 Last = Index + 1;
+        while((Last < Count) && (((s32)Starts[Last + 1] - Next) <= 127))
+        {
+            Last++;
+        }
+
+        s32 Target = (s32)Starts[First + RandomChoice(Series, Last - First + 1)];
+        At[1] = (u8)(s8)(Target - Next);
+    }
+
+    return Size;
+}
+
+// NOTE (Pedro): Everything the decoder takes, with any addressing mode and immediates. Odd seeds
+// are big. Half the seeds end on a byte that doesn't decode followed by noise, so the sweeps
+// have to stop before the end of the image.
+static u64 GenerateImage(random_series *Series, u64 Seed, u8 *Image)
+{
+    u64 TargetSize = 1 + RandomChoice(Series, (Seed & 1) ? CHECK_LARGE_IMAGE_SIZE : CHECK_SMALL_IMAGE_SIZE);
+    u64 Size = 0;
+
+    while(Size < TargetSize)
+    {
+        u8 *Dest = Image + Size;
+        switch(RandomChoice(Series, 7))
+        {
+            case 0:
+            {
+                Dest[0] = RegRmOps[RandomChoice(Series, ArrayCount(RegRmOps))];
+                Dest[1] = (u8)RandomU32(Series);
+                Size += 2 + EmitRandomBytes(Series, Dest + 2, GetDisplacementSize(Dest[1]));
+            } break;
+
+            case 1:
+            {
+                Dest[0] = ImmOps[RandomChoice(Series, 4)];
+                Dest[1] = (u8)((RandomU32(Series) & 0xC7) | (GroupRegs[RandomChoice(Series, ArrayCount(GroupRegs))] << 3));
+                Size += 2 + EmitRandomBytes(Series, Dest + 2, GetDisplacementSize(Dest[1]) + ((Dest[0] == 0x81) ? 2 : 1));
+            } break;
+
+            case 2:
+            {
+                Dest[0] = ImmOps[4 + RandomChoice(Series, 2)];
+                Dest[1] = (u8)(RandomU32(Series) & 0xC7);
+                Size += 2 + EmitRandomBytes(Series, Dest + 2, GetDisplacementSize(Dest[1]) + ((Dest[0] & 1) ? 2 : 1));
+            } break;
+
+            case 3:
+            {
+                Dest[0] = (u8)(0xB0 + RandomChoice(Series, 16));
+                Size += 1 + EmitRandomBytes(Series, Dest + 1, (Dest[0] & 0x8) ? 2 : 1);
+            } break;
+
+            case 4:
+            {
+                Dest[0] = AccOps[RandomChoice(Series, ArrayCount(AccOps))];
+                Size += 1 + EmitRandomBytes(Series, Dest + 1, (Dest[0] & 1) ? 2 : 1);
+            } break;
+
+            case 5:
+            {
+                Dest[0] = (u8)(0xA0 + RandomChoice(Series, 4));
+                Size += 1 + EmitRandomBytes(Series, Dest + 1, 2);
+            } break;
+
+            default:
+            {
+                Dest[0] = (u8)(0x70 + RandomChoice(Series, 16));
+                Size += 1 + EmitRandomBytes(Series, Dest + 1, 1);
+            } break;
+        }
+    }
+
+    if(RandomChoice(Series, 2))
+    {
+        u8 Undecodable = 0;
+        while(OpcodeTable[Undecodable].Layout != Layout_None)
+        {
+            Undecodable++;
+        }
+
+        Image[Size++] = Undecodable;
+        Size += EmitRandomBytes(Series, Image + Size, RandomChoice(Series, 64));
+    }
+
+    return Size;
+}
+
+// NOTE (Pedro): What every other path has to agree with, ParseInstruction one instruction at a
+// time from the start until something doesn't decode. Returns the instruction count.
+static u64 SweepImage(u8 *Image, u64 Size, instruction_record *Records, u64 *Starts, u64 *End)
+{
+    buffer Buffer = {Image, Size, 0, 0};
+    u64 Count = 0;
+
+    while(Buffer.IndexPtr < Buffer.Count)
+    {
+        u64 Start = Buffer.IndexPtr;
+        instruction Instruction = ParseInstruction(&Buffer);
+        if(Instruction.OpType == op_unknown)
+        {
+            Buffer.IndexPtr = Start;
+            break;
+        }
+
+        PackInstruction(&Instruction, &Records[Count]);
+        Starts[Count] = Start;
+        Count++;
+    }
+
+    *End = Buffer.IndexPtr;
+    return Count;
+}
+
+//
+// NOTE (Pedro): Execution, every cached back end against the uncached generic loop
+//
+
+static void LoadCheckProgram(machine *Machine, u8 *Program, u32 Size)
+{
+    ResetMachine(Machine);
+    memcpy(Machine->Image.Bytes, Program, Size);
+    Machine->Image.ProgramSize = Size;
+    Machine->ProgramSize = Size;
+
+    ReleaseMemory(&Machine->Memory);
+    ForkMemory(&Machine->Memory, &Machine->Image, &Machine->Pool);
+}
+
+static void RunCheckProgram(machine *Machine, block_cache *Cache, execute_dispatch Dispatch, u64 Limit, clock_stats *Clocks)
+{
+    if(Cache)
+    {
+        ResetBlockCache(Cache);
+    }
+
+    Machine->Cache = Cache;
+    Machine->Dispatch = Dispatch;
+    Machine->InstructionLimit = Limit;
+    Machine->Clocks = Clocks;
+    ExecuteProgram(Machine);
+    Machine->Clocks = 0;
+}
+
+// NOTE (Pedro): Flags are materialized first, so a pending lazy result has to come out the same
+// as one that was already folded in
+static bool SameMachineState(machine *A, machine *B)
+{
+    MaterializeFlags(A);
+    MaterializeFlags(B);
+
+    bool Result = (memcmp(&A->Regs, &B->Regs, sizeof(regs)) == 0) && (A->IP == B->IP) &&
+                  (A->Flags == B->Flags) && (A->InstructionCount == B->InstructionCount);
+
+    for(u32 Page = 0; Result && (Page < MEMORY_PAGE_COUNT); Page++)
+    {
+        Result = (memcmp(A->Memory.Pages[Page], B->Memory.Pages[Page], MEMORY_PAGE_SIZE) == 0);
+    }
+
+    return Result;
+}
+
+static void CheckExecution(u64 Seed, u8 *Program, u32 Size, machine *Reference, machine *Test, block_cache *Cache)
+{
+    static clock_stats ReferenceClocks;
+    static clock_stats TestClocks;
+
+    for(u32 WithClocks = 0; WithClocks < 2; WithClocks++)
+    {
+        ReferenceClocks = {};
+        LoadCheckProgram(Reference, Program, Size);
+        RunCheckProgram(Reference, 0, Dispatch_Generic, CHECK_INSTRUCTION_LIMIT, WithClocks ? &ReferenceClocks : 0);
+
+        for(u32 Dispatch = Dispatch_Call; Dispatch < Dispatch_Count; Dispatch++)
+        {
+            TestClocks = {};
+            LoadCheckProgram(Test, Program, Size);
+            RunCheckProgram(Test, Cache, (execute_dispatch)Dispatch, CHECK_INSTRUCTION_LIMIT, WithClocks ? &TestClocks : 0);
+
+            if(!SameMachineState(Reference, Test))
+            {
+                ReportFailure("execute", Seed, DispatchNames[Dispatch], Test->InstructionCount);
+            }
+            else if(WithClocks && (memcmp(&ReferenceClocks, &TestClocks, sizeof(clock_stats)) != 0))
+            {
+                ReportFailure("execute -clocks", Seed, DispatchNames[Dispatch], TestClocks.Total);
+            }
+        }
+    }
+}
+
+//
+// NOTE (Pedro): Snapshots, a run split at two points through snapshot files against one straight run
+//
+
+static void SaveAndLoadSnapshot(machine *From, machine *To, output_buffer *File)
+{
+    machine_snapshot Snapshot;
+    TakeSnapshot(From, &Snapshot);
+
+    File->Used = 0;
+    AppendSnapshot(&Snapshot, File);
+
+    machine_snapshot Loaded;
+    if(LoadSnapshot(&Loaded, File->Base, File->Used))
+    {
+        RestoreSnapshot(To, &Loaded);
+    }
+}
+
+static void CheckSnapshots(u64 Seed, u8 *Program, u32 Size, machine *Reference, machine *Test, machine *Other,
+                           block_cache *Cache, output_buffer *Files)
+{
+    LoadCheckProgram(Reference, Program, Size);
+    RunCheckProgram(Reference, 0, Dispatch_Generic, CHECK_INSTRUCTION_LIMIT, 0);
+
+    // Each leg runs on the machine the last one's file was loaded into
+    LoadCheckProgram(Test, Program, Size);
+    LoadCheckProgram(Other, Program, Size);
+    RunCheckProgram(Test, Cache, Dispatch_Default, CHECK_INSTRUCTION_LIMIT / 3, 0);
+
+    machine_snapshot First;
+    TakeSnapshot(Test, &First);
+
+    SaveAndLoadSnapshot(Test, Other, &Files[0]);
+    RunCheckProgram(Other, 0, Dispatch_Default, (2 * CHECK_INSTRUCTION_LIMIT) / 3, 0);
+    SaveAndLoadSnapshot(Other, Test, &Files[1]);
+    RunCheckProgram(Test, Cache, Dispatch_Default, CHECK_INSTRUCTION_LIMIT, 0);
+
+    if(!SameMachineState(Reference, Test))
+    {
+        ReportFailure("snapshot files", Seed, "resumed twice", Test->InstructionCount);
+        return;
+    }
+
+    // Back to the first snapshot in memory, only the pages written since have to be dropped
+    RestoreSnapshot(Test, &First);
+    RunCheckProgram(Test, Cache, Dispatch_Default, CHECK_INSTRUCTION_LIMIT, 0);
+
+    if(!SameMachineState(Reference, Test))
+    {
+        ReportFailure("snapshot restore", Seed, "rerun from the first snapshot", Test->InstructionCount);
+    }
+}
+
+//
+// NOTE (Pedro): Records, the binary and JSON lines formats and decoded batches against the sweep
+//
+
+static void RunFormat(u8 *Image, u64 Size, output_format Format, run_context *Context)
+{
+    run_options Options = {};
+    Options.ThreadCount = 1;
+    Options.Format = Format;
+
+    Context->Out.Used = 0;
+    BeginImage(Context);
+
+    image_source Source;
+    OpenImageFromMemory(&Source, Image, Size);
+    RunSource(&Options, &Source, (char *)"check", Context);
+    CloseImage(&Source);
+}
+
+static bool SameRecord(instruction_record *A, instruction_record *B)
+{
+    bool Result = (memcmp(A, B, sizeof(instruction_record)) == 0);
+    return Result;
+}
+
+static void CheckBinaryRecords(u64 Seed, u8 *Image, u64 Size, instruction_record *Expected, u64 Count, run_context *Context)
+{
+    RunFormat(Image, Size, Format_Binary, Context);
+    output_buffer *Out = &Context->Out;
+
+    record_file_header Header;
+    if(Out->Used < sizeof(Header))
+    {
+        ReportFailure("binary records", Seed, "no header", Out->Used);
+        return;
+    }
+
+    memcpy(&Header, Out->Base, sizeof(Header));
+    if((Header.Magic != RECORD_FILE_MAGIC) || (Header.Version != RECORD_FILE_VERSION) ||
+       (Header.HeaderSize != sizeof(record_file_header)) || (Header.RecordSize != sizeof(instruction_record)) ||
+       (Header.OpTypeCount != op_unknown) || (Header.RegisterCount != unknown))
+    {
+        ReportFailure("binary records", Seed, "header", Header.Version);
+        return;
+    }
+
+    u64 RecordBytes = Out->Used - Header.HeaderSize;
+    if((RecordBytes % Header.RecordSize) || ((RecordBytes / Header.RecordSize) != Count))
+    {
+        ReportFailure("binary records", Seed, "record count", RecordBytes / Header.RecordSize);
+        return;
+    }
+
+    instruction_record *Records = (instruction_record *)(Out->Base + Header.HeaderSize);
+    for(u64 Index = 0; Index < Count; Index++)
+    {
+        instruction_record Record;
+        memcpy(&Record, Records + Index, sizeof(Record));
+        if(!SameRecord(&Record, &Expected[Index]))
+        {
+            ReportFailure("binary records", Seed, "record differs at address", Expected[Index].Address);
+            return;
+        }
+    }
+}
+
+// NOTE (Pedro): Every line after the file's has to start with the record's address, size and op
+static void CheckJsonLines(u64 Seed, u8 *Image, u64 Size, instruction_record *Expected, u64 Count, run_context *Context)
+{
+    RunFormat(Image, Size, Format_Json, Context);
+    output_buffer *Out = &Context->Out;
+
+    char *At = (char *)Out->Base;
+    char *End = At + Out->Used;
+    u64 LineCount = 0;
+
+    while(At < End)
+    {
+        char *LineEnd = (char *)memchr(At, '\n', End - At);
+        if(!LineEnd)
+        {
+            ReportFailure("json lines", Seed, "unterminated line", LineCount);
+            return;
+        }
+
+        if(LineCount > 0)
+        {
+            if(LineCount > Count)
+            {
+                ReportFailure("json lines", Seed, "more lines than records", LineCount);
+                return;
+            }
+
+            instruction_record *Record = &Expected[LineCount - 1];
+            char Prefix[128];
+            int PrefixSize = snprintf(Prefix, sizeof(Prefix), "{\"address\":%llu,\"size\":%u,\"op\":\"%s\"",
+                                      (unsigned long long)Record->Address, Record->Length,
+                                      GetMnemonic((operation_types)Record->OpType));
+            if(((LineEnd - At) < PrefixSize) || (memcmp(At, Prefix, PrefixSize) != 0))
+            {
+                ReportFailure("json lines", Seed, "line differs at address", Record->Address);
+                return;
+            }
+        }
+
+        LineCount++;
+        At = LineEnd + 1;
+    }
+
+    if(LineCount != (Count + 1))
+    {
+        ReportFailure("json lines", Seed, "line count", LineCount);
+    }
+}
+
+static void CheckDecodedBatches(u64 Seed, u8 *Image, u64 Size, instruction_record *Expected, u64 Count)
+{
+    u32 Offset[CHECK_BATCH_CAPACITY];
+    u8 OpType[CHECK_BATCH_CAPACITY];
+    u8 OperandKinds[CHECK_BATCH_CAPACITY];
+    u8 Register0[CHECK_BATCH_CAPACITY];
+    u8 Register1[CHECK_BATCH_CAPACITY];
+    u8 Flags[CHECK_BATCH_CAPACITY];
+    s16 Displacement[CHECK_BATCH_CAPACITY];
+    u16 Immediate[CHECK_BATCH_CAPACITY];
+    u8 Length[CHECK_BATCH_CAPACITY];
+
+    decoded_batch Batch = {CHECK_BATCH_CAPACITY, 0, 0, Offset, OpType, OperandKinds, Register0, Register1,
+                           Flags, Displacement, Immediate, Length};
+
+    buffer Buffer = {Image, Size, 0, 0};
+    u64 Decoded = 0;
+    while(DecodeBatch(&Buffer, CHECK_BATCH_CAPACITY, &Batch))
+    {
+        for(u32 Index = 0; Index < Batch.Count; Index++)
+        {
+            if(Decoded >= Count)
+            {
+                ReportFailure("decoded batches", Seed, "more rows than records", Decoded);
+                return;
+            }
+
+            instruction_record Row = {};
+            Row.Address = Batch.BaseAddress + Batch.Offset[Index];
+            Row.OpType = Batch.OpType[Index];
+            Row.OperandKinds = Batch.OperandKinds[Index];
+            Row.Register0 = Batch.Register0[Index];
+            Row.Register1 = Batch.Register1[Index];
+            Row.Displacement = Batch.Displacement[Index];
+            Row.Immediate = Batch.Immediate[Index];
+            Row.Flags = Batch.Flags[Index];
+            Row.Length = Batch.Length[Index];
+
+            if(!SameRecord(&Row, &Expected[Decoded]))
+            {
+                ReportFailure("decoded batches", Seed, "row differs at address", Expected[Decoded].Address);
+                return;
+            }
+            Decoded++;
+        }
+    }
+
+    if(Decoded != Count)
+    {
+        ReportFailure("decoded batches", Seed, "row count", Decoded);
+    }
+}
+
+//
+// NOTE (Pedro): Boundary index, every query at every offset against the sweep
+//
+
+static void CheckBoundaryIndex(u64 Seed, u8 *Image, u64 Size, u64 *Starts, u64 Count, u64 End, memory_arena *Arena)
+{
+    ResetArena(Arena);
+
+    boundary_index Index;
+    BuildBoundaryIndex(Image, Size, &Index, Arena);
+
+    if((Index.InstructionCount != Count) || (Index.End != End))
+    {
+        ReportFailure("boundary index", Seed, "instruction count", Index.InstructionCount);
+        return;
+    }
+
+    // Number is the count of starts before Address, so Starts[Number] is the next one
+    u64 Number = 0;
+    for(u64 Address = 0; Address <= Size; Address++)
+    {
+        bool IsStart = (Number < Count) && (Starts[Number] == Address);
+        u64 Next = (Number < Count) ? Starts[Number] : End;
+
+        if(IsInstructionStart(&Index, Address) != IsStart)
+        {
+            ReportFailure("boundary index", Seed, "IsInstructionStart", Address);
+            return;
+        }
+
+        if(GetInstructionNumber(&Index, Address) != Number)
+        {
+            ReportFailure("boundary index", Seed, "GetInstructionNumber", Address);
+            return;
+        }
+
+        if(GetNextInstructionStart(&Index, Address) != Next)
+        {
+            ReportFailure("boundary index", Seed, "GetNextInstructionStart", Address);
+            return;
+        }
+
+        Number += IsStart;
+    }
+
+    for(u64 Instruction = 0; Instruction <= Count; Instruction++)
+    {
+        u64 Expected = (Instruction < Count) ? Starts[Instruction] : End;
+        if(GetInstructionAddress(&Index, Instruction) != Expected)
+        {
+            ReportFailure("boundary index", Seed, "GetInstructionAddress", Instruction);
+            return;
+        }
+    }
+}
+
+int main(int ArgCount, char **Args)
+{
+    u32 ProgramSeeds = CHECK_PROGRAM_SEEDS;
+    u32 ImageSeeds = CHECK_IMAGE_SEEDS;
+    u64 FirstSeed = 1;
+
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+    {
+        if((strcmp(Args[ArgIndex], "-programs") == 0) && (ArgIndex + 1 < ArgCount))
+        {
+            ProgramSeeds = (u32)strtoul(Args[++ArgIndex], 0, 10);
+        }
+        else if((strcmp(Args[ArgIndex], "-images") == 0) && (ArgIndex + 1 < ArgCount))
+        {
+            ImageSeeds = (u32)strtoul(Args[++ArgIndex], 0, 10);
+        }
+        else if((strcmp(Args[ArgIndex], "-seed") == 0) && (ArgIndex + 1 < ArgCount))
+        {
+            FirstSeed = strtoull(Args[++ArgIndex], 0, 10);
+        }
+        else
+        {
+            fprintf(stderr, "USAGE: %s [-programs N] [-images N] [-seed First]\n", Args[0]);
+            return 1;
+        }
+    }
+
+    memory_arena Arena;
+    memory_arena ImageArena;
+    run_context Context;
+    if(!InitArena(&Arena, ARENA_IMAGE_RESERVE) || !InitArena(&ImageArena, ARENA_IMAGE_RESERVE) ||
+       !InitRunContext(&Context, -1))
+    {
+        return 1;
+    }
+
+    machine Reference;
+    machine Test;
+    machine Other;
+    InitMachine(&Reference, &Arena);
+    InitMachine(&Test, &Arena);
+    InitMachine(&Other, &Arena);
+    block_cache *Cache = CreateBlockCache(&Arena);
+
+    output_buffer Files[2];
+    InitOutput(&Files[0], -1);
+    InitOutput(&Files[1], -1);
+
+    // NOTE (Pedro): Stores that wrap onto the code can leave bytes the executor stops on, which
+    // every back end has to stop on the same way. Their errors would bury the failures.
+    fflush(stderr);
+    int ErrorHandle = dup(2);
+    int NullHandle = open("/dev/null", O_WRONLY);
+    if((ErrorHandle >= 0) && (NullHandle >= 0))
+    {
+        dup2(NullHandle, 2);
+    }
+
+    u8 *Program = (u8 *)malloc(CHECK_PROGRAM_SIZE + MAX_INSTRUCTION_SIZE);
+    for(u64 Seed = FirstSeed; Seed < (FirstSeed + ProgramSeeds); Seed++)
+    {
+        random_series Series = SeedSeries(Seed, 0);
+        u32 Size = GenerateProgram(&Series, Program);
+
+        CheckExecution(Seed, Program, Size, &Reference, &Test, Cache);
+        CheckSnapshots(Seed, Program, Size, &Reference, &Test, &Other, Cache, Files);
+    }
+
+    if((ErrorHandle >= 0) && (NullHandle >= 0))
+    {
+        fflush(stderr);
+        dup2(ErrorHandle, 2);
+    }
+    if(ErrorHandle >= 0)
+    {
+        close(ErrorHandle);
+    }
+    if(NullHandle >= 0)
+    {
+        close(NullHandle);
+    }
+
+    // Room for the biggest image plus its noise, and a record and start per byte
+    u64 MaxImageSize = CHECK_LARGE_IMAGE_SIZE + MAX_INSTRUCTION_SIZE + 64;
+    u8 *Image = (u8 *)malloc(MaxImageSize);
+    instruction_record *Records = (instruction_record *)malloc(MaxImageSize * sizeof(instruction_record));
+    u64 *Starts = (u64 *)malloc(MaxImageSize * sizeof(u64));
+
+    for(u64 Seed = FirstSeed; Seed < (FirstSeed + ImageSeeds); Seed++)
+    {
+        random_series Series = SeedSeries(Seed, 1);
+        u64 Size = GenerateImage(&Series, Seed, Image);
+
+        u64 End;
+        u64 Count = SweepImage(Image, Size, Records, Starts, &End);
+
+        CheckBinaryRecords(Seed, Image, Size, Records, Count, &Context);
+        CheckJsonLines(Seed, Image, Size, Records, Count, &Context);
+        CheckDecodedBatches(Seed, Image, Size, Records, Count);
+        CheckBoundaryIndex(Seed, Image, Size, Starts, Count, End, &ImageArena);
+    }
+
+    free(Starts);
+    free(Records);
+    free(Image);
+    free(Program);
+    FreeOutput(&Files[1]);
+    FreeOutput(&Files[0]);
+    FreeRunContext(&Context);
+    FreeArena(&ImageArena);
+    FreeArena(&Arena);
+
+    if(FailureCount)
+    {
+        printf("%u checks failed\n", FailureCount);
+        return 1;
+    }
+
+    printf("All checks passed on %u programs and %u images\n", ProgramSeeds, ImageSeeds);
+    return 0;
+}
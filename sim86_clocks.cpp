@@ -0,0 +1,245 @@
+#include "sim86_clocks.h"
+#include "sim86_display.h"
+#include "sim86_table.h"
+
+// NOTE (Pedro): Not taken / taken for every jump and loop, indexed by operation_types
+static const u8 JumpClocks[op_unknown][2] =
+{
+    /* mov */ {0, 0},
+    /* add */ {0, 0},
+    /* sub */ {0, 0},
+    /* cmp */ {0, 0},
+    /* jne */ {4, 16},
+    /* je */ {4, 16},
+    /* jl */ {4, 16},
+    /* jle */ {4, 16},
+    /* jb */ {4, 16},
+    /* jbe */ {4, 16},
+    /* jp */ {4, 16},
+    /* jo */ {4, 16},
+    /* js */ {4, 16},
+    /* jnl */ {4, 16},
+    /* jg */ {4, 16},
+    /* jnb */ {4, 16},
+    /* ja */ {4, 16},
+    /* jnp */ {4, 16},
+    /* jno */ {4, 16},
+    /* jns */ {4, 16},
+    /* loop */ {5, 17},
+    /* loopz */ {6, 18},
+    /* loopnz */ {5, 19},
+    /* jcxz */ {6, 18},
+    /* ret */ {0, 0},
+};
+
+u32 GetEAClocks(operand_memory *Memory)
+{
+    if(Memory->Flags.Memory_HasDirectAddress)
+    {
+        return 6;
+    }
+
+    u32 Result = 0;
+    switch(Memory->Register)
+    {
+        case bp_di:
+        case bx_si: Result = 7; break;
+        case bp_si:
+        case bx_di: Result = 8; break;
+        default: Result = 5; break;
+    }
+
+    // A displacement adds 4 to every form, even when it is zero ([bp + 0])
+    if(Memory->Flags.Memory_HasDisplacement)
+    {
+        Result += 4;
+    }
+
+    return Result;
+}
+
+u32 GetJumpClocks(operation_types Op, bool Taken)
+{
+    u32 Result = JumpClocks[Op][Taken ? 1 : 0];
+    return Result;
+}
+
+// NOTE (Pedro): Read-modify-write of memory is two transfers, everything else touches memory once
+u32 GetTransferCount(operation_types Op, operand_types DestKind, operand_types SourceKind)
+{
+    u32 Result = 0;
+    if(DestKind == Operand_Memory)
+    {
+        Result = ((Op == add) || (Op == sub)) ? 2 : 1;
+    }
+    else if(SourceKind == Operand_Memory)
+    {
+        Result = 1;
+    }
+
+    return Result;
+}
+
+instruction_clocks GetInstructionClocks(instruction *Instruction)
+{
+    instruction_clocks Result = {};
+
+    operation_types Op = Instruction->OpType;
+    instruction_operand *Dest = &Instruction->Operands[0];
+    instruction_operand *Source = &Instruction->Operands[1];
+
+    if((Op >= jne) && (Op <= jcxz))
+    {
+        Result.Base = JumpClocks[Op][0];
+        Result.TakenExtra = JumpClocks[Op][1] - JumpClocks[Op][0];
+        return Result;
+    }
+
+    bool DestMemory = (Dest->Type == Operand_Memory);
+    bool SourceMemory = (Source->Type == Operand_Memory);
+
+    // mov between the accumulator and a direct address has its own short form with no EA
+    bool Accumulator = (Instruction->Layout == Layout_MemToAcc) || (Instruction->Layout == Layout_AccToMem);
+
+    if(Accumulator)
+    {
+        Result.Base = 10;
+    }
+    else if(Source->Type == Operand_Immediate)
+    {
+        if(DestMemory)
+        {
+            Result.Base = ((Op == mov) || (Op == cmp)) ? 10 : 17;
+        }
+        else
+        {
+            Result.Base = 4;
+        }
+    }
+    else if(DestMemory)
+    {
+        Result.Base = ((Op == mov) || (Op == cmp)) ? 9 : 16;
+    }
+    else if(SourceMemory)
+    {
+        Result.Base = (Op == mov) ? 8 : 9;
+    }
+    else
+    {
+        Result.Base = (Op == mov) ? 2 : 3;
+    }
+
+    if(!Accumulator)
+    {
+        if(DestMemory)
+        {
+            Result.EA = GetEAClocks(&Dest->Memory);
+        }
+        else if(SourceMemory)
+        {
+            Result.EA = GetEAClocks(&Source->Memory);
+        }
+    }
+
+    Result.Transfers = GetTransferCount(Op, Dest->Type, Source->Type);
+
+    return Result;
+}
+
+// NOTE (Pedro): " ; Clocks: +N = Total (base + ea + p)" for the disassembly listing. Jumps are
+// counted as not taken, the odd address penalty only shows up for direct addresses we can see.
+void AppendInstructionClocks(instruction *Instruction, u64 *Total, output_buffer *Out)
+{
+    instruction_clocks Clocks = GetInstructionClocks(Instruction);
+
+    u32 Penalty = 0;
+    if(Instruction->WBit)
+    {
+        for(u32 Index = 0; Index < ArrayCount(Instruction->Operands); Index++)
+        {
+            operand_memory *Memory = &Instruction->Operands[Index].Memory;
+            if((Instruction->Operands[Index].Type == Operand_Memory) &&
+               Memory->Flags.Memory_HasDirectAddress && (Memory->DirectAddress & 1))
+            {
+                Penalty = Clocks.Transfers * ODD_TRANSFER_PENALTY;
+            }
+        }
+    }
+
+    u32 InstructionClocks = Clocks.Base + Clocks.EA + Penalty;
+    *Total += InstructionClocks;
+
+    AppendString(Out, " ; Clocks: +");
+    AppendU32(Out, InstructionClocks);
+    AppendString(Out, " = ");
+    AppendU64(Out, *Total);
+
+    if(Clocks.TakenExtra)
+    {
+        AppendString(Out, " (");
+        AppendU32(Out, Clocks.Base + Clocks.TakenExtra);
+        AppendString(Out, " if taken)");
+    }
+    else if(Clocks.EA || Penalty)
+    {
+        AppendString(Out, " (");
+        AppendU32(Out, Clocks.Base);
+        if(Clocks.EA)
+        {
+            AppendString(Out, " + ");
+            AppendU32(Out, Clocks.EA);
+            AppendString(Out, "ea");
+        }
+        if(Penalty)
+        {
+            AppendString(Out, " + ");
+            AppendU32(Out, Penalty);
+            AppendString(Out, "p");
+        }
+        AppendString(Out, ")");
+    }
+}
+
+static const char *OperandKindName(u32 Kind)
+{
+    static const char *Names[] = {"", "reg", "mem", "imm"};
+    return Names[Kind];
+}
+
+// NOTE (Pedro): Jumps are all counted under Operand_None, everything else by its operand kinds
+void PrintClockStats(clock_stats *Stats, output_buffer *Out)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "Clocks: ");
+    AppendU64(Out, Stats->Total);
+    AppendString(Out, "\n");
+
+    for(u32 Op = 0; Op < op_unknown; Op++)
+    {
+        for(u32 DestKind = 0; DestKind < 4; DestKind++)
+        {
+            for(u32 SourceKind = 0; SourceKind < 4; SourceKind++)
+            {
+                u64 Count = Stats->Count[Op][DestKind][SourceKind];
+                if(Count)
+                {
+                    ReserveOutput(Out, MAX_OUTPUT_LINE);
+                    AppendString(Out, "    ");
+                    AppendString(Out, GetMnemonic((operation_types)Op));
+                    if(DestKind != Operand_None)
+                    {
+                        AppendString(Out, " ");
+                        AppendString(Out, OperandKindName(DestKind));
+                        AppendString(Out, ", ");
+                        AppendString(Out, OperandKindName(SourceKind));
+                    }
+                    AppendString(Out, ": ");
+                    AppendU64(Out, Count);
+                    AppendString(Out, " executed, ");
+                    AppendU64(Out, Stats->Clocks[Op][DestKind][SourceKind]);
+                    AppendString(Out, " clocks\n");
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef SIM86_CLOCKS_H
+#define SIM86_CLOCKS_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+
+// NOTE (Pedro): 8086 clock counts from the Intel manual. Base is the not-taken count for
+// jumps/loops, TakenExtra is what a taken branch adds on top.
+typedef struct instruction_clocks
+{
+    u8 Base;
+    u8 EA;          // Effective address calculation, 0 without a ModRM memory operand
+    u8 TakenExtra;
+    u8 Transfers;   // Memory transfers, each pays 4 clocks when it's a word at an odd address
+} instruction_clocks;
+
+// NOTE (Pedro): Executed clocks broken down by operation and operand kinds (operand_types)
+typedef struct clock_stats
+{
+    u64 Total;
+    u64 Count[op_unknown][4][4];
+    u64 Clocks[op_unknown][4][4];
+} clock_stats;
+
+#define ODD_TRANSFER_PENALTY 4
+
+u32 GetEAClocks(operand_memory *Memory);
+u32 GetJumpClocks(operation_types Op, bool Taken);
+u32 GetTransferCount(operation_types Op, operand_types DestKind, operand_types SourceKind);
+instruction_clocks GetInstructionClocks(instruction *Instruction);
+
+void AppendInstructionClocks(instruction *Instruction, u64 *Total, output_buffer *Out);
+void PrintClockStats(clock_stats *Stats, output_buffer *Out);
+
+#endif
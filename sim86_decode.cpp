@@ -0,0 +1,380 @@
+#include <string.h>
+
+#include "sim86_decode.h"
+#include "sim86_table.h"
+#include "sim86_stats.h"
+
+// NOTE (Pedro): Little-endian load of a 1 or 2 byte value at offset At in the buffer, 0 when it
+// would run past the valid bytes. Reads the image in place, nothing is copied out.
+static u16 LoadValue(buffer *Buffer, u64 At, u32 Size, bool SignExtend)
+{
+    if((At + Size) > Buffer->Count)
+    {
+        return 0;
+    }
+
+    u8 *ValuePtr = Buffer->Bytes + At;
+
+    u16 Result = 0;
+    if(Size == 2)
+    {
+        Result = (ValuePtr[1] << 8) | ValuePtr[0];
+    }
+    else if(Size == 1)
+    {
+        Result = SignExtend ? (u16)(s8)ValuePtr[0] : ValuePtr[0];
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Reads the value at the decode position At and moves At past it
+static u16 ReadInstructionValue(buffer *Buffer, u64 *At, u32 Size, bool SignExtend)
+{
+    u16 Result = LoadValue(Buffer, *At, Size, SignExtend);
+    *At += Size;
+    return Result;
+}
+
+static void ParseRmEncoding(instruction *Instruction,
+                            instruction_operand *Operand,
+                            buffer *Buffer, u64 *At)
+{
+    TIMED_BLOCK(Stage_ParseRm);
+    STATS_COUNT_MODRM(Instruction->ModBits, Instruction->RmBits);
+
+    // Register mode: No displacement follows
+    if(Instruction->ModBits == 0b11)
+    {
+        Operand->Type = Operand_Register;
+        Operand->Register = RegisterLookup[Instruction->WBit][Instruction->RmBits];
+        return;
+    }
+
+    Operand->Type = Operand_Memory;
+    Operand->Memory = {};
+
+    // NOTE (pedro): Special case, 16-bit direct address follows
+    if((Instruction->ModBits == 0b00) && (Instruction->RmBits == 0b110))
+    {
+        Operand->Memory.Flags.Memory_HasDirectAddress = 0x1;
+        Operand->Memory.DirectAddress = ReadInstructionValue(Buffer, At, 2, false);
+        return;
+    }
+
+    Operand->Memory.Register = RegisterLookup[2][Instruction->RmBits];
+
+    // Memory mode: 8-bit (sign-extended) or 16-bit displacement follows
+    if(Instruction->ModBits != 0b00)
+    {
+        u8 DispSize = (Instruction->ModBits == 0b01) ? 1 : 2;
+        Operand->Memory.Flags.Memory_HasDisplacement = 0x1;
+        Operand->Memory.Displacement = (s16)ReadInstructionValue(Buffer, At, DispSize, true);
+    }
+}
+
+// NOTE (Pedro): Total encoded size from the opcode entry and the ModRM byte (ignored if there is none)
+u32 GetInstructionSize(opcode_entry Entry, u8 ModRM)
+{
+    u32 Result = 1 + Entry.DispSize + Entry.ImmSize;
+
+    if(Entry.Flags & Opcode_ModRM)
+    {
+        u8 Mod = ModRM >> 6;
+        u8 Rm = ModRM & 0b111;
+
+        Result += 1;
+        if(Mod == 0b01)
+        {
+            Result += 1;
+        }
+        else if((Mod == 0b10) || ((Mod == 0b00) && (Rm == 0b110)))
+        {
+            Result += 2;
+        }
+    }
+
+    return Result;
+}
+
+instruction ParseInstruction(buffer *Buffer)
+{
+    TIMED_BLOCK(Stage_Parse);
+
+    instruction Instruction = {};
+    Instruction.Address = Buffer->BaseOffset + Buffer->IndexPtr;
+
+    u64 At = Buffer->IndexPtr;
+
+    // First byte, everything else about the encoding comes from the opcode table
+    u8 Opcode = (u8)LoadValue(Buffer, At, 1, false);
+    opcode_entry Entry = OpcodeTable[Opcode];
+    if(Entry.Layout == Layout_None)
+    {
+        return Instruction;
+    }
+
+    // Don't read past the end of the image on a truncated encoding
+    u8 ModRM = (u8)LoadValue(Buffer, At + 1, 1, false);
+    u32 Size = GetInstructionSize(Entry, ModRM);
+    if((At + Size) > Buffer->Count)
+    {
+        return Instruction;
+    }
+
+    At += 1;
+    Instruction.Layout = Entry.Layout;
+
+    Instruction.DBit = (Entry.Flags & Opcode_D) ? 1 : 0;
+    Instruction.WBit = (Entry.Flags & Opcode_W) ? 1 : 0;
+    Instruction.SBit = (Entry.Flags & Opcode_S) ? 1 : 0;
+
+    if(Entry.Flags & Opcode_ModRM)
+    {
+        At += 1;
+
+        Instruction.ModBits = ModRM >> 6 & 0b11;
+        Instruction.RegBits = ModRM >> 3 & 0b111;
+        Instruction.RmBits = ModRM & 0b111;
+    }
+
+    if(Entry.Flags & Opcode_Group)
+    {
+        Instruction.OpType = OpcodeGroupTable[Entry.OpType][Instruction.RegBits];
+        if(Instruction.OpType == op_unknown)
+        {
+            return Instruction;
+        }
+    }
+    else
+    {
+        Instruction.OpType = (operation_types)Entry.OpType;
+    }
+
+    // Create destination and source operands
+    instruction_operand LeftOperand = {};
+    instruction_operand RightOperand = {};
+
+    switch(Entry.Layout)
+    {
+        // Register/memory to/from register, D bit picks the destination
+        case Layout_RegRm:
+        {
+            LeftOperand.Type = Operand_Register;
+            LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
+
+            ParseRmEncoding(&Instruction, &RightOperand, Buffer, &At);
+
+            if(!Instruction.DBit)
+            {
+                instruction_operand Temp = LeftOperand;
+                LeftOperand = RightOperand;
+                RightOperand = Temp;
+            }
+        } break;
+
+        // Immediate to register/memory, data follows any displacement
+        case Layout_ImmToRm:
+        {
+            ParseRmEncoding(&Instruction, &LeftOperand, Buffer, &At);
+
+            // S only widens an imm8 to a word, 0x82 has S set on a byte operation
+            RightOperand.Type = Operand_Immediate;
+            RightOperand.Immediate.Value =
+                ReadInstructionValue(Buffer, &At, Entry.ImmSize, Instruction.SBit && Instruction.WBit);
+
+            // Memory destinations need an explicit operand size
+            if(LeftOperand.Type == Operand_Memory)
+            {
+                RightOperand.Immediate.Flags.Memory_IsWide = Instruction.WBit ? 0x2 : 0x1;
+            }
+        } break;
+
+        // Immediate to register, register is in the low bits of the opcode
+        case Layout_ImmToReg:
+        {
+            Instruction.RegBits = Opcode & 0b111;
+
+            LeftOperand.Type = Operand_Register;
+            LeftOperand.Register = RegisterLookup[Instruction.WBit][Instruction.RegBits];
+
+            RightOperand.Type = Operand_Immediate;
+            RightOperand.Immediate.Value =
+                ReadInstructionValue(Buffer, &At, Entry.ImmSize, false);
+        } break;
+
+        // Immediate to accumulator
+        case Layout_ImmToAcc:
+        {
+            LeftOperand.Type = Operand_Register;
+            LeftOperand.Register = RegisterLookup[Instruction.WBit][0];
+
+            RightOperand.Type = Operand_Immediate;
+            RightOperand.Immediate.Value =
+                ReadInstructionValue(Buffer, &At, Entry.ImmSize, false);
+        } break;
+
+        // Memory to accumulator / accumulator to memory, always a 16-bit address
+        case Layout_MemToAcc:
+        case Layout_AccToMem:
+        {
+            LeftOperand.Type = Operand_Register;
+            LeftOperand.Register = RegisterLookup[Instruction.WBit][0];
+
+            RightOperand.Type = Operand_Memory;
+            RightOperand.Memory.Flags.Memory_HasDirectAddress = 0x1;
+            RightOperand.Memory.DirectAddress =
+                ReadInstructionValue(Buffer, &At, Entry.DispSize, false);
+
+            if(Entry.Layout == Layout_AccToMem)
+            {
+                instruction_operand Temp = LeftOperand;
+                LeftOperand = RightOperand;
+                RightOperand = Temp;
+            }
+        } break;
+
+        // Conditional jumps and loops, 8-bit IP increment
+        case Layout_Jump:
+        {
+            LeftOperand.Type = Operand_Immediate;
+            LeftOperand.Immediate.Flags.Immediate_IsRelative = 0x1;
+            LeftOperand.Immediate.Value =
+                ReadInstructionValue(Buffer, &At, Entry.DispSize, true);
+        } break;
+    }
+
+    Instruction.Operands[0] = LeftOperand;
+    Instruction.Operands[1] = RightOperand;
+    Instruction.Size = (u8)Size;
+
+    Buffer->IndexPtr += Size;
+
+    STATS_COUNT_INSTRUCTION(Instruction.OpType, Entry.Layout, Instruction.Size);
+
+    return Instruction;
+}
+
+// NOTE (Pedro): The encoded bytes of an instruction parsed from Buffer, pointing into the image.
+// Null once the window has moved past it (streamed input refills in place).
+u8 *GetInstructionBytes(buffer *Buffer, instruction *Instruction)
+{
+    u64 Offset = Instruction->Address - Buffer->BaseOffset;
+    if((Instruction->Address < Buffer->BaseOffset) || ((Offset + Instruction->Size) > Buffer->Count))
+    {
+        return 0;
+    }
+
+    u8 *Result = Buffer->Bytes + Offset;
+    return Result;
+}
+
+// NOTE (Pedro): Shared by the batch and record packers, the slots are wherever the caller keeps them
+static void PackOperand(instruction_operand *Operand, u8 *Register, u8 *Flags, s16 *Displacement, u16 *Immediate)
+{
+    switch(Operand->Type)
+    {
+        case Operand_Register:
+        {
+            *Register = Operand->Register;
+        } break;
+
+        case Operand_Memory:
+        {
+            if(Operand->Memory.Flags.Memory_HasDirectAddress)
+            {
+                *Flags |= Decoded_HasDirectAddress;
+                *Displacement = (s16)Operand->Memory.DirectAddress;
+            }
+            else
+            {
+                *Register = Operand->Memory.Register;
+                if(Operand->Memory.Flags.Memory_HasDisplacement)
+                {
+                    *Flags |= Decoded_HasDisplacement;
+                    *Displacement = Operand->Memory.Displacement;
+                }
+            }
+        } break;
+
+        case Operand_Immediate:
+        {
+            *Immediate = Operand->Immediate.Value;
+            if(Operand->Immediate.Flags.Immediate_IsRelative)
+            {
+                *Flags |= Decoded_Relative;
+            }
+
+            if(Operand->Immediate.Flags.Memory_IsWide)
+            {
+                *Flags |= (Operand->Immediate.Flags.Memory_IsWide == 0x2) ?
+                    Decoded_WordKeyword : Decoded_ByteKeyword;
+            }
+        } break;
+
+        default:
+        {
+        } break;
+    }
+}
+
+static_assert(sizeof(instruction_record) == 24, "instruction_record is a file format, keep it 24 bytes");
+
+void PackInstruction(instruction *Instruction, instruction_record *Record)
+{
+    *Record = {};
+    Record->Address = Instruction->Address;
+    Record->OpType = Instruction->OpType;
+    Record->OperandKinds = Instruction->Operands[0].Type | (Instruction->Operands[1].Type << 4);
+    Record->Register0 = unknown;
+    Record->Register1 = unknown;
+    Record->Flags = Instruction->WBit ? Decoded_Wide : 0;
+    Record->Length = Instruction->Size;
+
+    PackOperand(&Instruction->Operands[0], &Record->Register0, &Record->Flags, &Record->Displacement, &Record->Immediate);
+    PackOperand(&Instruction->Operands[1], &Record->Register1, &Record->Flags, &Record->Displacement, &Record->Immediate);
+}
+
+// NOTE (Pedro): Decode up to Count instructions (capped at the batch capacity) starting at the
+// image read position, and advance it. Stops early at the end of the image or an unknown opcode,
+// or once the next offset wouldn't fit in a u32.
+u32 DecodeBatch(buffer *Image, u32 Count, decoded_batch *Batch)
+{
+    if(Count > Batch->Capacity)
+    {
+        Count = Batch->Capacity;
+    }
+
+    Batch->BaseAddress = Image->BaseOffset + Image->IndexPtr;
+
+    u32 Index = 0;
+    while((Index < Count) && (Image->IndexPtr < Image->Count) &&
+          ((Image->BaseOffset + Image->IndexPtr - Batch->BaseAddress) <= 0xFFFFFFFF))
+    {
+        instruction Instruction = ParseInstruction(Image);
+        if(Instruction.OpType == op_unknown)
+        {
+            break;
+        }
+
+        Batch->Offset[Index] = (u32)(Instruction.Address - Batch->BaseAddress);
+        Batch->OpType[Index] = Instruction.OpType;
+        Batch->OperandKinds[Index] = Instruction.Operands[0].Type | (Instruction.Operands[1].Type << 4);
+        Batch->Register0[Index] = unknown;
+        Batch->Register1[Index] = unknown;
+        Batch->Flags[Index] = Instruction.WBit ? Decoded_Wide : 0;
+        Batch->Displacement[Index] = 0;
+        Batch->Immediate[Index] = 0;
+        Batch->Length[Index] = Instruction.Size;
+
+        PackOperand(&Instruction.Operands[0], &Batch->Register0[Index], &Batch->Flags[Index],
+                    &Batch->Displacement[Index], &Batch->Immediate[Index]);
+        PackOperand(&Instruction.Operands[1], &Batch->Register1[Index], &Batch->Flags[Index],
+                    &Batch->Displacement[Index], &Batch->Immediate[Index]);
+
+        Index++;
+    }
+
+    Batch->Count = Index;
+    return Index;
+}
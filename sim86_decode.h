@@ -0,0 +1,60 @@
+#ifndef SIM86_DECODE_H
+#define SIM86_DECODE_H
+
+#include "sim86.h"
+
+// NOTE (Pedro): Per-instruction flags in a decoded_batch
+typedef enum decoded_flags
+{
+    Decoded_Wide = 0x1,             // W bit, 16-bit operation
+    Decoded_HasDisplacement = 0x2,  // Displacement holds a signed memory displacement
+    Decoded_HasDirectAddress = 0x4, // Displacement holds a 16-bit direct address
+    Decoded_ByteKeyword = 0x8,      // Immediate to memory, printed with an explicit size
+    Decoded_WordKeyword = 0x10,
+    Decoded_Relative = 0x20,        // Immediate is a signed IP increment from the next instruction
+} decoded_flags;
+
+// NOTE (Pedro): Structure-of-arrays view of decoded instructions, 14 bytes per instruction
+// with no pointers into itself. The arrays are owned by the caller and sized to Capacity.
+// Only one operand can touch memory, so a single Displacement slot covers both operands.
+// Images can be past 4 GB, so rows keep a u32 offset from the batch's first instruction.
+typedef struct decoded_batch
+{
+    u32 Capacity;
+    u32 Count;
+    u64 BaseAddress;    // Image offset of the first instruction
+
+    u32 *Offset;        // First byte, from BaseAddress
+    u8 *OpType;         // operation_types
+    u8 *OperandKinds;   // operand_types, destination in the low nibble, source in the high nibble
+    u8 *Register0;      // register_id of the destination (effective address base for memory)
+    u8 *Register1;      // register_id of the source
+    u8 *Flags;          // decoded_flags
+    s16 *Displacement;
+    u16 *Immediate;
+    u8 *Length;
+} decoded_batch;
+
+// NOTE (Pedro): The same fields as one decoded_batch row, packed into a fixed 24 bytes so a file of
+// them can be mapped and indexed directly. Written in host (little-endian) order.
+typedef struct instruction_record
+{
+    u64 Address;
+    u8 OpType;
+    u8 OperandKinds;
+    u8 Register0;
+    u8 Register1;
+    s16 Displacement;
+    u16 Immediate;
+    u8 Flags;
+    u8 Length;
+    u8 Reserved[6];
+} instruction_record;
+
+u32 GetInstructionSize(opcode_entry Entry, u8 ModRM);
+instruction ParseInstruction(buffer *Buffer);
+u8 *GetInstructionBytes(buffer *Buffer, instruction *Instruction);
+void PackInstruction(instruction *Instruction, instruction_record *Record);
+u32 DecodeBatch(buffer *Image, u32 Count, decoded_batch *Batch);
+
+#endif
@@ -1,7 +1,6 @@
-#include <stdio.h>
-
 #include "sim86_display.h"
 #include "sim86_table.h"
+#include "sim86_stats.h"
 
 const char *GetMnemonic(operation_types Op)
 {
@@ -15,20 +14,28 @@ const char *GetRegister(register_id Reg)
     return Result;
 }
 
-void PrintInstruction(instruction Instruction)
+// NOTE (Pedro): Mnemonic and operands only, callers reserve the line and end it
+void AppendInstruction(instruction *Instruction, output_buffer *Out)
 {
-    const char *Mnemonic = GetMnemonic(Instruction.OpType);
-    printf("%s ", Mnemonic);
+    TIMED_BLOCK(Stage_Print);
+
+    const char *Mnemonic = GetMnemonic(Instruction->OpType);
+    AppendString(Out, Mnemonic);
+    AppendString(Out, " ");
     const char *Separator = "";
 
-    for(int Index = 0; Index < ArrayCount(Instruction.Operands); Index++)
+    for(u32 Index = 0; Index < ArrayCount(Instruction->Operands); Index++)
     {
-        instruction_operand Operand = Instruction.Operands[Index];
+        instruction_operand *Operand = &Instruction->Operands[Index];
+        if(Operand->Type == Operand_None)
+        {
+            continue;
+        }
 
-        printf("%s", Separator);
+        AppendString(Out, Separator);
         Separator = ", ";
 
-        switch(Operand.Type)
+        switch(Operand->Type)
         {
             case Operand_None:
             {
@@ -36,50 +43,61 @@ void PrintInstruction(instruction Instruction)
 
             case Operand_Memory:
             {
-                printf("[");
-                const char *Register = GetRegister(Operand.Register);
+                AppendString(Out, "[");
+                const char *Register = GetRegister(Operand->Register);
 
-                if(!Operand.Memory.Flags.Memory_HasDirectAddress)
+                if(!Operand->Memory.Flags.Memory_HasDirectAddress)
                 {
-                    printf("%s", Register);
+                    AppendString(Out, Register);
                 }
 
-                if(Operand.Memory.Flags.Memory_HasDisplacement)
+                if(Operand->Memory.Flags.Memory_HasDisplacement)
                 {
-                    if(Operand.Memory.Displacement >= 0)
+                    if(Operand->Memory.Displacement >= 0)
                     {
-                        printf(" + %i", Operand.Memory.Displacement);
+                        AppendString(Out, " + ");
+                        AppendS32(Out, Operand->Memory.Displacement);
                     }
                     else
                     {
-                        printf(" - %i", Operand.Memory.Displacement * -1);
+                        AppendString(Out, " - ");
+                        AppendS32(Out, Operand->Memory.Displacement * -1);
                     }
                 }
 
-                if(Operand.Memory.Flags.Memory_HasDirectAddress)
+                if(Operand->Memory.Flags.Memory_HasDirectAddress)
                 {
-                    printf("%d", Operand.Memory.DirectAddress);
+                    AppendU32(Out, Operand->Memory.DirectAddress);
                 }
 
-                printf("]");
+                AppendString(Out, "]");
             } break;
 
             case Operand_Immediate:
             {
-                if(Operand.Immediate.Flags.Memory_IsWide)
+                // Jumps print as nasm's $-relative form, counted from the start of the instruction
+                if(Operand->Immediate.Flags.Immediate_IsRelative)
+                {
+                    s32 Offset = (s16)Operand->Immediate.Value + Instruction->Size;
+                    AppendString(Out, (Offset >= 0) ? "$+" : "$");
+                    AppendS32(Out, Offset);
+                    break;
+                }
+
+                if(Operand->Immediate.Flags.Memory_IsWide)
                 {
-                    printf("%s ", (Operand.Immediate.Flags.Memory_IsWide == 0x2) ? "word" : "byte");
+                    AppendString(Out, (Operand->Immediate.Flags.Memory_IsWide == 0x2) ? "word " : "byte ");
                 }
 
-                printf("%d", Operand.Immediate.Value);
+                AppendU32(Out, Operand->Immediate.Value);
 
             } break;
 
             case Operand_Register:
             {
                 // TODO (PEDRO): Fix the separator and the next line printing
-                const char *Register = GetRegister(Operand.Register);
-                printf("%s", Register);
+                const char *Register = GetRegister(Operand->Register);
+                AppendString(Out, Register);
             } break;
 
             default:
@@ -87,5 +105,11 @@ void PrintInstruction(instruction Instruction)
             } break;
         }
     }
-    printf("\n");
+}
+
+void PrintInstruction(instruction *Instruction, output_buffer *Out)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendInstruction(Instruction, Out);
+    AppendString(Out, "\n");
 }
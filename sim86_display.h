@@ -2,9 +2,11 @@
 #define SIM86_DISPLAY_H
 
 #include "sim86.h"
+#include "sim86_output.h"
 
 const char *GetMnemonic(operation_types Op);
 const char *GetRegister(register_id Reg);
-void PrintInstruction(instruction Instruction);
+void AppendInstruction(instruction *Instruction, output_buffer *Out);
+void PrintInstruction(instruction *Instruction, output_buffer *Out);
 
 #endif
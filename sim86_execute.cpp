@@ -1,11 +1,1057 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+
 #include "sim86_execute.h"
+#include "sim86_decode.h"
+#include "sim86_cache.h"
+#include "sim86_clocks.h"
+#include "sim86_stats.h"
+
+// NOTE (Pedro): Byte offset of every register_id inside the regs union, so 8 and 16-bit
+// registers are both a single load from the same storage
+static const u8 RegisterOffset[] =
+{
+    offsetof(regs, al),
+    offsetof(regs, cl),
+    offsetof(regs, dl),
+    offsetof(regs, bl),
+    offsetof(regs, ah),
+    offsetof(regs, ch),
+    offsetof(regs, dh),
+    offsetof(regs, bh),
+    offsetof(regs, ax),
+    offsetof(regs, cx),
+    offsetof(regs, dx),
+    offsetof(regs, bx),
+    offsetof(regs, sp),
+    offsetof(regs, bp),
+    offsetof(regs, si),
+    offsetof(regs, di),
+};
+
+static const char *DispatchNames[Dispatch_Count] =
+{
+    "default",
+    "call",
+    "switch",
+    "goto",
+    "tail",
+    "generic",
+};
+
+bool ParseDispatch(char *Name, execute_dispatch *Dispatch)
+{
+    bool Result = false;
+
+    for(u32 Index = 0; Index < Dispatch_Count; Index++)
+    {
+        if(strcmp(Name, DispatchNames[Index]) == 0)
+        {
+            *Dispatch = (execute_dispatch)Index;
+            Result = true;
+            break;
+        }
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Computed goto is a GNU extension, builds without it fall back to the call loop
+static execute_dispatch GetDispatchOrDefault(execute_dispatch Dispatch)
+{
+    execute_dispatch Result = (Dispatch == Dispatch_Default) ? SIM86_DISPATCH : Dispatch;
+#ifndef __GNUC__
+    if(Result == Dispatch_Goto)
+    {
+        Result = Dispatch_Call;
+    }
+#endif
+    return Result;
+}
+
+execute_dispatch GetDispatch(machine *Machine)
+{
+    execute_dispatch Result = GetDispatchOrDefault(Machine->Dispatch);
+    return Result;
+}
+
+// NOTE (Pedro): Memory comes from Arena and lives as long as it does. The machine owns its image
+// and the pool its memory copies pages from, so it must stay where it is once initialized.
+void InitMachine(machine *Machine, memory_arena *Arena)
+{
+    *Machine = {};
+    InitMemoryImage(&Machine->Image, Arena);
+    InitPagePool(&Machine->Pool, Arena);
+    ForkMemory(&Machine->Memory, &Machine->Image, &Machine->Pool);
+}
 
-void ExecuteInstruction(u8 BytesRead, buffer *Buffer)
+// NOTE (Pedro): Back to the state InitMachine leaves, keeping the image and the pool. The copied
+// pages go back to the pool for the next program, and its stats start over.
+void ResetMachine(machine *Machine)
 {
-    u8 Count = BytesRead;
+    ReleaseMemory(&Machine->Memory);
+    ResetMemoryImage(&Machine->Image);
+
+    memory_image Image = Machine->Image;
+    page_pool Pool = Machine->Pool;
 
-    while(Buffer->IndexPtr < Count)
+    *Machine = {};
+    Machine->Image = Image;
+    Machine->Pool = Pool;
+    Machine->Pool.PagesCopied = 0;
+    Machine->Pool.PeakPagesInUse = 0;
+    ForkMemory(&Machine->Memory, &Machine->Image, &Machine->Pool);
+}
+
+// NOTE (Pedro): Copies the whole image to address 0, CS:IP starts at 0000:0000. Memory is forked
+// again so it knows which pages hold the program.
+bool LoadProgram(machine *Machine, image_source *Source)
+{
+    buffer *Buffer = &Source->Buffer;
+    u32 Size = 0;
+
+    for(;;)
     {
+        u64 Available = Buffer->Count - Buffer->IndexPtr;
+        if((Size + Available) > SEGMENT_SIZE)
+        {
+            fprintf(stderr, "ERROR: Program does not fit in a 64 KB code segment\n");
+            return false;
+        }
+
+        memcpy(Machine->Image.Bytes + Size, Buffer->Bytes + Buffer->IndexPtr, Available);
+        Size += Available;
+        Machine->Image.ProgramSize = Size;
+        Buffer->IndexPtr += Available;
+
+        if(!RefillImage(Source))
+        {
+            break;
+        }
+    }
+
+    Machine->ProgramSize = Size;
+    ReleaseMemory(&Machine->Memory);
+    ForkMemory(&Machine->Memory, &Machine->Image, &Machine->Pool);
+    return true;
+}
+
+static inline u16 ReadRegister(regs *Regs, register_id Register, u8 Wide)
+{
+    u8 *Storage = (u8 *)Regs + RegisterOffset[Register];
 
+    u16 Result = Wide ? *(u16 *)Storage : *Storage;
+    return Result;
+}
+
+static inline void WriteRegister(regs *Regs, register_id Register, u8 Wide, u16 Value)
+{
+    u8 *Storage = (u8 *)Regs + RegisterOffset[Register];
+
+    if(Wide)
+    {
+        *(u16 *)Storage = Value;
     }
+    else
+    {
+        *Storage = (u8)Value;
+    }
+}
+
+// NOTE (Pedro): Offsets wrap inside the 64 KB segment, words are stored little-endian
+static inline u16 ReadMemory(machine *Machine, u16 Address, u8 Wide)
+{
+    u16 Result = ReadMemoryByte(&Machine->Memory, Address);
+    if(Wide)
+    {
+        Result |= ReadMemoryByte(&Machine->Memory, (u16)(Address + 1)) << 8;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): A write that lands on cached code drops the blocks covering it and flags the
+// machine so the block being run is abandoned after the current op
+static inline void WriteMemory(machine *Machine, u16 Address, u8 Wide, u16 Value)
+{
+    WriteMemoryByte(&Machine->Memory, Address, (u8)Value);
+    if(Wide)
+    {
+        WriteMemoryByte(&Machine->Memory, (u16)(Address + 1), (u8)(Value >> 8));
+    }
+
+    if(Machine->Cache)
+    {
+        bool Modified = InvalidateCode(Machine->Cache, Address);
+        if(Wide)
+        {
+            Modified |= InvalidateCode(Machine->Cache, (u16)(Address + 1));
+        }
+
+        Machine->CodeModified |= Modified;
+    }
+}
+
+// NOTE (Pedro): Base is the register_id from RegisterLookup[2], or unknown for a direct address
+static inline u16 GetEffectiveAddress(regs *Regs, u8 Base, u16 Disp)
+{
+    u16 Result = Disp;
+    switch(Base)
+    {
+        case bx_si: Result += Regs->bx + Regs->si; break;
+        case bx_di: Result += Regs->bx + Regs->di; break;
+        case bp_si: Result += Regs->bp + Regs->si; break;
+        case bp_di: Result += Regs->bp + Regs->di; break;
+        case si:    Result += Regs->si; break;
+        case di:    Result += Regs->di; break;
+        case bp:    Result += Regs->bp; break;
+        case bx:    Result += Regs->bx; break;
+        default: break;
+    }
+
+    return Result;
+}
+
+static inline u16 ReadOperand(machine *Machine, micro_op *Op, u8 Kind, u8 Register, u8 Wide)
+{
+    u16 Result = 0;
+    switch(Kind)
+    {
+        case Operand_Register:
+        {
+            Result = ReadRegister(&Machine->Regs, (register_id)Register, Wide);
+        } break;
+
+        case Operand_Memory:
+        {
+            Result = ReadMemory(Machine, GetEffectiveAddress(&Machine->Regs, Register, Op->Disp), Wide);
+        } break;
+
+        case Operand_Immediate:
+        {
+            Result = Wide ? Op->Imm : (u8)Op->Imm;
+        } break;
+
+        default:
+        {
+        } break;
+    }
+
+    return Result;
+}
+
+static inline void WriteOperand(machine *Machine, micro_op *Op, u16 Value)
+{
+    u8 Wide = Op->Flags & MicroOp_Wide;
+
+    if(Op->DestKind == Operand_Register)
+    {
+        WriteRegister(&Machine->Regs, (register_id)Op->DestReg, Wide, Value);
+    }
+    else if(Op->DestKind == Operand_Memory)
+    {
+        WriteMemory(Machine, GetEffectiveAddress(&Machine->Regs, Op->DestReg, Op->Disp), Wide, Value);
+    }
+}
+
+// NOTE (Pedro): add/sub/cmp only record their operands and result. Each flag is worked out
+// from that record when something reads it, most results are overwritten before a jump looks.
+// Build with -DSIM86_EAGER_FLAGS to materialize all six after every op instead (for comparison).
+static inline u16 RecordArithmetic(machine *Machine, operation_types Op, u8 Wide, u16 Left, u16 Right)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    Lazy->Pending = true;
+    Lazy->IsSub = (Op != add);
+    Lazy->Wide = Wide;
+    Lazy->Left = Left;
+    Lazy->Right = Right;
+    Lazy->Result = Lazy->IsSub ? ((u32)Left - Right) : ((u32)Left + Right);
+
+#ifdef SIM86_EAGER_FLAGS
+    MaterializeFlags(Machine);
+#endif
+
+    return (u16)Lazy->Result;
+}
+
+static inline u32 LazySignBit(lazy_flags *Lazy)
+{
+    u32 Result = Lazy->Wide ? 0x8000 : 0x80;
+    return Result;
+}
+
+static inline bool GetCF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_CF;
+    }
+
+    bool Result = Lazy->IsSub ? (Lazy->Right > Lazy->Left) : (Lazy->Result > (LazySignBit(Lazy) * 2 - 1));
+    return Result;
+}
+
+static inline bool GetZF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_ZF;
+    }
+
+    bool Result = (Lazy->Result & (LazySignBit(Lazy) * 2 - 1)) == 0;
+    return Result;
+}
+
+static inline bool GetSF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_SF;
+    }
+
+    bool Result = Lazy->Result & LazySignBit(Lazy);
+    return Result;
+}
+
+static inline bool GetOF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_OF;
+    }
+
+    u32 Overflow = Lazy->IsSub ?
+        ((Lazy->Left ^ Lazy->Right) & (Lazy->Left ^ Lazy->Result)) :
+        ((Lazy->Left ^ Lazy->Result) & (Lazy->Right ^ Lazy->Result));
+
+    bool Result = Overflow & LazySignBit(Lazy);
+    return Result;
+}
+
+static inline bool GetPF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_PF;
+    }
+
+    bool Result = !__builtin_parity((u8)Lazy->Result);
+    return Result;
+}
+
+static inline bool GetAF(machine *Machine)
+{
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    if(!Lazy->Pending)
+    {
+        return Machine->Flags & Flag_AF;
+    }
+
+    bool Result = (Lazy->Left ^ Lazy->Right ^ Lazy->Result) & 0x10;
+    return Result;
+}
+
+// NOTE (Pedro): Folds a pending add/sub/cmp into the FLAGS register, for anything that needs all of it
+void MaterializeFlags(machine *Machine)
+{
+    if(Machine->LazyFlags.Pending)
+    {
+        u16 Flags = 0;
+        if(GetCF(Machine)) Flags |= Flag_CF;
+        if(GetPF(Machine)) Flags |= Flag_PF;
+        if(GetAF(Machine)) Flags |= Flag_AF;
+        if(GetZF(Machine)) Flags |= Flag_ZF;
+        if(GetSF(Machine)) Flags |= Flag_SF;
+        if(GetOF(Machine)) Flags |= Flag_OF;
+
+        u16 ArithmeticFlags = Flag_CF | Flag_PF | Flag_AF | Flag_ZF | Flag_SF | Flag_OF;
+        Machine->Flags = (Machine->Flags & ~ArithmeticFlags) | Flags;
+        Machine->LazyFlags.Pending = false;
+    }
+}
+
+static inline bool EvaluateCondition(machine *Machine, operation_types Op)
+{
+    bool Result = false;
+    switch(Op)
+    {
+        case je:  Result = GetZF(Machine); break;
+        case jne: Result = !GetZF(Machine); break;
+        case jl:  Result = (GetSF(Machine) != GetOF(Machine)); break;
+        case jnl: Result = (GetSF(Machine) == GetOF(Machine)); break;
+        case jle: Result = GetZF(Machine) || (GetSF(Machine) != GetOF(Machine)); break;
+        case jg:  Result = !GetZF(Machine) && (GetSF(Machine) == GetOF(Machine)); break;
+        case jb:  Result = GetCF(Machine); break;
+        case jnb: Result = !GetCF(Machine); break;
+        case jbe: Result = GetCF(Machine) || GetZF(Machine); break;
+        case ja:  Result = !GetCF(Machine) && !GetZF(Machine); break;
+        case jp:  Result = GetPF(Machine); break;
+        case jnp: Result = !GetPF(Machine); break;
+        case jo:  Result = GetOF(Machine); break;
+        case jno: Result = !GetOF(Machine); break;
+        case js:  Result = GetSF(Machine); break;
+        case jns: Result = !GetSF(Machine); break;
+
+        // CX is decremented before the test, without touching any flags
+        case loop:   Result = (--Machine->Regs.cx != 0); break;
+        case loopz:  Result = (--Machine->Regs.cx != 0) && GetZF(Machine); break;
+        case loopnz: Result = (--Machine->Regs.cx != 0) && !GetZF(Machine); break;
+        case jcxz:   Result = (Machine->Regs.cx == 0); break;
+
+        default: break;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Branch condition of a fused cmp/sub straight from the compared values.
+// Left and Right are already truncated to the operand width.
+static inline bool EvaluateFusedCondition(machine *Machine, operation_types Branch, u8 Wide, u16 Left, u16 Right)
+{
+    s16 SignedLeft = Wide ? (s16)Left : (s8)Left;
+    s16 SignedRight = Wide ? (s16)Right : (s8)Right;
+
+    bool Result = false;
+    switch(Branch)
+    {
+        case je:  Result = (Left == Right); break;
+        case jne: Result = (Left != Right); break;
+        case jb:  Result = (Left < Right); break;
+        case jnb: Result = (Left >= Right); break;
+        case jbe: Result = (Left <= Right); break;
+        case ja:  Result = (Left > Right); break;
+        case jl:  Result = (SignedLeft < SignedRight); break;
+        case jnl: Result = (SignedLeft >= SignedRight); break;
+        case jle: Result = (SignedLeft <= SignedRight); break;
+        case jg:  Result = (SignedLeft > SignedRight); break;
+
+        case loopz:  Result = (--Machine->Regs.cx != 0) && (Left == Right); break;
+        case loopnz: Result = (--Machine->Regs.cx != 0) && (Left != Right); break;
+
+        // Sign, overflow and parity come from the recorded result like any other jump
+        default: Result = EvaluateCondition(Machine, Branch); break;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): The odd address penalty depends on the effective address, so it is taken before
+// the op runs and can change the registers it was computed from
+static inline u16 GetMemoryOperandAddress(machine *Machine, micro_op *Op)
+{
+    u16 Result = 0;
+    if(Op->DestKind == Operand_Memory)
+    {
+        Result = GetEffectiveAddress(&Machine->Regs, Op->DestReg, Op->Disp);
+    }
+    else if(Op->SourceKind == Operand_Memory)
+    {
+        Result = GetEffectiveAddress(&Machine->Regs, Op->SourceReg, Op->Disp);
+    }
+
+    return Result;
+}
+
+static void CountClocks(machine *Machine, micro_op *Op, u16 Address, bool Taken)
+{
+    clock_stats *Stats = Machine->Clocks;
+
+    u32 OpType = Op->OpType;
+    u32 BranchOp = op_unknown;
+    if(OpType >= MicroOp_FusedCmp)
+    {
+        BranchOp = Op->BranchOp;
+        OpType = (OpType == MicroOp_FusedCmp) ? cmp : sub;
+    }
+    else if((OpType >= jne) && (OpType <= jcxz))
+    {
+        BranchOp = OpType;
+    }
+
+    if(BranchOp == OpType)
+    {
+        u32 Clocks = GetJumpClocks((operation_types)BranchOp, Taken);
+        Stats->Count[BranchOp][Operand_None][Operand_None]++;
+        Stats->Clocks[BranchOp][Operand_None][Operand_None] += Clocks;
+        Stats->Total += Clocks;
+        return;
+    }
+
+    u32 Clocks = Op->Clocks;
+    if((Op->Flags & MicroOp_Wide) && (Address & 1))
+    {
+        Clocks += ODD_TRANSFER_PENALTY *
+            GetTransferCount((operation_types)OpType, (operand_types)Op->DestKind, (operand_types)Op->SourceKind);
+    }
+
+    Stats->Count[OpType][Op->DestKind][Op->SourceKind]++;
+    Stats->Clocks[OpType][Op->DestKind][Op->SourceKind] += Clocks;
+    Stats->Total += Clocks;
+
+    if(BranchOp != op_unknown)
+    {
+        u32 BranchClocks = GetJumpClocks((operation_types)BranchOp, Taken);
+        Stats->Count[BranchOp][Operand_None][Operand_None]++;
+        Stats->Clocks[BranchOp][Operand_None][Operand_None] += BranchClocks;
+        Stats->Total += BranchClocks;
+    }
+}
+
+// NOTE (Pedro): IP must already point past the instruction, jumps are relative to the next instruction.
+// Timing adds the clock bookkeeping, the untimed instantiation is exactly the plain executor.
+template<bool Timing>
+static inline void ExecuteMicroOp(machine *Machine, micro_op *Op)
+{
+    u8 Wide = Op->Flags & MicroOp_Wide;
+    bool Taken = false;
+
+    u16 Address = 0;
+    if constexpr(Timing)
+    {
+        Address = GetMemoryOperandAddress(Machine, Op);
+    }
+
+    switch(Op->OpType)
+    {
+        case mov:
+        {
+            WriteOperand(Machine, Op, ReadOperand(Machine, Op, Op->SourceKind, Op->SourceReg, Wide));
+        } break;
+
+        case add:
+        case sub:
+        case cmp:
+        {
+            u16 Left = ReadOperand(Machine, Op, Op->DestKind, Op->DestReg, Wide);
+            u16 Right = ReadOperand(Machine, Op, Op->SourceKind, Op->SourceReg, Wide);
+            u16 Result = RecordArithmetic(Machine, (operation_types)Op->OpType, Wide, Left, Right);
+
+            if(Op->OpType != cmp)
+            {
+                WriteOperand(Machine, Op, Result);
+            }
+        } break;
+
+        case MicroOp_FusedCmp:
+        case MicroOp_FusedSub:
+        {
+            u16 Left = ReadOperand(Machine, Op, Op->DestKind, Op->DestReg, Wide);
+            u16 Right = ReadOperand(Machine, Op, Op->SourceKind, Op->SourceReg, Wide);
+            u16 Result = RecordArithmetic(Machine, sub, Wide, Left, Right);
+
+            if(Op->OpType == MicroOp_FusedSub)
+            {
+                WriteOperand(Machine, Op, Result);
+            }
+
+            Taken = EvaluateFusedCondition(Machine, (operation_types)Op->BranchOp, Wide, Left, Right);
+            if(Taken)
+            {
+                Machine->IP += Op->BranchDisp;
+            }
+
+            Machine->Cache->FusionHits[Op->OpType - MicroOp_FusedCmp][Op->BranchOp]++;
+        } break;
+
+        default:
+        {
+            Taken = EvaluateCondition(Machine, (operation_types)Op->OpType);
+            if(Taken)
+            {
+                Machine->IP += Op->Imm;
+            }
+        } break;
+    }
+
+    if constexpr(Timing)
+    {
+        CountClocks(Machine, Op, Address, Taken);
+    }
+}
+
+// NOTE (Pedro): Operand access with the kind and width known at compile time, each one is a
+// single load or store in the handler that uses it
+template<u32 Kind, u8 Wide>
+static inline u16 ReadOperandAs(machine *Machine, micro_op *Op, u8 Register)
+{
+    if constexpr(Kind == Operand_Register)
+    {
+        return ReadRegister(&Machine->Regs, (register_id)Register, Wide);
+    }
+    else if constexpr(Kind == Operand_Memory)
+    {
+        return ReadMemory(Machine, GetEffectiveAddress(&Machine->Regs, Register, Op->Disp), Wide);
+    }
+    else
+    {
+        return Wide ? Op->Imm : (u8)Op->Imm;
+    }
+}
+
+template<u32 Kind, u8 Wide>
+static inline void WriteOperandAs(machine *Machine, micro_op *Op, u16 Value)
+{
+    if constexpr(Kind == Operand_Register)
+    {
+        WriteRegister(&Machine->Regs, (register_id)Op->DestReg, Wide, Value);
+    }
+    else
+    {
+        WriteMemory(Machine, GetEffectiveAddress(&Machine->Regs, Op->DestReg, Op->Disp), Wide, Value);
+    }
+}
+
+// NOTE (Pedro): One instantiation per slot of GetHandlerIndex, the index is decoded back into
+// the operation, operand kinds and width so the body is straight-line code for exactly that op
+template<bool Timing, u32 Handler>
+static void ExecuteHandler(machine *Machine, micro_op *Op)
+{
+    if constexpr(Handler == HANDLER_GENERIC)
+    {
+        ExecuteMicroOp<Timing>(Machine, Op);
+    }
+    else if constexpr(Handler >= HANDLER_JUMP_BASE)
+    {
+        constexpr operation_types Jump = (operation_types)(jne + (Handler - HANDLER_JUMP_BASE));
+
+        bool Taken = EvaluateCondition(Machine, Jump);
+        if(Taken)
+        {
+            Machine->IP += Op->Imm;
+        }
+
+        if constexpr(Timing)
+        {
+            CountClocks(Machine, Op, 0, Taken);
+        }
+    }
+    else
+    {
+        constexpr u32 DataOp = Handler / 12;
+        constexpr u32 DestKind = Operand_Register + ((Handler / 6) % 2);
+        constexpr u32 SourceKind = Operand_Register + ((Handler / 2) % 3);
+        constexpr u8 Wide = Handler % 2;
+
+        u16 Address = 0;
+        if constexpr(Timing)
+        {
+            Address = GetMemoryOperandAddress(Machine, Op);
+        }
+
+        bool Taken = false;
+        if constexpr(DataOp == mov)
+        {
+            WriteOperandAs<DestKind, Wide>(Machine, Op, ReadOperandAs<SourceKind, Wide>(Machine, Op, Op->SourceReg));
+        }
+        else if constexpr(DataOp <= cmp)
+        {
+            u16 Left = ReadOperandAs<DestKind, Wide>(Machine, Op, Op->DestReg);
+            u16 Right = ReadOperandAs<SourceKind, Wide>(Machine, Op, Op->SourceReg);
+            u16 Result = RecordArithmetic(Machine, (operation_types)DataOp, Wide, Left, Right);
+
+            if constexpr(DataOp != cmp)
+            {
+                WriteOperandAs<DestKind, Wide>(Machine, Op, Result);
+            }
+        }
+        else
+        {
+            // Fused cmp (4) and sub (5) with the jump that followed
+            u16 Left = ReadOperandAs<DestKind, Wide>(Machine, Op, Op->DestReg);
+            u16 Right = ReadOperandAs<SourceKind, Wide>(Machine, Op, Op->SourceReg);
+            u16 Result = RecordArithmetic(Machine, sub, Wide, Left, Right);
+
+            if constexpr(DataOp == 5)
+            {
+                WriteOperandAs<DestKind, Wide>(Machine, Op, Result);
+            }
+
+            Taken = EvaluateFusedCondition(Machine, (operation_types)Op->BranchOp, Wide, Left, Right);
+            if(Taken)
+            {
+                Machine->IP += Op->BranchDisp;
+            }
+
+            Machine->Cache->FusionHits[DataOp - 4][Op->BranchOp]++;
+        }
+
+        if constexpr(Timing)
+        {
+            CountClocks(Machine, Op, Address, Taken);
+        }
+    }
+}
+
+typedef void execute_handler(machine *Machine, micro_op *Op);
+
+typedef struct handler_table
+{
+    execute_handler *Handlers[HANDLER_COUNT];
+} handler_table;
+
+template<bool Timing, u32... Handler>
+static constexpr handler_table MakeHandlerTable(std::integer_sequence<u32, Handler...>)
+{
+    handler_table Result = {{&ExecuteHandler<Timing, Handler>...}};
+    return Result;
+}
+
+// NOTE (Pedro): Indexed by Timing, then by micro_op::Handler
+static constexpr handler_table HandlerTables[2] =
+{
+    MakeHandlerTable<false>(std::make_integer_sequence<u32, HANDLER_COUNT>()),
+    MakeHandlerTable<true>(std::make_integer_sequence<u32, HANDLER_COUNT>()),
+};
+
+// NOTE (Pedro): Generic runs every op through ExecuteMicroOp's switches instead, kept to measure
+// the specialized handlers against
+template<bool Timing, bool Generic>
+static inline void RunMicroOp(machine *Machine, micro_op *Op)
+{
+    if constexpr(Generic)
+    {
+        ExecuteMicroOp<Timing>(Machine, Op);
+    }
+    else
+    {
+        HandlerTables[Timing].Handlers[Op->Handler](Machine, Op);
+    }
+}
+
+// NOTE (Pedro): The switch and goto back ends need one literal case or label per handler slot.
+// Slots past HANDLER_COUNT are never bound, they only keep the lists a fixed length.
+#define HANDLER_SLOTS_10(X, Tens) X(Tens##0) X(Tens##1) X(Tens##2) X(Tens##3) X(Tens##4) \
+                                  X(Tens##5) X(Tens##6) X(Tens##7) X(Tens##8) X(Tens##9)
+#define HANDLER_SLOTS(X) HANDLER_SLOTS_10(X, ) HANDLER_SLOTS_10(X, 1) HANDLER_SLOTS_10(X, 2) \
+                         HANDLER_SLOTS_10(X, 3) HANDLER_SLOTS_10(X, 4) HANDLER_SLOTS_10(X, 5) \
+                         HANDLER_SLOTS_10(X, 6) HANDLER_SLOTS_10(X, 7) HANDLER_SLOTS_10(X, 8) \
+                         HANDLER_SLOTS_10(X, 9) HANDLER_SLOTS_10(X, 10) HANDLER_SLOTS_10(X, 11) \
+                         HANDLER_SLOTS_10(X, 12)
+#define HANDLER_SLOT_COUNT 130
+#define SLOT_HANDLER(Slot) (((Slot) < HANDLER_COUNT) ? (Slot) : HANDLER_GENERIC)
+
+static_assert(HANDLER_COUNT <= HANDLER_SLOT_COUNT, "HANDLER_SLOTS needs more slots");
+
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define MUSTTAIL [[clang::musttail]]
+#endif
+#endif
+
+// NOTE (Pedro): Without musttail (gcc before 15) the tail calls are only as good as the
+// optimizer makes them. A chain never runs past one block, so the stack stays bounded by
+// MAX_BLOCK_OPS frames either way.
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+typedef micro_op *tail_handler(machine *Machine, micro_op *Op, micro_op *OnePastLast);
+
+typedef struct tail_handler_table
+{
+    tail_handler *Handlers[HANDLER_COUNT];
+} tail_handler_table;
+
+// NOTE (Pedro): A class template so the handlers can name the table before it is defined
+template<bool Timing>
+struct tail_dispatch
+{
+    static const tail_handler_table Table;
+};
+
+template<bool Timing, u32 Handler>
+static micro_op *TailHandler(machine *Machine, micro_op *Op, micro_op *OnePastLast)
+{
+    ExecuteHandler<Timing, Handler>(Machine, Op);
+
+    Op++;
+    if((Op == OnePastLast) || Machine->CodeModified)
+    {
+        return Op;
+    }
+
+    Machine->IP += Op->Length;
+    MUSTTAIL return tail_dispatch<Timing>::Table.Handlers[Op->Handler](Machine, Op, OnePastLast);
+}
+
+template<bool Timing, u32... Handler>
+static constexpr tail_handler_table MakeTailHandlerTable(std::integer_sequence<u32, Handler...>)
+{
+    tail_handler_table Result = {{&TailHandler<Timing, Handler>...}};
+    return Result;
+}
+
+template<bool Timing>
+const tail_handler_table tail_dispatch<Timing>::Table =
+    MakeTailHandlerTable<Timing>(std::make_integer_sequence<u32, HANDLER_COUNT>());
+
+// NOTE (Pedro): Runs the ops of one block until the end or a write to cached code, and returns
+// one past the last op that ran. Every back end runs the same ops through the same handlers,
+// only the way control gets from one op to the next differs.
+template<bool Timing, execute_dispatch Dispatch>
+static micro_op *RunBlock(machine *Machine, micro_op *Op, micro_op *OnePastLast)
+{
+    if constexpr(Dispatch == Dispatch_Switch)
+    {
+#define SWITCH_HANDLER(Slot) case (Slot): ExecuteHandler<Timing, SLOT_HANDLER(Slot)>(Machine, Op); break;
+
+        while(Op < OnePastLast)
+        {
+            Machine->IP += Op->Length;
+            switch(Op->Handler)
+            {
+                HANDLER_SLOTS(SWITCH_HANDLER)
+            }
+            Op++;
+
+            if(Machine->CodeModified)
+            {
+                break;
+            }
+        }
+
+        return Op;
+
+#undef SWITCH_HANDLER
+    }
+#ifdef __GNUC__
+    else if constexpr(Dispatch == Dispatch_Goto)
+    {
+        // Direct threading, every handler ends in its own indirect jump to the next one
+#define GOTO_LABEL_ADDRESS(Slot) &&Handler_##Slot,
+#define GOTO_HANDLER(Slot) \
+    Handler_##Slot: \
+        ExecuteHandler<Timing, SLOT_HANDLER(Slot)>(Machine, Op); \
+        Op++; \
+        if((Op == OnePastLast) || Machine->CodeModified) \
+        { \
+            return Op; \
+        } \
+        Machine->IP += Op->Length; \
+        goto *Labels[Op->Handler];
+
+        static void *const Labels[HANDLER_SLOT_COUNT] = {HANDLER_SLOTS(GOTO_LABEL_ADDRESS)};
+
+        if(Op == OnePastLast)
+        {
+            return Op;
+        }
+
+        Machine->IP += Op->Length;
+        goto *Labels[Op->Handler];
+
+        HANDLER_SLOTS(GOTO_HANDLER)
+
+#undef GOTO_LABEL_ADDRESS
+#undef GOTO_HANDLER
+    }
+#endif
+    else if constexpr(Dispatch == Dispatch_Tail)
+    {
+        if(Op == OnePastLast)
+        {
+            return Op;
+        }
+
+        Machine->IP += Op->Length;
+        return tail_dispatch<Timing>::Table.Handlers[Op->Handler](Machine, Op, OnePastLast);
+    }
+    else
+    {
+        while(Op < OnePastLast)
+        {
+            Machine->IP += Op->Length;
+            RunMicroOp<Timing, Dispatch == Dispatch_Generic>(Machine, Op++);
+
+            if(Machine->CodeModified)
+            {
+                break;
+            }
+        }
+
+        return Op;
+    }
+}
+
+void ExecuteInstruction(machine *Machine, instruction *Instruction)
+{
+    micro_op Op = DecodeMicroOp(Instruction);
+    if(Machine->Clocks)
+    {
+        RunMicroOp<true, false>(Machine, &Op);
+    }
+    else
+    {
+        RunMicroOp<false, false>(Machine, &Op);
+    }
+}
+
+// NOTE (Pedro): Decode-every-step path, used when the block cache is off. Each op is decoded
+// right before it runs, so there is no stream to thread and only Generic changes anything.
+template<bool Timing, bool Generic>
+static void ExecuteUncached(machine *Machine, u64 Limit)
+{
+    buffer Buffer = {0, Machine->ProgramSize, 0, 0};
+
+    while((Machine->IP < Machine->ProgramSize) && (Machine->InstructionCount < Limit))
+    {
+        // The code moves when it is first written, see CopyPageOnWrite
+        Buffer.Bytes = GetCodeBytes(&Machine->Memory);
+        Buffer.IndexPtr = Machine->IP;
+
+        instruction Instruction = ParseInstruction(&Buffer);
+        if(Instruction.OpType == op_unknown)
+        {
+            fprintf(stderr, "ERROR: Unrecognized instruction at %04x\n", Machine->IP);
+            break;
+        }
+
+        Machine->IP = (u16)Buffer.IndexPtr;
+        micro_op Op = DecodeMicroOp(&Instruction);
+        RunMicroOp<Timing, Generic>(Machine, &Op);
+        Machine->InstructionCount++;
+    }
+}
+
+template<bool Timing, execute_dispatch Dispatch>
+static void ExecuteCached(machine *Machine, u64 Limit)
+{
+    block_cache *Cache = Machine->Cache;
+
+    while((Machine->IP < Machine->ProgramSize) && (Machine->InstructionCount < Limit))
+    {
+        code_block *Block = GetBlock(Cache, GetCodeBytes(&Machine->Memory), Machine->ProgramSize, Machine->IP);
+        if(!Block)
+        {
+            fprintf(stderr, "ERROR: Unrecognized instruction at %04x\n", Machine->IP);
+            break;
+        }
+
+        // Fused ops can't stop halfway, so the last few instructions before the limit are stepped
+        if(Block->InstructionCount > (Limit - Machine->InstructionCount))
+        {
+            ExecuteUncached<Timing, Dispatch == Dispatch_Generic>(Machine, Limit);
+            break;
+        }
+
+        micro_op *FirstOp = Cache->Ops + Block->FirstOp;
+        micro_op *OnePastLast = FirstOp + Block->OpCount;
+
+        // Ops stay valid even if the block is invalidated, the pool is only reset by GetBlock
+        micro_op *Op = RunBlock<Timing, Dispatch>(Machine, FirstOp, OnePastLast);
+
+        if(Machine->CodeModified)
+        {
+            Machine->CodeModified = false;
+            for(micro_op *Executed = FirstOp; Executed < Op; Executed++)
+            {
+                Machine->InstructionCount += (Executed->OpType >= MicroOp_FusedCmp) ? 2 : 1;
+            }
+        }
+        else
+        {
+            Machine->InstructionCount += Block->InstructionCount;
+        }
+    }
+}
+
+template<bool Timing, execute_dispatch Dispatch>
+static void ExecuteWith(machine *Machine, u64 Limit)
+{
+    if(Machine->Cache)
+    {
+        ExecuteCached<Timing, Dispatch>(Machine, Limit);
+    }
+    else
+    {
+        ExecuteUncached<Timing, Dispatch == Dispatch_Generic>(Machine, Limit);
+    }
+}
+
+template<bool Timing>
+static void ExecuteDispatch(machine *Machine, u64 Limit)
+{
+    switch(GetDispatch(Machine))
+    {
+        case Dispatch_Switch:  ExecuteWith<Timing, Dispatch_Switch>(Machine, Limit); break;
+        case Dispatch_Goto:    ExecuteWith<Timing, Dispatch_Goto>(Machine, Limit); break;
+        case Dispatch_Tail:    ExecuteWith<Timing, Dispatch_Tail>(Machine, Limit); break;
+        case Dispatch_Generic: ExecuteWith<Timing, Dispatch_Generic>(Machine, Limit); break;
+        default:               ExecuteWith<Timing, Dispatch_Call>(Machine, Limit); break;
+    }
+}
+
+// NOTE (Pedro): Runs until IP leaves the loaded program, hits an encoding we can't decode
+// or reaches the instruction limit
+void ExecuteProgram(machine *Machine)
+{
+    TIMED_BLOCK(Stage_Execute);
+
+    u64 Limit = Machine->InstructionLimit ? Machine->InstructionLimit : ~0ull;
+
+    if(Machine->Clocks)
+    {
+        ExecuteDispatch<true>(Machine, Limit);
+    }
+    else
+    {
+        ExecuteDispatch<false>(Machine, Limit);
+    }
+}
+
+static void AppendRegister(output_buffer *Out, const char *Name, u16 Value)
+{
+    if(Value)
+    {
+        AppendString(Out, "      ");
+        AppendString(Out, Name);
+        AppendString(Out, ": 0x");
+        AppendHex16(Out, Value);
+        AppendString(Out, " (");
+        AppendU32(Out, Value);
+        AppendString(Out, ")\n");
+    }
+}
+
+// NOTE (Pedro): Registers that are still zero are left out
+void PrintMachineState(machine *Machine, output_buffer *Out)
+{
+    regs *Regs = &Machine->Regs;
+    MaterializeFlags(Machine);
+
+    ReserveOutput(Out, 2 * MAX_OUTPUT_LINE);
+    AppendString(Out, "Final registers:\n");
+    AppendRegister(Out, "ax", Regs->ax);
+    AppendRegister(Out, "bx", Regs->bx);
+    AppendRegister(Out, "cx", Regs->cx);
+    AppendRegister(Out, "dx", Regs->dx);
+    AppendRegister(Out, "sp", Regs->sp);
+    AppendRegister(Out, "bp", Regs->bp);
+    AppendRegister(Out, "si", Regs->si);
+    AppendRegister(Out, "di", Regs->di);
+    AppendRegister(Out, "ip", Machine->IP);
+
+    if(Machine->Flags)
+    {
+        AppendString(Out, "   flags: ");
+        if(Machine->Flags & Flag_CF) AppendString(Out, "C");
+        if(Machine->Flags & Flag_PF) AppendString(Out, "P");
+        if(Machine->Flags & Flag_AF) AppendString(Out, "A");
+        if(Machine->Flags & Flag_ZF) AppendString(Out, "Z");
+        if(Machine->Flags & Flag_SF) AppendString(Out, "S");
+        if(Machine->Flags & Flag_OF) AppendString(Out, "O");
+        AppendString(Out, "\n");
+    }
+
+    AppendString(Out, "\nExecuted ");
+    AppendU64(Out, Machine->InstructionCount);
+    AppendString(Out, " instructions\n");
 }
@@ -3,6 +3,12 @@
 
 #include "sim86.h"
 #include "sim86_table.h"
+#include "sim86_loader.h"
+#include "sim86_output.h"
+#include "sim86_cache.h"
+#include "sim86_clocks.h"
+#include "sim86_arena.h"
+#include "sim86_memory.h"
 
 typedef union {
 
@@ -25,6 +31,81 @@ typedef union {
 
 } regs;
 
-void ExecuteInstruction(u8 BytesRead, buffer *Buffer);
+// NOTE (Pedro): Bit positions in the 8086 FLAGS register
+typedef enum flag_bits
+{
+    Flag_CF = 0x0001,
+    Flag_PF = 0x0004,
+    Flag_AF = 0x0010,
+    Flag_ZF = 0x0040,
+    Flag_SF = 0x0080,
+    Flag_OF = 0x0800,
+} flag_bits;
+
+// NOTE (Pedro): Operands and result of the last add/sub/cmp, flags are derived from it on demand
+typedef struct lazy_flags
+{
+    bool Pending;   // False when the FLAGS register is already up to date
+    bool IsSub;     // sub and cmp, otherwise add
+    u8 Wide;
+    u16 Left;
+    u16 Right;
+    u32 Result;     // Unmasked, so the carry out of add is still visible
+} lazy_flags;
+
+// NOTE (Pedro): How control gets from one cached op to the next. Call goes through the handler
+// table from a loop, Switch is one big switch with a case per handler, Goto threads the handlers
+// with computed gotos and Tail has every handler tail-call the next one. Generic skips the
+// specialized handlers and runs every op through ExecuteMicroOp's switches.
+typedef enum execute_dispatch
+{
+    Dispatch_Default,   // Whatever the build picked with SIM86_DISPATCH
+    Dispatch_Call,
+    Dispatch_Switch,
+    Dispatch_Goto,
+    Dispatch_Tail,
+    Dispatch_Generic,
+
+    Dispatch_Count,
+} execute_dispatch;
+
+// NOTE (Pedro): "make DISPATCH=goto" builds with that back end as the default, -dispatch still
+// picks any of them at run time so they can be checked against each other from one binary
+#ifndef SIM86_DISPATCH
+#define SIM86_DISPATCH Dispatch_Call
+#endif
+
+typedef struct machine
+{
+    regs Regs;
+    u16 IP;
+    u16 Flags;
+    lazy_flags LazyFlags;
+
+    memory_image Image;     // The loaded program, Memory is forked from it
+    page_pool Pool;         // Pages Memory copies on write
+    paged_memory Memory;
+
+    u32 ProgramSize;
+    u64 InstructionCount;
+    u64 InstructionLimit;   // Stop after this many instructions, 0 for no limit
+
+    block_cache *Cache;     // Pre-decoded blocks, 0 to decode every instruction as it runs
+    bool CodeModified;      // Set when a write invalidated cached code
+    execute_dispatch Dispatch;
+
+    clock_stats *Clocks;    // 8086 clock estimate of everything executed, 0 to skip the bookkeeping
+} machine;
+
+bool ParseDispatch(char *Name, execute_dispatch *Dispatch);
+execute_dispatch GetDispatch(machine *Machine);
+
+void InitMachine(machine *Machine, memory_arena *Arena);
+void ResetMachine(machine *Machine);
+bool LoadProgram(machine *Machine, image_source *Source);
+void ExecuteInstruction(machine *Machine, instruction *Instruction);
+void MaterializeFlags(machine *Machine);
+void ExecuteProgram(machine *Machine);
+void PrintMachineState(machine *Machine, output_buffer *Out);
 
 #endif
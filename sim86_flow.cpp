@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim86_flow.h"
+#include "sim86_decode.h"
+#include "sim86_table.h"
+#include "sim86_length.h"
+#include "sim86_display.h"
+#include "sim86_clocks.h"
+
+static bool TestBit(u64 *Bitmap, u64 Index)
+{
+    bool Result = (Bitmap[Index >> 6] >> (Index & 63)) & 1;
+    return Result;
+}
+
+static void SetBit(u64 *Bitmap, u64 Index)
+{
+    Bitmap[Index >> 6] |= (u64)1 << (Index & 63);
+}
+
+// NOTE (Pedro): Grows a u64 array by doubling, Count is the slot about to be written
+static u64 *GrowU64(memory_arena *Arena, u64 *Array, u64 Count, u64 *Capacity)
+{
+    if(Count == *Capacity)
+    {
+        u64 NewCapacity = *Capacity ? 2 * *Capacity : 256;
+        Array = (u64 *)GrowPush(Arena, Array, *Capacity * sizeof(u64), NewCapacity * sizeof(u64));
+        *Capacity = NewCapacity;
+    }
+
+    return Array;
+}
+
+static bool IsFlowJump(operation_types OpType)
+{
+    bool Result = (OpType >= jne) && (OpType <= jcxz);
+    return Result;
+}
+
+static u64 GetJumpTarget(instruction *Instruction)
+{
+    u64 Result = Instruction->Address + Instruction->Size + (s16)Instruction->Operands[0].Immediate.Value;
+    return Result;
+}
+
+static void PushWork(flow_disasm *Flow, u64 Address)
+{
+    Flow->Worklist = GrowU64(Flow->Arena, Flow->Worklist, Flow->WorklistCount, &Flow->WorklistCapacity);
+    Flow->Worklist[Flow->WorklistCount++] = Address;
+}
+
+// NOTE (Pedro): Follows straight-line code from Address until a ret, an unknown opcode, the end
+// of the image or bytes some earlier path already traced. Jump targets go on the worklist.
+static void TraceFrom(flow_disasm *Flow, u64 Address)
+{
+    while(Address < Flow->ImageSize)
+    {
+        // Already traced, or a jump into the middle of an instruction
+        if(TestBit(Flow->Decoded, Address))
+        {
+            break;
+        }
+
+        u32 Size = GetInstructionLength(Flow->Image + Address, Flow->ImageSize - Address);
+        if(!Size)
+        {
+            break;
+        }
+
+        // Running into an instruction that's already there means this one overlaps it, keep the first
+        bool Overlaps = false;
+        for(u32 Offset = 1; Offset < Size; Offset++)
+        {
+            Overlaps |= TestBit(Flow->Decoded, Address + Offset);
+        }
+
+        if(Overlaps)
+        {
+            break;
+        }
+
+        for(u32 Offset = 0; Offset < Size; Offset++)
+        {
+            SetBit(Flow->Decoded, Address + Offset);
+        }
+        SetBit(Flow->Starts, Address);
+
+        opcode_entry Entry = OpcodeTable[Flow->Image[Address]];
+        if(Entry.Layout == Layout_Jump)
+        {
+            u64 Target = Address + Size + (s8)Flow->Image[Address + 1];
+            if(Target < Flow->ImageSize)
+            {
+                PushWork(Flow, Target);
+
+                Flow->Labels = GrowU64(Flow->Arena, Flow->Labels, Flow->LabelCount, &Flow->LabelCapacity);
+                Flow->Labels[Flow->LabelCount++] = Target;
+            }
+        }
+
+        if(!(Entry.Flags & Opcode_Group) && (Entry.OpType == ret))
+        {
+            break;
+        }
+
+        Address += Size;
+    }
+}
+
+static int CompareAddresses(const void *A, const void *B)
+{
+    u64 AddressA = *(u64 *)A;
+    u64 AddressB = *(u64 *)B;
+    int Result = (AddressA > AddressB) - (AddressA < AddressB);
+    return Result;
+}
+
+// NOTE (Pedro): Sorts the targets and keeps one of each that landed on an instruction start.
+// A label's number is its index, so jumps find theirs with a binary search.
+static void ResolveLabels(flow_disasm *Flow)
+{
+    qsort(Flow->Labels, Flow->LabelCount, sizeof(u64), CompareAddresses);
+
+    u64 Kept = 0;
+    for(u64 Index = 0; Index < Flow->LabelCount; Index++)
+    {
+        u64 Target = Flow->Labels[Index];
+        if(((Kept == 0) || (Flow->Labels[Kept - 1] != Target)) && TestBit(Flow->Starts, Target))
+        {
+            Flow->Labels[Kept++] = Target;
+        }
+    }
+
+    Flow->LabelCount = Kept;
+}
+
+static bool FindLabel(flow_disasm *Flow, u64 Target, u64 *LabelIndex)
+{
+    u64 Low = 0;
+    u64 High = Flow->LabelCount;
+    while(Low < High)
+    {
+        u64 Middle = Low + (High - Low) / 2;
+        if(Flow->Labels[Middle] < Target)
+        {
+            Low = Middle + 1;
+        }
+        else
+        {
+            High = Middle;
+        }
+    }
+
+    *LabelIndex = Low;
+    bool Result = (Low < Flow->LabelCount) && (Flow->Labels[Low] == Target);
+    return Result;
+}
+
+static void AppendSkipped(output_buffer *Out, u64 Address, u64 Size)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "; ");
+    AppendU64(Out, Size);
+    AppendString(Out, " bytes at ");
+    AppendU64(Out, Address);
+    AppendString(Out, " not reached from the entry point\n");
+}
+
+static void PrintFlow(flow_disasm *Flow, bool Clocks, output_buffer *Out)
+{
+    u64 NextLabel = 0;
+    u64 NextAddress = 0;
+    u64 TotalClocks = 0;
+
+    buffer Buffer = {};
+    Buffer.Bytes = Flow->Image;
+    Buffer.Count = Flow->ImageSize;
+
+    u64 WordCount = (Flow->ImageSize + 63) / 64;
+    for(u64 WordIndex = 0; WordIndex < WordCount; WordIndex++)
+    {
+        // Visit the set bits of each word low to high, that's address order
+        u64 Word = Flow->Starts[WordIndex];
+        while(Word)
+        {
+            u64 Address = 64 * WordIndex + __builtin_ctzll(Word);
+            Word &= Word - 1;
+
+            Buffer.IndexPtr = Address;
+            instruction Instruction = ParseInstruction(&Buffer);
+
+            if(Address > NextAddress)
+            {
+                AppendSkipped(Out, NextAddress, Address - NextAddress);
+            }
+            NextAddress = Address + Instruction.Size;
+
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+
+            if((NextLabel < Flow->LabelCount) && (Flow->Labels[NextLabel] == Address))
+            {
+                AppendString(Out, "label_");
+                AppendU64(Out, NextLabel++);
+                AppendString(Out, ":\n");
+            }
+
+            // Targets that didn't get a label (outside the image, mid-instruction) keep the $ form
+            u64 LabelIndex;
+            if(IsFlowJump(Instruction.OpType) && FindLabel(Flow, GetJumpTarget(&Instruction), &LabelIndex))
+            {
+                AppendString(Out, GetMnemonic(Instruction.OpType));
+                AppendString(Out, " label_");
+                AppendU64(Out, LabelIndex);
+            }
+            else
+            {
+                AppendInstruction(&Instruction, Out);
+            }
+
+            if(Clocks)
+            {
+                AppendInstructionClocks(&Instruction, &TotalClocks, Out);
+            }
+
+            AppendString(Out, "\n");
+        }
+    }
+
+    if(NextAddress < Flow->ImageSize)
+    {
+        AppendSkipped(Out, NextAddress, Flow->ImageSize - NextAddress);
+    }
+}
+
+// NOTE (Pedro): Entry point is the start of the image. The listing comes out in address order
+// with a label_N: line before every jump target, numbered by address. The bitmaps and lists
+// come from Arena and go away with the image.
+void DisAsm8086Flow(u8 *Image, u64 ImageSize, bool Clocks, output_buffer *Out, memory_arena *Arena)
+{
+    flow_disasm Flow = {};
+    Flow.Image = Image;
+    Flow.ImageSize = ImageSize;
+    Flow.Arena = Arena;
+
+    u64 BitmapWords = (ImageSize + 63) / 64;
+    Flow.Decoded = PushZeroArray(Arena, BitmapWords ? BitmapWords : 1, u64);
+    Flow.Starts = PushZeroArray(Arena, BitmapWords ? BitmapWords : 1, u64);
+
+    PushWork(&Flow, 0);
+    while(Flow.WorklistCount)
+    {
+        u64 Address = Flow.Worklist[--Flow.WorklistCount];
+        TraceFrom(&Flow, Address);
+    }
+
+    ResolveLabels(&Flow);
+
+    PrintFlow(&Flow, Clocks, Out);
+}
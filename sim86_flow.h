@@ -0,0 +1,34 @@
+#ifndef SIM86_FLOW_H
+#define SIM86_FLOW_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+
+// NOTE (Pedro): Control-flow disassembly. Tracing starts at the entry point and follows jump,
+// loop and jcxz targets through a worklist, using only the opcode table for lengths and targets.
+// Decoded and Starts are bitmaps over the image, one bit per byte. The listing is then a walk
+// over Starts in address order, so every reached instruction is fully decoded exactly once and
+// bytes no path reaches never are.
+typedef struct flow_disasm
+{
+    u8 *Image;
+    u64 ImageSize;
+    memory_arena *Arena;
+
+    u64 *Decoded;       // Every byte of every instruction traced so far
+    u64 *Starts;        // First byte of each of them, the only places a label can go
+
+    u64 *Worklist;
+    u64 WorklistCount;
+    u64 WorklistCapacity;
+
+    // Jump targets inside the image, sorted and deduplicated before printing
+    u64 *Labels;
+    u64 LabelCount;
+    u64 LabelCapacity;
+} flow_disasm;
+
+void DisAsm8086Flow(u8 *Image, u64 ImageSize, bool Clocks, output_buffer *Out, memory_arena *Arena);
+
+#endif
@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "sim86_format.h"
+#include "sim86_display.h"
+#include "sim86_stats.h"
+
+bool ParseOutputFormat(char *Name, output_format *Format)
+{
+    bool Result = true;
+
+    if(strcmp(Name, "text") == 0)
+    {
+        *Format = Format_Text;
+    }
+    else if(strcmp(Name, "binary") == 0)
+    {
+        *Format = Format_Binary;
+    }
+    else if((strcmp(Name, "jsonl") == 0) || (strcmp(Name, "json") == 0))
+    {
+        *Format = Format_Json;
+    }
+    else
+    {
+        Result = false;
+    }
+
+    return Result;
+}
+
+void AppendRecordHeader(output_buffer *Out)
+{
+    record_file_header Header = {};
+    Header.Magic = RECORD_FILE_MAGIC;
+    Header.Version = RECORD_FILE_VERSION;
+    Header.HeaderSize = sizeof(record_file_header);
+    Header.RecordSize = sizeof(instruction_record);
+    Header.OpTypeCount = op_unknown;
+    Header.RegisterCount = unknown;
+
+    AppendBytes(Out, (u8 *)&Header, sizeof(Header));
+}
+
+void AppendInstructionRecord(instruction *Instruction, output_buffer *Out)
+{
+    TIMED_BLOCK(Stage_Print);
+
+    instruction_record Record;
+    PackInstruction(Instruction, &Record);
+
+    AppendBytes(Out, (u8 *)&Record, sizeof(Record));
+}
+
+// NOTE (Pedro): Quotes included. Control bytes go out as \u00XX, callers reserve 6 bytes per character.
+static void AppendJsonString(output_buffer *Out, const char *String)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+
+    u8 *Dest = Out->Base + Out->Used;
+    *Dest++ = '"';
+
+    for(; *String; String++)
+    {
+        u8 Char = (u8)*String;
+        if((Char == '"') || (Char == '\\'))
+        {
+            *Dest++ = '\\';
+            *Dest++ = Char;
+        }
+        else if(Char < 0x20)
+        {
+            *Dest++ = '\\';
+            *Dest++ = 'u';
+            *Dest++ = '0';
+            *Dest++ = '0';
+            *Dest++ = HexDigits[Char >> 4];
+            *Dest++ = HexDigits[Char & 0xF];
+        }
+        else
+        {
+            *Dest++ = Char;
+        }
+    }
+
+    *Dest++ = '"';
+    Out->Used = Dest - Out->Base;
+}
+
+void AppendJsonHeader(char *Name, output_buffer *Out)
+{
+    ReserveOutput(Out, 6 * strlen(Name) + MAX_JSON_LINE);
+
+    AppendString(Out, "{\"file\":");
+    AppendJsonString(Out, Name);
+    AppendString(Out, ",\"bits\":16,\"version\":");
+    AppendU32(Out, RECORD_FILE_VERSION);
+    AppendString(Out, "}\n");
+}
+
+void AppendInstructionJson(instruction *Instruction, output_buffer *Out)
+{
+    TIMED_BLOCK(Stage_Print);
+
+    ReserveOutput(Out, MAX_JSON_LINE);
+
+    AppendString(Out, "{\"address\":");
+    AppendU64(Out, Instruction->Address);
+    AppendString(Out, ",\"size\":");
+    AppendU32(Out, Instruction->Size);
+    AppendString(Out, ",\"op\":\"");
+    AppendString(Out, GetMnemonic(Instruction->OpType));
+    AppendString(Out, Instruction->WBit ? "\",\"wide\":true,\"operands\":[" : "\",\"wide\":false,\"operands\":[");
+
+    const char *Separator = "";
+    for(u32 Index = 0; Index < ArrayCount(Instruction->Operands); Index++)
+    {
+        instruction_operand *Operand = &Instruction->Operands[Index];
+        if(Operand->Type == Operand_None)
+        {
+            continue;
+        }
+
+        AppendString(Out, Separator);
+        Separator = ",";
+
+        switch(Operand->Type)
+        {
+            case Operand_Register:
+            {
+                AppendString(Out, "{\"kind\":\"register\",\"register\":\"");
+                AppendString(Out, GetRegister(Operand->Register));
+                AppendString(Out, "\"}");
+            } break;
+
+            case Operand_Memory:
+            {
+                if(Operand->Memory.Flags.Memory_HasDirectAddress)
+                {
+                    AppendString(Out, "{\"kind\":\"memory\",\"address\":");
+                    AppendU32(Out, Operand->Memory.DirectAddress);
+                }
+                else
+                {
+                    AppendString(Out, "{\"kind\":\"memory\",\"base\":\"");
+                    AppendString(Out, GetRegister(Operand->Memory.Register));
+                    AppendString(Out, "\",\"displacement\":");
+                    AppendS32(Out, Operand->Memory.Flags.Memory_HasDisplacement ? Operand->Memory.Displacement : 0);
+                }
+
+                AppendString(Out, "}");
+            } break;
+
+            case Operand_Immediate:
+            {
+                // Jumps carry the increment and where it lands, counted from the next instruction
+                if(Operand->Immediate.Flags.Immediate_IsRelative)
+                {
+                    s32 Increment = (s16)Operand->Immediate.Value;
+                    AppendString(Out, "{\"kind\":\"relative\",\"increment\":");
+                    AppendS32(Out, Increment);
+                    AppendString(Out, ",\"target\":");
+                    AppendS64(Out, (s64)(Instruction->Address + Instruction->Size) + Increment);
+                    AppendString(Out, "}");
+                    break;
+                }
+
+                AppendString(Out, "{\"kind\":\"immediate\",\"value\":");
+                AppendU32(Out, Operand->Immediate.Value);
+
+                if(Operand->Immediate.Flags.Memory_IsWide)
+                {
+                    AppendString(Out, (Operand->Immediate.Flags.Memory_IsWide == 0x2) ? ",\"size\":\"word\"" : ",\"size\":\"byte\"");
+                }
+
+                AppendString(Out, "}");
+            } break;
+
+            default:
+            {
+            } break;
+        }
+    }
+
+    AppendString(Out, "]}\n");
+}
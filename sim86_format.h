@@ -0,0 +1,44 @@
+#ifndef SIM86_FORMAT_H
+#define SIM86_FORMAT_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_decode.h"
+
+// NOTE (Pedro): How disassembly is written out. Binary and JSON Lines come straight from the
+// instruction fields so tools don't have to re-parse the NASM text.
+typedef enum output_format
+{
+    Format_Text,
+    Format_Binary,      // record_file_header then one instruction_record per instruction
+    Format_Json,        // One object per line, the first one names the file
+} output_format;
+
+#define RECORD_FILE_MAGIC 0x49363853    // "S86I"
+#define RECORD_FILE_VERSION 2    // 2: 64-bit record addresses
+
+// NOTE (Pedro): 16 bytes so the records after it stay aligned when the file is mapped. There is
+// no record count, the records run to the end of the file: (FileSize - HeaderSize) / RecordSize.
+typedef struct record_file_header
+{
+    u32 Magic;
+    u16 Version;
+    u16 HeaderSize;
+    u16 RecordSize;
+    u8 OpTypeCount;     // op_unknown and unknown when written, so readers can tell the enums apart
+    u8 RegisterCount;
+    u32 Reserved;
+} record_file_header;
+
+// NOTE (Pedro): Longest JSON line, a memory operand plus an immediate with every field present
+#define MAX_JSON_LINE 512
+
+bool ParseOutputFormat(char *Name, output_format *Format);
+
+void AppendRecordHeader(output_buffer *Out);
+void AppendInstructionRecord(instruction *Instruction, output_buffer *Out);
+
+void AppendJsonHeader(char *Name, output_buffer *Out);
+void AppendInstructionJson(instruction *Instruction, output_buffer *Out);
+
+#endif
@@ -0,0 +1,437 @@
+#include "sim86_length.h"
+#include "sim86_decode.h"
+#include "sim86_table.h"
+#include "sim86_stats.h"
+
+// NOTE (Pedro): Length of an encoding is Base[Opcode] + (ModRMSize[ModRM] & ModRMMask[Opcode]),
+// so the common case is three loads and no branches. ValidRegs catches the group entries whose
+// reg field ParseInstruction would reject.
+typedef struct length_tables
+{
+    u8 Base[256];       // Opcode byte, fixed displacement and data. 0 if the byte can't start an instruction
+    u8 ModRMMask[256];  // 0xFF when a ModRM byte follows the opcode
+    u8 ValidRegs[256];  // Bit per reg field value that decodes, all set for opcodes that aren't groups
+    u8 ModRMSize[256];  // ModRM byte plus the displacement its mod and r/m ask for
+} length_tables;
+
+static constexpr length_tables BuildLengthTables()
+{
+    length_tables Tables = {};
+
+    for(u32 Byte = 0; Byte < 256; Byte++)
+    {
+        opcode_entry Entry = OpcodeTable[Byte];
+
+        Tables.Base[Byte] = (Entry.Layout == Layout_None) ? 0 : (u8)(1 + Entry.DispSize + Entry.ImmSize);
+        Tables.ModRMMask[Byte] = (Entry.Flags & Opcode_ModRM) ? 0xFF : 0;
+        Tables.ValidRegs[Byte] = 0xFF;
+
+        if(Entry.Flags & Opcode_Group)
+        {
+            Tables.ValidRegs[Byte] = 0;
+            for(u32 Reg = 0; Reg < 8; Reg++)
+            {
+                if(OpcodeGroupTable[Entry.OpType][Reg] != op_unknown)
+                {
+                    Tables.ValidRegs[Byte] |= (u8)(1 << Reg);
+                }
+            }
+        }
+
+        // Same as GetInstructionSize for a ModRM byte, less the opcode byte itself
+        u32 Mod = Byte >> 6;
+        u32 Rm = Byte & 0b111;
+        u32 Size = 1;
+        if(Mod == 0b01)
+        {
+            Size += 1;
+        }
+        else if((Mod == 0b10) || ((Mod == 0b00) && (Rm == 0b110)))
+        {
+            Size += 2;
+        }
+        Tables.ModRMSize[Byte] = (u8)Size;
+    }
+
+    return Tables;
+}
+
+static constexpr length_tables LengthTables = BuildLengthTables();
+
+// NOTE (Pedro): Encoded size of the instruction at At, 0 wherever ParseInstruction would give
+// up (unknown opcode or group entry, encoding cut off by the end of the image)
+u32 GetInstructionLength(u8 *At, u64 Remaining)
+{
+    u8 Opcode = At[0];
+    u8 ModRM = (Remaining > 1) ? At[1] : 0;
+
+    u32 Result = LengthTables.Base[Opcode] + (LengthTables.ModRMSize[ModRM] & LengthTables.ModRMMask[Opcode]);
+    bool Valid = LengthTables.Base[Opcode] && ((LengthTables.ValidRegs[Opcode] >> ((ModRM >> 3) & 0b111)) & 1);
+
+    if(!Valid || (Result > Remaining))
+    {
+        Result = 0;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): GetInstructionLength without the end of image checks, a whole encoding must fit
+static u32 GetUncheckedLength(u8 *At)
+{
+    u8 Opcode = At[0];
+    u8 ModRM = At[1];
+
+    u32 Result = LengthTables.Base[Opcode] + (LengthTables.ModRMSize[ModRM] & LengthTables.ModRMMask[Opcode]);
+    if(!LengthTables.Base[Opcode] || !((LengthTables.ValidRegs[Opcode] >> ((ModRM >> 3) & 0b111)) & 1))
+    {
+        Result = 0;
+    }
+
+    return Result;
+}
+
+static bool IsStartBit(u64 *Starts, u64 Address)
+{
+    bool Result = (Starts[Address >> 6] >> (Address & 63)) & 1;
+    return Result;
+}
+
+// NOTE (Pedro): Clears the start bits in [From, To)
+static void ClearStarts(u64 *Starts, u64 From, u64 To)
+{
+    for(u64 Address = From; (Address < To) && (Address & 63); Address++)
+    {
+        Starts[Address >> 6] &= ~((u64)1 << (Address & 63));
+        From = Address + 1;
+    }
+
+    for(; (From + 64) <= To; From += 64)
+    {
+        Starts[From >> 6] = 0;
+    }
+
+    for(; From < To; From++)
+    {
+        Starts[From >> 6] &= ~((u64)1 << (From & 63));
+    }
+}
+
+// NOTE (Pedro): A speculative stream that lands on something that doesn't decode was off the
+// real instruction stream there, or the real stream ends there. Either way it steps one byte on
+// and keeps guessing, the seam fix-up works out which.
+static void SkipInvalid(length_stream *Stream)
+{
+    Stream->LastSkip = Stream->At;
+    Stream->Skipped = true;
+    Stream->At++;
+}
+
+// NOTE (Pedro): Hops from Stream->At marking starts until one lands at or past Stream->End or
+// on something that doesn't decode. Safe all the way to the end of the image.
+static void TraceLengths(u8 *Image, u64 ImageSize, u64 *Starts, length_stream *Stream)
+{
+    while(Stream->At < Stream->End)
+    {
+        u32 Length = GetInstructionLength(Image + Stream->At, ImageSize - Stream->At);
+        if(!Length)
+        {
+            if(Stream->Speculative)
+            {
+                SkipInvalid(Stream);
+                continue;
+            }
+
+            Stream->Stopped = true;
+            break;
+        }
+
+        Starts[Stream->At >> 6] |= (u64)1 << (Stream->At & 63);
+        Stream->At += Length;
+    }
+}
+
+// NOTE (Pedro): Each length depends on where the last one ended, so one stream of hops is a
+// serial chain of dependent loads. The image is split into LENGTH_STREAMS segments that are
+// traced side by side from speculative starts, which keeps several chains in flight at once.
+// 8086 encodings fall back into step within a few instructions, so each seam is fixed up by
+// tracing the true stream into the next segment until it lands on a start that segment found.
+void BuildBoundaryIndex(u8 *Image, u64 ImageSize, boundary_index *Index, memory_arena *Arena)
+{
+    TIMED_BLOCK(Stage_Length);
+
+    *Index = {};
+    Index->ImageSize = ImageSize;
+    Index->WordCount = (ImageSize + 63) / 64;
+    Index->Starts = PushZeroArray(Arena, Index->WordCount + 1, u64);
+    Index->Ranks = PushZeroArray(Arena, (Index->WordCount / BOUNDARY_RANK_WORDS) + 1, u64);
+
+    u64 *Starts = Index->Starts;
+
+    // Segments start on word boundaries so no two streams ever write the same bitmap word
+    u32 StreamCount = (ImageSize >= LENGTH_MIN_SEGMENT * LENGTH_STREAMS) ? LENGTH_STREAMS : 1;
+    u64 SegmentSize = ((ImageSize / StreamCount) + 63) & ~(u64)63;
+
+    length_stream Streams[LENGTH_STREAMS] = {};
+    for(u32 StreamIndex = 0; StreamIndex < StreamCount; StreamIndex++)
+    {
+        Streams[StreamIndex].At = StreamIndex * SegmentSize;
+        Streams[StreamIndex].End = (StreamIndex == (StreamCount - 1)) ? ImageSize : (StreamIndex + 1) * SegmentSize;
+        Streams[StreamIndex].Speculative = (StreamIndex > 0);
+    }
+
+    // Every stream has a whole encoding ahead of it inside its segment, no bounds checks needed.
+    // The four positions live in locals so the chains stay in registers. A speculative stream
+    // that doesn't decode drops out of the loop just long enough to step over the byte.
+    if(StreamCount == LENGTH_STREAMS)
+    {
+        u64 Limit0 = Streams[0].End - MAX_INSTRUCTION_SIZE;
+        u64 Limit1 = Streams[1].End - MAX_INSTRUCTION_SIZE;
+        u64 Limit2 = Streams[2].End - MAX_INSTRUCTION_SIZE;
+        u64 Limit3 = Streams[3].End - MAX_INSTRUCTION_SIZE;
+
+        for(;;)
+        {
+            u64 At0 = Streams[0].At;
+            u64 At1 = Streams[1].At;
+            u64 At2 = Streams[2].At;
+            u64 At3 = Streams[3].At;
+
+            while((At0 <= Limit0) && (At1 <= Limit1) && (At2 <= Limit2) && (At3 <= Limit3))
+            {
+                u32 Length0 = GetUncheckedLength(Image + At0);
+                u32 Length1 = GetUncheckedLength(Image + At1);
+                u32 Length2 = GetUncheckedLength(Image + At2);
+                u32 Length3 = GetUncheckedLength(Image + At3);
+
+                if(!Length0 || !Length1 || !Length2 || !Length3)
+                {
+                    break;
+                }
+
+                Starts[At0 >> 6] |= (u64)1 << (At0 & 63);
+                Starts[At1 >> 6] |= (u64)1 << (At1 & 63);
+                Starts[At2 >> 6] |= (u64)1 << (At2 & 63);
+                Starts[At3 >> 6] |= (u64)1 << (At3 & 63);
+
+                At0 += Length0;
+                At1 += Length1;
+                At2 += Length2;
+                At3 += Length3;
+            }
+
+            Streams[0].At = At0;
+            Streams[1].At = At1;
+            Streams[2].At = At2;
+            Streams[3].At = At3;
+
+            if((At0 > Limit0) || (At1 > Limit1) || (At2 > Limit2) || (At3 > Limit3) ||
+               !GetUncheckedLength(Image + At0))
+            {
+                break;
+            }
+
+            for(u32 StreamIndex = 1; StreamIndex < LENGTH_STREAMS; StreamIndex++)
+            {
+                if(!GetUncheckedLength(Image + Streams[StreamIndex].At))
+                {
+                    SkipInvalid(&Streams[StreamIndex]);
+                }
+            }
+        }
+    }
+
+    for(u32 StreamIndex = 0; StreamIndex < StreamCount; StreamIndex++)
+    {
+        TraceLengths(Image, ImageSize, Starts, &Streams[StreamIndex]);
+    }
+
+    // Stream 0 started on a real instruction, each seam carries the true stream one segment on
+    u64 End = ImageSize;
+    for(u32 StreamIndex = 0; StreamIndex < StreamCount; StreamIndex++)
+    {
+        length_stream *Stream = &Streams[StreamIndex];
+        if(StreamIndex > 0)
+        {
+            length_stream *Previous = &Streams[StreamIndex - 1];
+            u64 SegmentStart = StreamIndex * SegmentSize;
+
+            // Walk the true stream until it meets a start this segment found on its own
+            u64 TrueAt = Previous->At;
+            bool Stopped = false;
+            while((TrueAt < Stream->End) && !IsStartBit(Starts, TrueAt))
+            {
+                u32 Length = GetInstructionLength(Image + TrueAt, ImageSize - TrueAt);
+                if(!Length)
+                {
+                    Stopped = true;
+                    break;
+                }
+
+                TrueAt += Length;
+            }
+
+            // Met before a byte the segment stepped over means the true stream runs into that
+            // byte and stops there. Rare enough to just retrace the segment serially.
+            if(!Stopped && (TrueAt < Stream->End) && Stream->Skipped && (TrueAt < Stream->LastSkip))
+            {
+                ClearStarts(Starts, SegmentStart, Stream->End);
+
+                length_stream Fix = {};
+                Fix.At = Previous->At;
+                Fix.End = Stream->End;
+                TraceLengths(Image, ImageSize, Starts, &Fix);
+
+                *Stream = Fix;
+            }
+            else
+            {
+                // Speculative starts before that point are wrong, the true ones go back in
+                ClearStarts(Starts, SegmentStart, (TrueAt < Stream->End) ? TrueAt : Stream->End);
+
+                length_stream Fix = {};
+                Fix.At = Previous->At;
+                Fix.End = TrueAt;
+                TraceLengths(Image, ImageSize, Starts, &Fix);
+
+                if(Stopped)
+                {
+                    Stream->At = TrueAt;
+                    Stream->Stopped = true;
+                }
+                else if(TrueAt >= Stream->End)
+                {
+                    // Never met, the true stream ran the whole segment itself
+                    Stream->At = TrueAt;
+                }
+            }
+        }
+
+        if(Stream->Stopped)
+        {
+            End = Stream->At;
+            ClearStarts(Starts, End, ImageSize);
+            break;
+        }
+
+        End = Stream->At;
+    }
+
+    Index->End = (End < ImageSize) ? End : ImageSize;
+
+    u64 Count = 0;
+    for(u64 Word = 0; Word < Index->WordCount; Word++)
+    {
+        if((Word % BOUNDARY_RANK_WORDS) == 0)
+        {
+            Index->Ranks[Word / BOUNDARY_RANK_WORDS] = Count;
+        }
+
+        Count += __builtin_popcountll(Starts[Word]);
+    }
+
+    if((Index->WordCount % BOUNDARY_RANK_WORDS) == 0)
+    {
+        Index->Ranks[Index->WordCount / BOUNDARY_RANK_WORDS] = Count;
+    }
+
+    Index->InstructionCount = Count;
+}
+
+bool IsInstructionStart(boundary_index *Index, u64 Address)
+{
+    bool Result = (Address < Index->ImageSize) && ((Index->Starts[Address >> 6] >> (Address & 63)) & 1);
+    return Result;
+}
+
+// NOTE (Pedro): First start at or after Address, End when there is none
+u64 GetNextInstructionStart(boundary_index *Index, u64 Address)
+{
+    if(Address >= Index->End)
+    {
+        return Index->End;
+    }
+
+    u64 Word = Address >> 6;
+    u64 Bits = Index->Starts[Word] & (~(u64)0 << (Address & 63));
+
+    while(!Bits)
+    {
+        if(++Word >= Index->WordCount)
+        {
+            return Index->End;
+        }
+
+        Bits = Index->Starts[Word];
+    }
+
+    u64 Result = (Word << 6) + __builtin_ctzll(Bits);
+    return Result;
+}
+
+// NOTE (Pedro): Instructions that start before Address
+u64 GetInstructionNumber(boundary_index *Index, u64 Address)
+{
+    if(Address >= Index->ImageSize)
+    {
+        return Index->InstructionCount;
+    }
+
+    u64 Word = Address >> 6;
+    u64 Result = Index->Ranks[Word / BOUNDARY_RANK_WORDS];
+
+    for(u64 Scan = Word - (Word % BOUNDARY_RANK_WORDS); Scan < Word; Scan++)
+    {
+        Result += __builtin_popcountll(Index->Starts[Scan]);
+    }
+
+    Result += __builtin_popcountll(Index->Starts[Word] & (((u64)1 << (Address & 63)) - 1));
+    return Result;
+}
+
+// NOTE (Pedro): Address of instruction Number (0 based), End past the last one
+u64 GetInstructionAddress(boundary_index *Index, u64 Number)
+{
+    if(Number >= Index->InstructionCount)
+    {
+        return Index->End;
+    }
+
+    // Last rank entry at or below Number
+    u64 Low = 0;
+    u64 High = Index->WordCount / BOUNDARY_RANK_WORDS;
+    while(Low < High)
+    {
+        u64 Middle = Low + (High - Low + 1) / 2;
+        if(Index->Ranks[Middle] <= Number)
+        {
+            Low = Middle;
+        }
+        else
+        {
+            High = Middle - 1;
+        }
+    }
+
+    u64 Word = Low * BOUNDARY_RANK_WORDS;
+    u64 Left = Number - Index->Ranks[Low];
+
+    for(;;)
+    {
+        u64 Bits = Index->Starts[Word];
+        u64 Count = __builtin_popcountll(Bits);
+        if(Left < Count)
+        {
+            while(Left--)
+            {
+                Bits &= Bits - 1;
+            }
+
+            u64 Result = (Word << 6) + __builtin_ctzll(Bits);
+            return Result;
+        }
+
+        Left -= Count;
+        Word++;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SIM86_LENGTH_H
+#define SIM86_LENGTH_H
+
+#include "sim86.h"
+#include "sim86_arena.h"
+
+// NOTE (Pedro): Instructions per rank entry are counted every this many bitmap words (512 bytes
+// of image), the words in between are popcounted
+#define BOUNDARY_RANK_WORDS 8
+
+// NOTE (Pedro): Independent hop chains traced side by side when building the index, and the
+// smallest segment worth giving one
+#define LENGTH_STREAMS 4
+#define LENGTH_MIN_SEGMENT (16 * 1024)
+
+typedef struct length_stream
+{
+    u64 At;             // Next start to look at
+    u64 End;            // Segment end, the stream stops at the first start at or past it
+    u64 LastSkip;       // Last byte a speculative stream stepped over, it didn't decode
+    bool Speculative;   // Started at a guess, steps over what doesn't decode instead of stopping
+    bool Skipped;
+    bool Stopped;       // Hit something that doesn't decode
+} length_stream;
+
+// NOTE (Pedro): Where every instruction of an image starts, found with the length tables alone.
+// Starts has one bit per image byte. Ranks[N] is the number of starts before word
+// N * BOUNDARY_RANK_WORDS, so offset -> instruction number and back are a lookup and a scan.
+typedef struct boundary_index
+{
+    u64 ImageSize;
+    u64 End;                // First byte past the last instruction, an unknown opcode or truncated encoding
+    u64 InstructionCount;
+
+    u64 *Starts;
+    u64 *Ranks;
+    u64 WordCount;
+} boundary_index;
+
+u32 GetInstructionLength(u8 *At, u64 Remaining);
+
+void BuildBoundaryIndex(u8 *Image, u64 ImageSize, boundary_index *Index, memory_arena *Arena);
+
+bool IsInstructionStart(boundary_index *Index, u64 Address);
+u64 GetNextInstructionStart(boundary_index *Index, u64 Address);
+u64 GetInstructionNumber(boundary_index *Index, u64 Address);
+u64 GetInstructionAddress(boundary_index *Index, u64 Number);
+
+#endif
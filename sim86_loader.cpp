@@ -0,0 +1,124 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sim86_loader.h"
+#include "sim86_stats.h"
+
+// NOTE (Pedro): Regular files are mapped whole, anything else ("-" for stdin, pipes) is streamed in
+// chunks. The read window comes from Arena, so it goes away with the image's arena reset.
+bool OpenImage(image_source *Source, char *FileName, memory_arena *Arena)
+{
+    TIMED_BLOCK(Stage_Load);
+
+    *Source = {};
+
+    if(strcmp(FileName, "-") == 0)
+    {
+        Source->FileHandle = STDIN_FILENO;
+    }
+    else
+    {
+        Source->FileHandle = open(FileName, O_RDONLY);
+        if(Source->FileHandle < 0)
+        {
+            fprintf(stderr, "ERROR: Could not open file %s\n", FileName);
+            return false;
+        }
+    }
+
+    struct stat FileStat;
+    if((fstat(Source->FileHandle, &FileStat) == 0) && S_ISREG(FileStat.st_mode) && (FileStat.st_size > 0))
+    {
+        void *Mapped = mmap(0, FileStat.st_size, PROT_READ, MAP_PRIVATE, Source->FileHandle, 0);
+        if(Mapped != MAP_FAILED)
+        {
+            madvise(Mapped, FileStat.st_size, MADV_SEQUENTIAL);
+
+            Source->Mapped = (u8 *)Mapped;
+            Source->MappedSize = FileStat.st_size;
+            Source->EndOfInput = true;
+
+            Source->Buffer.Bytes = Source->Mapped;
+            Source->Buffer.Count = Source->MappedSize;
+            return true;
+        }
+    }
+
+    Source->Chunk = PushArray(Arena, STREAM_CHUNK_SIZE, u8);
+    Source->Buffer.Bytes = Source->Chunk;
+    RefillImage(Source);
+
+    return true;
+}
+
+// NOTE (Pedro): Image that is already in memory (a server request), the caller keeps owning Bytes
+bool OpenImageFromMemory(image_source *Source, u8 *Bytes, u64 Size)
+{
+    *Source = {};
+    Source->FileHandle = -1;
+    Source->EndOfInput = true;
+
+    // The whole image is there, so it counts as mapped for the paths that need all of it
+    Source->Mapped = Bytes;
+    Source->MappedSize = Size;
+    Source->Borrowed = true;
+
+    Source->Buffer.Bytes = Bytes;
+    Source->Buffer.Count = Size;
+    return true;
+}
+
+// NOTE (Pedro): Slide the unread tail to the front of the chunk and fill the rest, so an
+// instruction that straddles two reads is always contiguous when it gets decoded
+bool RefillImage(image_source *Source)
+{
+    TIMED_BLOCK(Stage_Load);
+
+    if(Source->EndOfInput)
+    {
+        return false;
+    }
+
+    buffer *Buffer = &Source->Buffer;
+
+    u64 Unread = Buffer->Count - Buffer->IndexPtr;
+    memmove(Source->Chunk, Source->Chunk + Buffer->IndexPtr, Unread);
+
+    Buffer->BaseOffset += Buffer->IndexPtr;
+    Buffer->IndexPtr = 0;
+    Buffer->Count = Unread;
+
+    while(Buffer->Count < STREAM_CHUNK_SIZE)
+    {
+        ssize_t BytesRead = read(Source->FileHandle, Source->Chunk + Buffer->Count,
+                                 STREAM_CHUNK_SIZE - Buffer->Count);
+        if(BytesRead <= 0)
+        {
+            Source->EndOfInput = true;
+            break;
+        }
+
+        Buffer->Count += BytesRead;
+    }
+
+    return Buffer->Count > Unread;
+}
+
+void CloseImage(image_source *Source)
+{
+    if(Source->Mapped && !Source->Borrowed)
+    {
+        munmap(Source->Mapped, Source->MappedSize);
+    }
+
+    if(Source->FileHandle > STDIN_FILENO)
+    {
+        close(Source->FileHandle);
+    }
+
+    *Source = {};
+}
@@ -0,0 +1,29 @@
+#ifndef SIM86_LOADER_H
+#define SIM86_LOADER_H
+
+#include "sim86.h"
+#include "sim86_arena.h"
+
+// NOTE (Pedro): Size of the read window used when the input can't be memory-mapped (pipes, stdin)
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+typedef struct image_source
+{
+    buffer Buffer;
+
+    int FileHandle;
+    bool EndOfInput;
+
+    // Set when the whole image is mapped, otherwise Buffer.Bytes points at Chunk
+    u8 *Mapped;
+    u64 MappedSize;
+    bool Borrowed;          // Mapped is the caller's memory, it isn't unmapped on close
+    u8 *Chunk;
+} image_source;
+
+bool OpenImage(image_source *Source, char *FileName, memory_arena *Arena);
+bool OpenImageFromMemory(image_source *Source, u8 *Bytes, u64 Size);
+bool RefillImage(image_source *Source);
+void CloseImage(image_source *Source);
+
+#endif
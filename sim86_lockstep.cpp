@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+
+#include "sim86_lockstep.h"
+#include "sim86_execute.h"
+#include "sim86_cache.h"
+
+static void LoadLaneState(lockstep_batch *Batch, u32 Lane, machine *Machine)
+{
+    regs *Regs = &Machine->Regs;
+    Regs->ax = Batch->Regs[ax - ax][Lane];
+    Regs->cx = Batch->Regs[cx - ax][Lane];
+    Regs->dx = Batch->Regs[dx - ax][Lane];
+    Regs->bx = Batch->Regs[bx - ax][Lane];
+    Regs->sp = Batch->Regs[sp - ax][Lane];
+    Regs->bp = Batch->Regs[bp - ax][Lane];
+    Regs->si = Batch->Regs[si - ax][Lane];
+    Regs->di = Batch->Regs[di - ax][Lane];
+
+    u8 State = Batch->LazyState[Lane];
+    Machine->IP = Batch->IP[Lane];
+    Machine->Flags = Batch->Flags[Lane];
+    Machine->LazyFlags.Pending = State & LaneLazy_Pending;
+    Machine->LazyFlags.IsSub = State & LaneLazy_Sub;
+    Machine->LazyFlags.Wide = (State & LaneLazy_Wide) ? 1 : 0;
+    Machine->LazyFlags.Left = Batch->LazyLeft[Lane];
+    Machine->LazyFlags.Right = Batch->LazyRight[Lane];
+    Machine->LazyFlags.Result = Batch->LazyResult[Lane];
+    Machine->InstructionCount = Batch->InstructionCount[Lane];
+}
+
+static void StoreLaneState(lockstep_batch *Batch, u32 Lane, machine *Machine)
+{
+    regs *Regs = &Machine->Regs;
+    Batch->Regs[ax - ax][Lane] = Regs->ax;
+    Batch->Regs[cx - ax][Lane] = Regs->cx;
+    Batch->Regs[dx - ax][Lane] = Regs->dx;
+    Batch->Regs[bx - ax][Lane] = Regs->bx;
+    Batch->Regs[sp - ax][Lane] = Regs->sp;
+    Batch->Regs[bp - ax][Lane] = Regs->bp;
+    Batch->Regs[si - ax][Lane] = Regs->si;
+    Batch->Regs[di - ax][Lane] = Regs->di;
+
+    lazy_flags *Lazy = &Machine->LazyFlags;
+    Batch->IP[Lane] = Machine->IP;
+    Batch->Flags[Lane] = Machine->Flags;
+    Batch->LazyState[Lane] = (Lazy->Pending ? LaneLazy_Pending : 0) | (Lazy->IsSub ? LaneLazy_Sub : 0) |
+                             (Lazy->Wide ? LaneLazy_Wide : 0);
+    Batch->LazyLeft[Lane] = Lazy->Left;
+    Batch->LazyRight[Lane] = Lazy->Right;
+    Batch->LazyResult[Lane] = Lazy->Result;
+    Batch->InstructionCount[Lane] = Machine->InstructionCount;
+}
+
+// NOTE (Pedro): Every lane starts as a fork of Machine, its registers, flags and memory, which is a
+// freshly loaded program or a restored snapshot. SeedLaneRegisters or the caller's own writes
+// give each one its own starting state. The lanes share Machine's pages, so whatever those point
+// into has to outlive the batch.
+void InitLockstepBatch(lockstep_batch *Batch, u32 LaneCount, machine *Machine, memory_arena *Arena)
+{
+    *Batch = {};
+    Batch->LaneCount = LaneCount;
+    Batch->RunningCount = LaneCount;
+
+    for(u32 Register = 0; Register < ArrayCount(Batch->Regs); Register++)
+    {
+        Batch->Regs[Register] = PushZeroArray(Arena, LaneCount, u16);
+    }
+
+    Batch->IP = PushZeroArray(Arena, LaneCount, u16);
+    Batch->Flags = PushZeroArray(Arena, LaneCount, u16);
+    Batch->LazyLeft = PushZeroArray(Arena, LaneCount, u16);
+    Batch->LazyRight = PushZeroArray(Arena, LaneCount, u16);
+    Batch->LazyResult = PushZeroArray(Arena, LaneCount, u32);
+    Batch->LazyState = PushZeroArray(Arena, LaneCount, u8);
+    Batch->Status = PushZeroArray(Arena, LaneCount, u8);
+    Batch->CodeWritten = PushZeroArray(Arena, LaneCount, u8);
+    Batch->LaneId = PushArray(Arena, LaneCount, u32);
+    Batch->InstructionCount = PushZeroArray(Arena, LaneCount, u64);
+
+    MaterializeFlags(Machine);
+    Batch->Program = GetCodeBytes(&Machine->Memory);
+    Batch->ProgramSize = Machine->ProgramSize;
+
+    InitPagePool(&Batch->Pool, Arena);
+    Batch->Memory = PushArray(Arena, LaneCount, paged_memory);
+    for(u32 Lane = 0; Lane < LaneCount; Lane++)
+    {
+        Batch->LaneId[Lane] = Lane;
+        ForkMemoryFrom(&Batch->Memory[Lane], &Machine->Memory, &Batch->Pool);
+        StoreLaneState(Batch, Lane, Machine);
+    }
+
+    Batch->Cache = CreateBlockCache(Arena);
+    Batch->InstructionLimit = ~0ull;
+}
+
+// NOTE (Pedro): Lane 0 keeps the registers it was forked with, the ones a plain -exec starts
+// from, so its result can be checked against one. The rest get every register from a xorshift64*
+// series per lane.
+void SeedLaneRegisters(lockstep_batch *Batch, u64 Seed)
+{
+    for(u32 Lane = 1; Lane < Batch->LaneCount; Lane++)
+    {
+        u64 State = (Seed ^ ((u64)Lane * 0x9E3779B97F4A7C15ull)) | 1;
+        for(u32 Register = 0; Register < ArrayCount(Batch->Regs); Register++)
+        {
+            State ^= State >> 12;
+            State ^= State << 25;
+            State ^= State >> 27;
+            Batch->Regs[Register][Lane] = (u16)((State * 0x2545F4914F6CDD1Dull) >> 48);
+        }
+    }
+}
+
+static void SwapLanes(lockstep_batch *Batch, u32 A, u32 B)
+{
+#define SWAP_LANE(Array) { auto Temp = (Array)[A]; (Array)[A] = (Array)[B]; (Array)[B] = Temp; }
+
+    for(u32 Register = 0; Register < ArrayCount(Batch->Regs); Register++)
+    {
+        SWAP_LANE(Batch->Regs[Register]);
+    }
+
+    SWAP_LANE(Batch->IP);
+    SWAP_LANE(Batch->Flags);
+    SWAP_LANE(Batch->LazyLeft);
+    SWAP_LANE(Batch->LazyRight);
+    SWAP_LANE(Batch->LazyResult);
+    SWAP_LANE(Batch->LazyState);
+    SWAP_LANE(Batch->Status);
+    SWAP_LANE(Batch->LaneId);
+    SWAP_LANE(Batch->InstructionCount);
+
+#undef SWAP_LANE
+}
+
+// NOTE (Pedro): Takes the lane at Position out of the group [0, *GroupCount) and then out of the
+// running lanes, keeping both packed
+static void RetireLane(lockstep_batch *Batch, u32 Position, u32 *GroupCount, lane_status Status)
+{
+    Batch->Status[Position] = (u8)Status;
+
+    u32 LastInGroup = --*GroupCount;
+    SwapLanes(Batch, Position, LastInGroup);
+
+    u32 LastRunning = --Batch->RunningCount;
+    SwapLanes(Batch, LastInGroup, LastRunning);
+
+    if(Status == Lane_Detached)
+    {
+        Batch->DetachedCount++;
+    }
+}
+
+// NOTE (Pedro): The lanes furthest behind go first. Paths that split usually meet again further
+// down, so stepping the lowest IP lets the others catch up and run as one group again there.
+static u16 GetLowestIP(lockstep_batch *Batch)
+{
+    u16 Result = 0xFFFF;
+    for(u32 Lane = 0; Lane < Batch->RunningCount; Lane++)
+    {
+        Result = (Batch->IP[Lane] < Result) ? Batch->IP[Lane] : Result;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Regroups the running lanes so the ones at IP come first, no moves at all when
+// every lane is already there. *OtherIP is the lowest IP of the rest, 0x10000 when there are none.
+static u32 PackGroup(lockstep_batch *Batch, u16 IP, u32 *OtherIP)
+{
+    u32 Result = 0;
+    u32 Other = 0x10000;
+    for(u32 Lane = 0; Lane < Batch->RunningCount; Lane++)
+    {
+        if(Batch->IP[Lane] == IP)
+        {
+            if(Lane != Result)
+            {
+                SwapLanes(Batch, Lane, Result);
+            }
+            Result++;
+        }
+        else if(Batch->IP[Lane] < Other)
+        {
+            Other = Batch->IP[Lane];
+        }
+    }
+
+    *OtherIP = Other;
+    return Result;
+}
+
+// NOTE (Pedro): One register of every lane. Byte registers are a half of the word array, Shift
+// picks which, so reading and writing one is a shift and a mask the same for every lane.
+typedef struct lane_register
+{
+    u16 *Words;
+    u32 Shift;
+} lane_register;
+
+static inline lane_register GetLaneRegister(lockstep_batch *Batch, u8 Register, u8 Wide)
+{
+    lane_register Result;
+    Result.Words = Batch->Regs[Wide ? (Register - ax) : (Register & 3)];
+    Result.Shift = (!Wide && (Register & 4)) ? 8 : 0;
+    return Result;
+}
+
+template<u8 Wide>
+static inline u16 ReadLaneRegister(lane_register Register, u32 Lane)
+{
+    u16 Result = Wide ? Register.Words[Lane] : (u8)(Register.Words[Lane] >> Register.Shift);
+    return Result;
+}
+
+template<u8 Wide>
+static inline void WriteLaneRegister(lane_register Register, u32 Lane, u16 Value)
+{
+    if constexpr(Wide)
+    {
+        Register.Words[Lane] = Value;
+    }
+    else
+    {
+        u16 Mask = (u16)(0xFF << Register.Shift);
+        Register.Words[Lane] = (Register.Words[Lane] & ~Mask) | (((Value & 0xFF) << Register.Shift) & Mask);
+    }
+}
+
+static inline u16 GetLaneAddress(lockstep_batch *Batch, u8 Base, u16 Disp, u32 Lane)
+{
+    u16 Bx = Batch->Regs[bx - ax][Lane];
+    u16 Bp = Batch->Regs[bp - ax][Lane];
+    u16 Si = Batch->Regs[si - ax][Lane];
+    u16 Di = Batch->Regs[di - ax][Lane];
+
+    u16 Result = Disp;
+    switch(Base)
+    {
+        case bx_si: Result += Bx + Si; break;
+        case bx_di: Result += Bx + Di; break;
+        case bp_si: Result += Bp + Si; break;
+        case bp_di: Result += Bp + Di; break;
+        case si:    Result += Si; break;
+        case di:    Result += Di; break;
+        case bp:    Result += Bp; break;
+        case bx:    Result += Bx; break;
+        default: break;
+    }
+
+    return Result;
+}
+
+static inline paged_memory *GetLaneMemory(lockstep_batch *Batch, u32 Lane)
+{
+    paged_memory *Result = Batch->Memory + Batch->LaneId[Lane];
+    return Result;
+}
+
+template<u8 Wide>
+static inline u16 ReadLaneMemory(lockstep_batch *Batch, u32 Lane, u16 Address)
+{
+    paged_memory *Memory = GetLaneMemory(Batch, Lane);
+
+    u16 Result = ReadMemoryByte(Memory, Address);
+    if constexpr(Wide)
+    {
+        Result |= ReadMemoryByte(Memory, (u16)(Address + 1)) << 8;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Every lane decodes from the one shared copy of the program, so a lane that writes
+// into it can't keep running from that copy. It is flagged here and detached after the op.
+template<u8 Wide>
+static inline bool WriteLaneMemory(lockstep_batch *Batch, u32 Lane, u16 Address, u16 Value)
+{
+    paged_memory *Memory = GetLaneMemory(Batch, Lane);
+
+    WriteMemoryByte(Memory, Address, (u8)Value);
+    bool Result = (Address < Batch->ProgramSize);
+
+    if constexpr(Wide)
+    {
+        u16 High = (u16)(Address + 1);
+        WriteMemoryByte(Memory, High, (u8)(Value >> 8));
+        Result |= (High < Batch->ProgramSize);
+    }
+
+    Batch->CodeWritten[Lane] |= Result;
+    return Result;
+}
+
+// NOTE (Pedro): The flag getters of the scalar executor, over the lazy state of one lane. Both
+// the lazy and the stored flag are worked out and one is picked, so a loop over the lanes has no
+// branch in it and still vectorizes.
+static inline u32 LaneSignBit(u8 State)
+{
+    u32 Result = (State & LaneLazy_Wide) ? 0x8000 : 0x80;
+    return Result;
+}
+
+static inline bool GetLaneCF(lockstep_batch *Batch, u32 Lane)
+{
+    u8 State = Batch->LazyState[Lane];
+    bool Lazy = (State & LaneLazy_Sub) ? (Batch->LazyRight[Lane] > Batch->LazyLeft[Lane]) :
+                                         (Batch->LazyResult[Lane] > (LaneSignBit(State) * 2 - 1));
+    bool Stored = Batch->Flags[Lane] & Flag_CF;
+
+    bool Result = (State & LaneLazy_Pending) ? Lazy : Stored;
+    return Result;
+}
+
+static inline bool GetLaneZF(lockstep_batch *Batch, u32 Lane)
+{
+    u8 State = Batch->LazyState[Lane];
+    bool Lazy = (Batch->LazyResult[Lane] & (LaneSignBit(State) * 2 - 1)) == 0;
+    bool Stored = Batch->Flags[Lane] & Flag_ZF;
+
+    bool Result = (State & LaneLazy_Pending) ? Lazy : Stored;
+    return Result;
+}
+
+static inline bool GetLaneSF(lockstep_batch *Batch, u32 Lane)
+{
+    u8 State = Batch->LazyState[Lane];
+    bool Lazy = Batch->LazyResult[Lane] & LaneSignBit(State);
+    bool Stored = Batch->Flags[Lane] & Flag_SF;
+
+    bool Result = (State & LaneLazy_Pending) ? Lazy : Stored;
+    return Result;
+}
+
+static inline bool GetLaneOF(lockstep_batch *Batch, u32 Lane)
+{
+    u8 State = Batch->LazyState[Lane];
+    u32 Left = Batch->LazyLeft[Lane];
+    u32 Right = Batch->LazyRight[Lane];
+    u32 Value = Batch->LazyResult[Lane];
+    u32 Overflow = (State & LaneLazy_Sub) ? ((Left ^ Right) & (Left ^ Value)) :
+                                            ((Left ^ Value) & (Right ^ Value));
+    bool Lazy = Overflow & LaneSignBit(State);
+    bool Stored = Batch->Flags[Lane] & Flag_OF;
+
+    bool Result = (State & LaneLazy_Pending) ? Lazy : Stored;
+    return Result;
+}
+
+static inline bool GetLanePF(lockstep_batch *Batch, u32 Lane)
+{
+    u8 State = Batch->LazyState[Lane];
+    bool Lazy = !__builtin_parity((u8)Batch->LazyResult[Lane]);
+    bool Stored = Batch->Flags[Lane] & Flag_PF;
+
+    bool Result = (State & LaneLazy_Pending) ? Lazy : Stored;
+    return Result;
+}
+
+// NOTE (Pedro): Fused ops always leave a pending compare behind, so the plain conditions are a
+// compare of the recorded operands like EvaluateFusedCondition does
+template<u32 Jump, bool Fused>
+static inline bool GetLaneCondition(lockstep_batch *Batch, u32 Lane, u8 Wide)
+{
+    u16 Left = Batch->LazyLeft[Lane];
+    u16 Right = Batch->LazyRight[Lane];
+    s16 SignedLeft = Wide ? (s16)Left : (s8)Left;
+    s16 SignedRight = Wide ? (s16)Right : (s8)Right;
+    u16 *Cx = Batch->Regs[cx - ax];
+
+    if constexpr(Fused && (Jump == je))  return Left == Right;
+    if constexpr(Fused && (Jump == jne)) return Left != Right;
+    if constexpr(Fused && (Jump == jb))  return Left < Right;
+    if constexpr(Fused && (Jump == jnb)) return Left >= Right;
+    if constexpr(Fused && (Jump == jbe)) return Left <= Right;
+    if constexpr(Fused && (Jump == ja))  return Left > Right;
+    if constexpr(Fused && (Jump == jl))  return SignedLeft < SignedRight;
+    if constexpr(Fused && (Jump == jnl)) return SignedLeft >= SignedRight;
+    if constexpr(Fused && (Jump == jle)) return SignedLeft <= SignedRight;
+    if constexpr(Fused && (Jump == jg))  return SignedLeft > SignedRight;
+
+    if constexpr(Jump == je)  return GetLaneZF(Batch, Lane);
+    if constexpr(Jump == jne) return !GetLaneZF(Batch, Lane);
+    if constexpr(Jump == jl)  return GetLaneSF(Batch, Lane) != GetLaneOF(Batch, Lane);
+    if constexpr(Jump == jnl) return GetLaneSF(Batch, Lane) == GetLaneOF(Batch, Lane);
+    if constexpr(Jump == jle) return GetLaneZF(Batch, Lane) | (GetLaneSF(Batch, Lane) != GetLaneOF(Batch, Lane));
+    if constexpr(Jump == jg)  return !GetLaneZF(Batch, Lane) & (GetLaneSF(Batch, Lane) == GetLaneOF(Batch, Lane));
+    if constexpr(Jump == jb)  return GetLaneCF(Batch, Lane);
+    if constexpr(Jump == jnb) return !GetLaneCF(Batch, Lane);
+    if constexpr(Jump == jbe) return GetLaneCF(Batch, Lane) | GetLaneZF(Batch, Lane);
+    if constexpr(Jump == ja)  return !GetLaneCF(Batch, Lane) & !GetLaneZF(Batch, Lane);
+    if constexpr(Jump == jp)  return GetLanePF(Batch, Lane);
+    if constexpr(Jump == jnp) return !GetLanePF(Batch, Lane);
+    if constexpr(Jump == jo)  return GetLaneOF(Batch, Lane);
+    if constexpr(Jump == jno) return !GetLaneOF(Batch, Lane);
+    if constexpr(Jump == js)  return GetLaneSF(Batch, Lane);
+    if constexpr(Jump == jns) return !GetLaneSF(Batch, Lane);
+
+    // CX is decremented before the test, without touching any flags. The & rather than && keep
+    // the loops branch-free, the decrement happens either way.
+    if constexpr(Jump == loop)   return --Cx[Lane] != 0;
+    if constexpr(Jump == loopz)  return (--Cx[Lane] != 0) & GetLaneZF(Batch, Lane);
+    if constexpr(Jump == loopnz) return (--Cx[Lane] != 0) & !GetLaneZF(Batch, Lane);
+    if constexpr(Jump == jcxz)   return Cx[Lane] == 0;
+
+    return false;
+}
+
+// NOTE (Pedro): The branch ends the block, so this is where the lanes of a group get their own
+// IP again. Disp is already widened, a fused jump's is the s8 from its encoding.
+template<u32 Jump, bool Fused>
+static void RunLaneJump(lockstep_batch *Batch, u32 Count, u16 NextIP, u16 Disp, u8 Wide)
+{
+    for(u32 Lane = 0; Lane < Count; Lane++)
+    {
+        bool Taken = GetLaneCondition<Jump, Fused>(Batch, Lane, Wide);
+        Batch->IP[Lane] = NextIP + (Taken ? Disp : 0);
+    }
+}
+
+#define LANE_BRANCH_COUNT (ret - jne + 1)
+
+typedef void lane_branch(lockstep_batch *Batch, u32 Count, u16 NextIP, u16 Disp, u8 Wide);
+
+typedef struct lane_branch_table
+{
+    lane_branch *Branches[LANE_BRANCH_COUNT];   // By operation - jne
+} lane_branch_table;
+
+template<bool Fused, u32... Index>
+static constexpr lane_branch_table MakeLaneBranchTable(std::integer_sequence<u32, Index...>)
+{
+    lane_branch_table Result = {{&RunLaneJump<jne + Index, Fused>...}};
+    return Result;
+}
+
+static constexpr lane_branch_table LaneBranchTables[2] =
+{
+    MakeLaneBranchTable<false>(std::make_integer_sequence<u32, LANE_BRANCH_COUNT>()),
+    MakeLaneBranchTable<true>(std::make_integer_sequence<u32, LANE_BRANCH_COUNT>()),
+};
+
+// NOTE (Pedro): A data op with a register destination and a register or immediate source, the
+// case that vectorizes. The lazy arrays are passed in restrict since nothing else reaches them,
+// which saves the compiler from checking them against the registers before every loop.
+template<u32 DataOp, u32 SourceKind, u8 Wide>
+static void RunLaneRegisterOp(lane_register Dest, lane_register Source, u16 Immediate, u32 Count,
+                              u16 *__restrict LazyLeft, u16 *__restrict LazyRight,
+                              u32 *__restrict LazyResult, u8 *__restrict LazyState)
+{
+    constexpr bool IsSub = (DataOp >= sub);
+    constexpr bool Writes = (DataOp != cmp) && (DataOp != 4);
+    constexpr u8 State = LaneLazy_Pending | (IsSub ? LaneLazy_Sub : 0) | (Wide ? LaneLazy_Wide : 0);
+
+    for(u32 Lane = 0; Lane < Count; Lane++)
+    {
+        u16 Right = (SourceKind == Operand_Register) ? ReadLaneRegister<Wide>(Source, Lane) : Immediate;
+        u16 Value = Right;
+
+        if constexpr(DataOp != mov)
+        {
+            u16 Left = ReadLaneRegister<Wide>(Dest, Lane);
+            u32 Result = IsSub ? ((u32)Left - Right) : ((u32)Left + Right);
+            LazyLeft[Lane] = Left;
+            LazyRight[Lane] = Right;
+            LazyResult[Lane] = Result;
+            LazyState[Lane] = State;
+            Value = (u16)Result;
+        }
+
+        if constexpr(Writes)
+        {
+            WriteLaneRegister<Wide>(Dest, Lane, Value);
+        }
+    }
+}
+
+// NOTE (Pedro): The lane form of ExecuteHandler, bound through the same handler index. The
+// operand kinds and width are template arguments, so for register and immediate operands the
+// loop is plain arithmetic on the register arrays and vectorizes. Memory operands are a load or
+// store per lane into that lane's memory. Returns true when some lane wrote into the program.
+template<u32 Handler>
+static bool RunLaneHandler(lockstep_batch *Batch, micro_op *Op, u32 Count, u16 NextIP)
+{
+    if constexpr(Handler == HANDLER_GENERIC)
+    {
+        // Never bound, RunLaneBlock hands these ops to the scalar executor
+        return false;
+    }
+    else if constexpr(Handler >= HANDLER_JUMP_BASE)
+    {
+        constexpr u32 Jump = jne + (Handler - HANDLER_JUMP_BASE);
+        RunLaneJump<Jump, false>(Batch, Count, NextIP, Op->Imm, 0);
+        return false;
+    }
+    else
+    {
+        constexpr u32 DataOp = Handler / 12;
+        constexpr u32 DestKind = Operand_Register + ((Handler / 6) % 2);
+        constexpr u32 SourceKind = Operand_Register + ((Handler / 2) % 3);
+        constexpr u8 Wide = Handler % 2;
+
+        // mov, add, sub, cmp, fused cmp, fused sub
+        constexpr bool IsSub = (DataOp >= sub);
+        constexpr bool Writes = (DataOp != cmp) && (DataOp != 4);
+        constexpr bool Fused = (DataOp >= 4);
+        constexpr u8 LazyState = LaneLazy_Pending | (IsSub ? LaneLazy_Sub : 0) | (Wide ? LaneLazy_Wide : 0);
+
+        lane_register Dest = GetLaneRegister(Batch, (DestKind == Operand_Register) ? Op->DestReg : ax, Wide);
+        lane_register Source = GetLaneRegister(Batch, (SourceKind == Operand_Register) ? Op->SourceReg : ax, Wide);
+        u16 Immediate = Wide ? Op->Imm : (u8)Op->Imm;
+
+        bool CodeWritten = false;
+        if constexpr((DestKind == Operand_Register) && (SourceKind != Operand_Memory))
+        {
+            RunLaneRegisterOp<DataOp, SourceKind, Wide>(Dest, Source, Immediate, Count, Batch->LazyLeft,
+                                                        Batch->LazyRight, Batch->LazyResult, Batch->LazyState);
+        }
+        else for(u32 Lane = 0; Lane < Count; Lane++)
+        {
+            u16 Right;
+            if constexpr(SourceKind == Operand_Register)
+            {
+                Right = ReadLaneRegister<Wide>(Source, Lane);
+            }
+            else if constexpr(SourceKind == Operand_Memory)
+            {
+                Right = ReadLaneMemory<Wide>(Batch, Lane, GetLaneAddress(Batch, Op->SourceReg, Op->Disp, Lane));
+            }
+            else
+            {
+                Right = Immediate;
+            }
+
+            u16 Address = 0;
+            if constexpr(DestKind == Operand_Memory)
+            {
+                Address = GetLaneAddress(Batch, Op->DestReg, Op->Disp, Lane);
+            }
+
+            u16 Value = Right;
+            if constexpr(DataOp != mov)
+            {
+                u16 Left;
+                if constexpr(DestKind == Operand_Register)
+                {
+                    Left = ReadLaneRegister<Wide>(Dest, Lane);
+                }
+                else
+                {
+                    Left = ReadLaneMemory<Wide>(Batch, Lane, Address);
+                }
+
+                u32 Result = IsSub ? ((u32)Left - Right) : ((u32)Left + Right);
+                Batch->LazyLeft[Lane] = Left;
+                Batch->LazyRight[Lane] = Right;
+                Batch->LazyResult[Lane] = Result;
+                Batch->LazyState[Lane] = LazyState;
+                Value = (u16)Result;
+            }
+
+            if constexpr(Writes && (DestKind == Operand_Register))
+            {
+                WriteLaneRegister<Wide>(Dest, Lane, Value);
+            }
+            else if constexpr(Writes)
+            {
+                CodeWritten |= WriteLaneMemory<Wide>(Batch, Lane, Address, Value);
+            }
+        }
+
+        if constexpr(Fused)
+        {
+            LaneBranchTables[1].Branches[Op->BranchOp - jne](Batch, Count, NextIP, (u16)(s16)Op->BranchDisp, Wide);
+        }
+
+        return CodeWritten;
+    }
+}
+
+typedef bool lane_handler(lockstep_batch *Batch, micro_op *Op, u32 Count, u16 NextIP);
+
+typedef struct lane_handler_table
+{
+    lane_handler *Handlers[HANDLER_COUNT];
+} lane_handler_table;
+
+template<u32... Handler>
+static constexpr lane_handler_table MakeLaneHandlerTable(std::integer_sequence<u32, Handler...>)
+{
+    lane_handler_table Result = {{&RunLaneHandler<Handler>...}};
+    return Result;
+}
+
+static constexpr lane_handler_table LaneHandlers =
+    MakeLaneHandlerTable(std::make_integer_sequence<u32, HANDLER_COUNT>());
+
+// NOTE (Pedro): Runs one block for the group [0, *Count), every lane of which is at the block's
+// start. Intermediate ops never need a per-lane IP, only the branch at the end sets them. Lanes
+// that write into the program leave the group.
+static void RunLaneBlock(lockstep_batch *Batch, code_block *Block, u32 *Count)
+{
+    micro_op *Ops = Batch->Cache->Ops + Block->FirstOp;
+
+    u16 IP = (u16)Block->StartIP;
+    u32 Executed = 0;
+    bool Branched = false;
+
+    for(u32 OpIndex = 0; (OpIndex < Block->OpCount) && *Count; OpIndex++)
+    {
+        micro_op *Op = Ops + OpIndex;
+
+        // No lane kernel for this one, the group finishes on the scalar executor from this op on
+        if(Op->Handler == HANDLER_GENERIC)
+        {
+            while(*Count)
+            {
+                u32 Lane = *Count - 1;
+                Batch->IP[Lane] = IP;
+                Batch->InstructionCount[Lane] += Executed;
+                RetireLane(Batch, Lane, Count, Lane_Detached);
+            }
+            return;
+        }
+
+        IP += Op->Length;
+        bool CodeWritten = LaneHandlers.Handlers[Op->Handler](Batch, Op, *Count, IP);
+
+        Executed += (Op->OpType >= MicroOp_FusedCmp) ? 2 : 1;
+        Branched = (Op->OpType >= MicroOp_FusedCmp) || (Op->Handler >= HANDLER_JUMP_BASE);
+
+        if(CodeWritten)
+        {
+            for(u32 Lane = *Count; Lane-- > 0;)
+            {
+                if(Batch->CodeWritten[Lane])
+                {
+                    Batch->CodeWritten[Lane] = 0;
+                    if(!Branched)
+                    {
+                        Batch->IP[Lane] = IP;
+                    }
+                    Batch->InstructionCount[Lane] += Executed;
+                    RetireLane(Batch, Lane, Count, Lane_Detached);
+                }
+            }
+        }
+    }
+
+    for(u32 Lane = 0; Lane < *Count; Lane++)
+    {
+        Batch->InstructionCount[Lane] += Block->InstructionCount;
+    }
+
+    if(!Branched)
+    {
+        for(u32 Lane = 0; Lane < *Count; Lane++)
+        {
+            Batch->IP[Lane] = IP;
+        }
+    }
+}
+
+// NOTE (Pedro): Lanes [0, *Count) that are done go, the rest stay packed at the front
+static void RetireFinishedLanes(lockstep_batch *Batch, u32 *Count)
+{
+    for(u32 Lane = *Count; Lane-- > 0;)
+    {
+        if(Batch->IP[Lane] >= Batch->ProgramSize)
+        {
+            RetireLane(Batch, Lane, Count, Lane_Halted);
+        }
+        else if(Batch->InstructionCount[Lane] >= Batch->InstructionLimit)
+        {
+            RetireLane(Batch, Lane, Count, Lane_Limit);
+        }
+    }
+}
+
+static u64 GetMostInstructions(lockstep_batch *Batch, u32 Count)
+{
+    u64 Result = 0;
+    for(u32 Lane = 0; Lane < Count; Lane++)
+    {
+        Result = (Batch->InstructionCount[Lane] > Result) ? Batch->InstructionCount[Lane] : Result;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): True when every lane of the group went to the same place, which is then *IP
+static bool IsGroupTogether(lockstep_batch *Batch, u32 Count, u16 *IP)
+{
+    u16 Lowest = 0xFFFF;
+    u16 Highest = 0;
+    for(u32 Lane = 0; Lane < Count; Lane++)
+    {
+        Lowest = (Batch->IP[Lane] < Lowest) ? Batch->IP[Lane] : Lowest;
+        Highest = (Batch->IP[Lane] > Highest) ? Batch->IP[Lane] : Highest;
+    }
+
+    *IP = Lowest;
+    bool Result = (Lowest == Highest);
+    return Result;
+}
+
+// NOTE (Pedro): Runs one lane to the end on Scratch, with the lane's page table swapped in for
+// Scratch's own. Scratch keeps its dispatch and block cache, the cache is reset since lanes can
+// hold different code.
+static void RunLaneScalar(lockstep_batch *Batch, u32 Lane, machine *Scratch)
+{
+    paged_memory *LaneMemory = GetLaneMemory(Batch, Lane);
+    paged_memory ScratchMemory = Scratch->Memory;
+
+    LoadLaneState(Batch, Lane, Scratch);
+    Scratch->Memory = *LaneMemory;
+    Scratch->ProgramSize = Batch->ProgramSize;
+    Scratch->InstructionLimit = (Batch->InstructionLimit == ~0ull) ? 0 : Batch->InstructionLimit;
+    Scratch->CodeModified = false;
+    if(Scratch->Cache)
+    {
+        ResetBlockCache(Scratch->Cache);
+    }
+
+    ExecuteProgram(Scratch);
+
+    StoreLaneState(Batch, Lane, Scratch);
+    *LaneMemory = Scratch->Memory;
+    Scratch->Memory = ScratchMemory;
+
+    Batch->Status[Lane] = (Scratch->IP >= Batch->ProgramSize) ? Lane_Halted :
+                          (Scratch->InstructionCount >= Batch->InstructionLimit) ? Lane_Limit : Lane_Unrecognized;
+}
+
+// NOTE (Pedro): Steps the group at the lowest IP one block at a time until every lane is done.
+// A group that stays together keeps running without a regroup for as long as it is still
+// behind every other lane, which is always when the lanes never split.
+// Lanes leave lockstep for the scalar executor when they write into the program, reach an op
+// with no lane kernel or are within one block of the instruction limit (the scalar executor
+// steps the last few one at a time). Clocks are not counted. The lanes end up back in order.
+void RunLockstep(lockstep_batch *Batch, machine *Scratch)
+{
+    while(Batch->RunningCount)
+    {
+        u16 GroupIP = GetLowestIP(Batch);
+        u32 OtherIP;
+        u32 Count = PackGroup(Batch, GroupIP, &OtherIP);
+        u64 MostInstructions = GetMostInstructions(Batch, Count);
+
+        Batch->Regroups += (Count < Batch->RunningCount);
+
+        while(Count)
+        {
+            Batch->GroupSteps++;
+            Batch->LaneSteps += Count;
+
+            code_block *Block = GetBlock(Batch->Cache, Batch->Program, Batch->ProgramSize, GroupIP);
+            if(!Block)
+            {
+                fprintf(stderr, "ERROR: Unrecognized instruction at %04x (%u lanes)\n", GroupIP, Count);
+                while(Count)
+                {
+                    RetireLane(Batch, Count - 1, &Count, Lane_Unrecognized);
+                }
+                break;
+            }
+
+            if(Block->InstructionCount > (Batch->InstructionLimit - MostInstructions))
+            {
+                for(u32 Lane = Count; Lane-- > 0;)
+                {
+                    if(Block->InstructionCount > (Batch->InstructionLimit - Batch->InstructionCount[Lane]))
+                    {
+                        RetireLane(Batch, Lane, &Count, Lane_Detached);
+                    }
+                }
+
+                MostInstructions = GetMostInstructions(Batch, Count);
+            }
+
+            RunLaneBlock(Batch, Block, &Count);
+            MostInstructions += Block->InstructionCount;
+
+            bool Together = IsGroupTogether(Batch, Count, &GroupIP);
+            if(!Together || (GroupIP >= Batch->ProgramSize) || (MostInstructions >= Batch->InstructionLimit))
+            {
+                RetireFinishedLanes(Batch, &Count);
+                break;
+            }
+
+            // Caught up with some other lanes, regroup to take them along
+            if(GroupIP >= OtherIP)
+            {
+                break;
+            }
+        }
+    }
+
+    for(u32 Position = 0; Position < Batch->LaneCount; Position++)
+    {
+        while(Batch->LaneId[Position] != Position)
+        {
+            SwapLanes(Batch, Position, Batch->LaneId[Position]);
+        }
+    }
+
+    for(u32 Lane = 0; Lane < Batch->LaneCount; Lane++)
+    {
+        if(Batch->Status[Lane] == Lane_Detached)
+        {
+            RunLaneScalar(Batch, Lane, Scratch);
+        }
+    }
+}
+
+// NOTE (Pedro): Every lane on its own through the scalar executor, what RunLockstep is measured
+// and checked against
+void RunLanesScalar(lockstep_batch *Batch, machine *Scratch)
+{
+    for(u32 Lane = 0; Lane < Batch->LaneCount; Lane++)
+    {
+        RunLaneScalar(Batch, Lane, Scratch);
+    }
+
+    Batch->RunningCount = 0;
+}
+
+// NOTE (Pedro): Each lane's final state in the -exec format, under a line naming the lane
+void PrintLaneStates(lockstep_batch *Batch, output_buffer *Out)
+{
+    for(u32 Lane = 0; Lane < Batch->LaneCount; Lane++)
+    {
+        machine View = {};
+        LoadLaneState(Batch, Lane, &View);
+
+        ReserveOutput(Out, MAX_OUTPUT_LINE);
+        AppendString(Out, "Lane ");
+        AppendU32(Out, Lane);
+        AppendString(Out, ":\n");
+
+        PrintMachineState(&View, Out);
+        AppendString(Out, "\n");
+    }
+}
+
+void PrintLockstepStats(lockstep_batch *Batch, output_buffer *Out)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "Lockstep: ");
+    AppendU32(Out, Batch->LaneCount);
+    AppendString(Out, " lanes, ");
+    AppendU64(Out, Batch->GroupSteps);
+    AppendString(Out, " blocks stepped, ");
+    AppendU64(Out, Batch->GroupSteps ? Batch->LaneSteps / Batch->GroupSteps : 0);
+    AppendString(Out, " lanes per block, ");
+    AppendU64(Out, Batch->Regroups);
+    AppendString(Out, " regroups, ");
+    AppendU32(Out, Batch->DetachedCount);
+    AppendString(Out, " detached\n");
+}
@@ -0,0 +1,77 @@
+#ifndef SIM86_LOCKSTEP_H
+#define SIM86_LOCKSTEP_H
+
+#include "sim86.h"
+#include "sim86_execute.h"
+#include "sim86_cache.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+#include "sim86_memory.h"
+
+#define LOCKSTEP_MAX_LANES 65536
+
+typedef enum lane_status
+{
+    Lane_Running,
+    Lane_Halted,        // IP left the program
+    Lane_Unrecognized,  // IP reached bytes that don't decode
+    Lane_Limit,         // Ran the instruction limit
+    Lane_Detached,      // Finishes on the scalar executor, see RunLockstep
+} lane_status;
+
+// NOTE (Pedro): Bits of lockstep_batch::LazyState, the per-lane form of lazy_flags
+typedef enum lane_lazy_bits
+{
+    LaneLazy_Pending = 0x1,
+    LaneLazy_Sub = 0x2,
+    LaneLazy_Wide = 0x4,
+} lane_lazy_bits;
+
+// NOTE (Pedro): Many machines running the same program, one lane each, kept as a structure of
+// arrays so an op runs over every lane of a group as one loop the compiler can vectorize.
+// Lanes are indexed by position, and positions are reordered as lanes regroup: the lanes still
+// running are [0, RunningCount), and the group being stepped is packed at the front of those.
+// LaneId maps a position back to the lane, memory stays put and is found through it. Every lane's
+// memory is forked from the image, so a lane only costs the pages it writes.
+typedef struct lockstep_batch
+{
+    u32 LaneCount;
+    u32 RunningCount;
+
+    u16 *Regs[8];           // By 16-bit register number, ax cx dx bx sp bp si di
+    u16 *IP;
+    u16 *Flags;
+    u16 *LazyLeft;
+    u16 *LazyRight;
+    u32 *LazyResult;
+    u8 *LazyState;          // lane_lazy_bits
+    u8 *Status;             // lane_status
+    u8 *CodeWritten;        // Set by a write into the program, the lane detaches after the op
+    u32 *LaneId;
+    u64 *InstructionCount;
+
+    paged_memory *Memory;   // Indexed by LaneId
+    page_pool Pool;
+
+    u8 *Program;            // The machine's code, decoded for every lane, so a lane that writes into it detaches
+    u32 ProgramSize;
+    block_cache *Cache;
+    u64 InstructionLimit;
+
+    // Stats
+    u64 GroupSteps;         // Blocks run, each for one group of lanes
+    u64 LaneSteps;          // Sum of the group sizes
+    u64 Regroups;           // Steps that ran fewer than all the running lanes
+    u32 DetachedCount;
+} lockstep_batch;
+
+void InitLockstepBatch(lockstep_batch *Batch, u32 LaneCount, machine *Machine, memory_arena *Arena);
+void SeedLaneRegisters(lockstep_batch *Batch, u64 Seed);
+
+void RunLockstep(lockstep_batch *Batch, machine *Scratch);
+void RunLanesScalar(lockstep_batch *Batch, machine *Scratch);
+
+void PrintLaneStates(lockstep_batch *Batch, output_buffer *Out);
+void PrintLockstepStats(lockstep_batch *Batch, output_buffer *Out);
+
+#endif
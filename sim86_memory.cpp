@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sim86_memory.h"
+
+void InitMemoryImage(memory_image *Image, memory_arena *Arena)
+{
+    Image->Bytes = PushZeroArray(Arena, SEGMENT_SIZE, u8);
+    Image->ProgramSize = 0;
+}
+
+// NOTE (Pedro): Only a program is ever copied into an image, so clearing it is enough. Nothing can
+// still be forked from the image when it is reset.
+void ResetMemoryImage(memory_image *Image)
+{
+    memset(Image->Bytes, 0, Image->ProgramSize);
+    Image->ProgramSize = 0;
+}
+
+void InitPagePool(page_pool *Pool, memory_arena *Arena)
+{
+    *Pool = {};
+    Pool->Arena = Arena;
+}
+
+static u8 *AllocatePages(page_pool *Pool, u32 Count)
+{
+    u8 *Result = Pool->FreeBlocks[Count];
+    if(Result)
+    {
+        Pool->FreeBlocks[Count] = *(u8 **)Result;
+    }
+    else
+    {
+        Result = (u8 *)PushSize(Pool->Arena, (u64)Count * MEMORY_PAGE_SIZE + MEMORY_BLOCK_PADDING);
+    }
+
+    Pool->PagesInUse += Count;
+    if(Pool->PagesInUse > Pool->PeakPagesInUse)
+    {
+        Pool->PeakPagesInUse = Pool->PagesInUse;
+    }
+
+    return Result;
+}
+
+static void FreePages(page_pool *Pool, u8 *Block, u32 Count)
+{
+    *(u8 **)Block = Pool->FreeBlocks[Count];
+    Pool->FreeBlocks[Count] = Block;
+    Pool->PagesInUse -= Count;
+}
+
+// NOTE (Pedro): Every page points into the image, nothing is copied until it is written. Memory
+// must not own any pages, release them first.
+void ForkMemory(paged_memory *Memory, memory_image *Image, page_pool *Pool)
+{
+    *Memory = {};
+    for(u32 Page = 0; Page < MEMORY_PAGE_COUNT; Page++)
+    {
+        Memory->Pages[Page] = Image->Bytes + Page * MEMORY_PAGE_SIZE;
+    }
+
+    u32 CodePageCount = (Image->ProgramSize + MEMORY_PAGE_MASK) >> MEMORY_PAGE_SHIFT;
+    Memory->CodePages = (1u << CodePageCount) - 1;
+    Memory->Pool = Pool;
+}
+
+// NOTE (Pedro): The parent's copies become shared with the child, so the parent gives up owning
+// them and copies again on its next write too. Those pages are never released back to a pool,
+// they live as long as the parent's pool arena does.
+void ForkMemoryFrom(paged_memory *Memory, paged_memory *Parent, page_pool *Pool)
+{
+    *Memory = *Parent;
+    Memory->Owned = 0;
+    Memory->Pool = Pool;
+
+    Parent->Owned = 0;
+}
+
+// NOTE (Pedro): Hands the pages Memory copied back to its pool, it has to be forked again before
+// it is used
+void ReleaseMemory(paged_memory *Memory)
+{
+    page_pool *Pool = Memory->Pool;
+    u32 Owned = Memory->Owned;
+
+    if(Owned & Memory->CodePages)
+    {
+        FreePages(Pool, Memory->Pages[0], __builtin_popcount(Memory->CodePages));
+        Owned &= ~Memory->CodePages;
+    }
+
+    while(Owned)
+    {
+        u32 Page = __builtin_ctz(Owned);
+        FreePages(Pool, Memory->Pages[Page], 1);
+        Owned &= Owned - 1;
+    }
+
+    *Memory = {};
+    Memory->Pool = Pool;
+}
+
+// NOTE (Pedro): A write to a page covering the program copies all of them as one block, which
+// keeps the code contiguous for the decoder. Returns the page's new bytes.
+u8 *CopyPageOnWrite(paged_memory *Memory, u32 Page)
+{
+    u32 Copied = 1u << Page;
+    if(Memory->CodePages & Copied)
+    {
+        Copied = Memory->CodePages;
+    }
+
+    u32 First = __builtin_ctz(Copied);
+    u32 Count = __builtin_popcount(Copied);
+
+    u8 *Block = AllocatePages(Memory->Pool, Count);
+    memcpy(Block, Memory->Pages[First], (u64)Count * MEMORY_PAGE_SIZE);
+    for(u32 Index = 0; Index < Count; Index++)
+    {
+        Memory->Pages[First + Index] = Block + Index * MEMORY_PAGE_SIZE;
+    }
+
+    Memory->Owned |= Copied;
+    Memory->Dirty |= Copied;
+    Memory->Pool->PagesCopied += Count;
+
+    u8 *Result = Memory->Pages[Page];
+    return Result;
+}
+
+u32 GetDirtyPageCount(paged_memory *Memory)
+{
+    u32 Result = __builtin_popcount(Memory->Dirty);
+    return Result;
+}
+
+void PrintPagePoolStats(page_pool *Pool, output_buffer *Out)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "Memory: ");
+    AppendU64(Out, Pool->PagesCopied);
+    AppendString(Out, " pages copied on write, ");
+    AppendU64(Out, Pool->PagesInUse);
+    AppendString(Out, " in use, peak ");
+    AppendU64(Out, Pool->PeakPagesInUse);
+    AppendString(Out, " (");
+    AppendU64(Out, (Pool->PeakPagesInUse * MEMORY_PAGE_SIZE) / 1024);
+    AppendString(Out, " KB)\n");
+}
@@ -0,0 +1,95 @@
+#ifndef SIM86_MEMORY_H
+#define SIM86_MEMORY_H
+
+#include "sim86.h"
+#include "sim86_arena.h"
+#include "sim86_output.h"
+
+// NOTE (Pedro): All segments are zero, so code and data share one 64 KB segment and that is all
+// of memory an instance can ever reach
+#define SEGMENT_SIZE 0x10000
+
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_SIZE - 1)
+#define MEMORY_PAGE_COUNT (SEGMENT_SIZE / MEMORY_PAGE_SIZE)
+
+// NOTE (Pedro): Instances touch the same offsets at the same time (lockstep lanes all do). Every
+// copied block is a cache line longer than its pages, so those don't all land in one cache set.
+#define MEMORY_BLOCK_PADDING 64
+
+// NOTE (Pedro): The loaded program and the zeroes after it, one contiguous segment. Instances fork
+// from it and never write to it, so it stays read-only for as long as any of them run.
+typedef struct memory_image
+{
+    u8 *Bytes;              // SEGMENT_SIZE
+    u32 ProgramSize;
+} memory_image;
+
+// NOTE (Pedro): Where the pages instances copy on write come from. Released pages are kept on a
+// free list per block size (a program is copied as one block, see paged_memory), so a context
+// that runs image after image stops growing once it has seen the biggest.
+typedef struct page_pool
+{
+    memory_arena *Arena;
+    u8 *FreeBlocks[MEMORY_PAGE_COUNT + 1];  // By page count, linked through each block's first bytes
+
+    // Stats
+    u64 PagesCopied;
+    u64 PagesInUse;
+    u64 PeakPagesInUse;
+} page_pool;
+
+// NOTE (Pedro): One instance's view of the segment, 4 KB pages that point into the image until the
+// instance first writes to them. Forking is a copy of the page table, whatever the memory holds.
+// The pages covering the program are always copied together into one block, so the decoder can
+// keep reading the code as contiguous bytes from Pages[0].
+typedef struct paged_memory
+{
+    u8 *Pages[MEMORY_PAGE_COUNT];
+    u32 Owned;              // Bit per page this instance copied, written in place
+    u32 Dirty;              // Bit per page that may differ from the image
+    u32 CodePages;          // Bit per page covering the program
+    page_pool *Pool;
+} paged_memory;
+
+void InitMemoryImage(memory_image *Image, memory_arena *Arena);
+void ResetMemoryImage(memory_image *Image);
+void InitPagePool(page_pool *Pool, memory_arena *Arena);
+
+void ForkMemory(paged_memory *Memory, memory_image *Image, page_pool *Pool);
+void ForkMemoryFrom(paged_memory *Memory, paged_memory *Parent, page_pool *Pool);
+void ReleaseMemory(paged_memory *Memory);
+u8 *CopyPageOnWrite(paged_memory *Memory, u32 Page);
+
+u32 GetDirtyPageCount(paged_memory *Memory);
+void PrintPagePoolStats(page_pool *Pool, output_buffer *Out);
+
+// NOTE (Pedro): Offsets wrap inside the segment since they are u16, so the page is always valid
+static inline u8 ReadMemoryByte(paged_memory *Memory, u16 Address)
+{
+    u8 Result = Memory->Pages[Address >> MEMORY_PAGE_SHIFT][Address & MEMORY_PAGE_MASK];
+    return Result;
+}
+
+static inline void WriteMemoryByte(paged_memory *Memory, u16 Address, u8 Value)
+{
+    u32 Page = Address >> MEMORY_PAGE_SHIFT;
+    u8 *Bytes = Memory->Pages[Page];
+    if(!(Memory->Owned & (1u << Page)))
+    {
+        Bytes = CopyPageOnWrite(Memory, Page);
+    }
+
+    Bytes[Address & MEMORY_PAGE_MASK] = Value;
+}
+
+// NOTE (Pedro): The program pages are contiguous wherever they are. They move when the program is
+// first written, so this is looked up again after anything that can write.
+static inline u8 *GetCodeBytes(paged_memory *Memory)
+{
+    u8 *Result = Memory->Pages[0];
+    return Result;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim86_output.h"
+
+void InitOutput(output_buffer *Out, int FileHandle)
+{
+    *Out = {};
+    Out->Base = (u8 *)malloc(OUTPUT_BUFFER_SIZE);
+    Out->Size = OUTPUT_BUFFER_SIZE;
+    Out->FileHandle = FileHandle;
+}
+
+static void WriteAll(int FileHandle, u8 *At, u64 Left)
+{
+    // NOTE (Pedro): write may take less than the whole block on pipes, keep going until it's all out
+    while(Left)
+    {
+        ssize_t Written = write(FileHandle, At, Left);
+        if(Written <= 0)
+        {
+            break;
+        }
+
+        At += Written;
+        Left -= Written;
+    }
+}
+
+void FlushOutput(output_buffer *Out)
+{
+    if(Out->FileHandle >= 0)
+    {
+        WriteAll(Out->FileHandle, Out->Base, Out->Used);
+        Out->Used = 0;
+    }
+}
+
+void FreeOutput(output_buffer *Out)
+{
+    FlushOutput(Out);
+    free(Out->Base);
+    *Out = {};
+}
+
+// NOTE (Pedro): Make sure the next Size bytes fit, the Append functions don't check on their own.
+// Buffers without a file handle keep everything in memory and grow instead of flushing. One that
+// can't grow keeps the block it had.
+void ReserveOutput(output_buffer *Out, u64 Size)
+{
+    if((Out->Size - Out->Used) < Size)
+    {
+        if(Out->FileHandle >= 0)
+        {
+            FlushOutput(Out);
+        }
+        else
+        {
+            u64 NewSize = 2 * Out->Size;
+            if(NewSize < (Out->Used + Size))
+            {
+                NewSize = Out->Used + Size;
+            }
+
+            u8 *Base = (u8 *)realloc(Out->Base, NewSize);
+            if(!Base)
+            {
+                fprintf(stderr, "ERROR: Could not grow the output to %llu bytes\n", (unsigned long long)NewSize);
+                if(Out->OutOfSpace)
+                {
+                    longjmp(*Out->OutOfSpace, 1);
+                }
+                exit(1);
+            }
+
+            Out->Base = Base;
+            Out->Size = NewSize;
+        }
+    }
+}
+
+void AppendBytes(output_buffer *Out, u8 *Bytes, u64 Size)
+{
+    ReserveOutput(Out, Size);
+
+    if((Out->Size - Out->Used) >= Size)
+    {
+        memcpy(Out->Base + Out->Used, Bytes, Size);
+        Out->Used += Size;
+    }
+    else
+    {
+        // Still doesn't fit after a flush, hand it straight to the OS
+        WriteAll(Out->FileHandle, Bytes, Size);
+    }
+}
+
+void AppendString(output_buffer *Out, const char *String)
+{
+    u8 *Dest = Out->Base + Out->Used;
+    while(*String)
+    {
+        *Dest++ = *String++;
+    }
+
+    Out->Used = Dest - Out->Base;
+}
+
+void AppendU64(output_buffer *Out, u64 Value)
+{
+    // Digits come out backwards, build them at the end of a scratch array
+    u8 Digits[20];
+    u8 *Start = Digits + sizeof(Digits);
+    do
+    {
+        *--Start = '0' + (Value % 10);
+        Value /= 10;
+    } while(Value);
+
+    u64 Count = (Digits + sizeof(Digits)) - Start;
+    u8 *Dest = Out->Base + Out->Used;
+    for(u64 Index = 0; Index < Count; Index++)
+    {
+        Dest[Index] = Start[Index];
+    }
+
+    Out->Used += Count;
+}
+
+void AppendU32(output_buffer *Out, u32 Value)
+{
+    AppendU64(Out, Value);
+}
+
+// NOTE (Pedro): Always four lowercase digits, no prefix
+void AppendHex16(output_buffer *Out, u16 Value)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+
+    u8 *Dest = Out->Base + Out->Used;
+    for(int Index = 3; Index >= 0; Index--)
+    {
+        Dest[Index] = HexDigits[Value & 0xF];
+        Value >>= 4;
+    }
+
+    Out->Used += 4;
+}
+
+void AppendS32(output_buffer *Out, s32 Value)
+{
+    if(Value < 0)
+    {
+        Out->Base[Out->Used++] = '-';
+        AppendU32(Out, -(u32)Value);
+    }
+    else
+    {
+        AppendU32(Out, Value);
+    }
+}
+
+void AppendS64(output_buffer *Out, s64 Value)
+{
+    if(Value < 0)
+    {
+        Out->Base[Out->Used++] = '-';
+        AppendU64(Out, -(u64)Value);
+    }
+    else
+    {
+        AppendU64(Out, Value);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef SIM86_OUTPUT_H
+#define SIM86_OUTPUT_H
+
+#include <setjmp.h>
+
+#include "sim86.h"
+
+// NOTE (Pedro): Text is formatted into one reusable block and handed to the OS with a single write when it fills up
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+// NOTE (Pedro): Upper bound on one formatted line, checked once per line instead of per token
+#define MAX_OUTPUT_LINE 256
+
+typedef struct output_buffer
+{
+    u8 *Base;
+    u64 Size;
+    u64 Used;
+    int FileHandle;     // Negative for in-memory buffers that grow instead of flushing
+    jmp_buf *OutOfSpace;    // Where a buffer that can't grow jumps to, 0 exits the process
+} output_buffer;
+
+void InitOutput(output_buffer *Out, int FileHandle);
+void FlushOutput(output_buffer *Out);
+void FreeOutput(output_buffer *Out);
+
+void ReserveOutput(output_buffer *Out, u64 Size);
+void AppendBytes(output_buffer *Out, u8 *Bytes, u64 Size);
+void AppendString(output_buffer *Out, const char *String);
+void AppendU32(output_buffer *Out, u32 Value);
+void AppendU64(output_buffer *Out, u64 Value);
+void AppendHex16(output_buffer *Out, u16 Value);
+void AppendS32(output_buffer *Out, s32 Value);
+void AppendS64(output_buffer *Out, s64 Value);
+
+#endif
@@ -0,0 +1,158 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sim86_parallel.h"
+#include "sim86_decode.h"
+#include "sim86_length.h"
+#include "sim86_display.h"
+#include "sim86_timer.h"
+#include "sim86_stats.h"
+
+typedef struct parallel_wave
+{
+    u8 *Image;
+    u64 ImageSize;
+
+    disasm_chunk *Chunks;
+    u32 ChunkCount;
+    u32 NextChunk;
+} parallel_wave;
+
+// NOTE (Pedro): Start is a real instruction start and so is End, every instruction in between
+// is known to decode
+static void DecodeChunk(u8 *Image, u64 ImageSize, disasm_chunk *Chunk)
+{
+    buffer Buffer = {Image, ImageSize, Chunk->Start, 0};
+
+    Chunk->Text.Used = 0;
+
+    while(Buffer.IndexPtr < Chunk->End)
+    {
+        instruction Instruction = ParseInstruction(&Buffer);
+        if(Instruction.OpType == op_unknown)
+        {
+            break;
+        }
+
+        PrintInstruction(&Instruction, &Chunk->Text);
+    }
+}
+
+static void *ChunkWorker(void *Param)
+{
+    parallel_wave *Wave = (parallel_wave *)Param;
+
+    for(;;)
+    {
+        u32 ChunkIndex = __atomic_fetch_add(&Wave->NextChunk, 1, __ATOMIC_RELAXED);
+        if(ChunkIndex >= Wave->ChunkCount)
+        {
+            break;
+        }
+
+        DecodeChunk(Wave->Image, Wave->ImageSize, &Wave->Chunks[ChunkIndex]);
+    }
+
+    STATS_MERGE_THREAD();
+    return 0;
+}
+
+// NOTE (Pedro): Works in waves of ThreadCount * PARALLEL_CHUNKS_PER_THREAD chunks so the
+// text held in memory stays flat no matter how big the image is. The chunk table and boundary
+// index come from Arena, the chunk text buffers grow on their own and are freed here.
+void DisAsm8086Parallel(u8 *Image, u64 ImageSize, u32 ThreadCount, output_buffer *Out, memory_arena *Arena)
+{
+    u32 ChunkCount = ThreadCount * PARALLEL_CHUNKS_PER_THREAD;
+    disasm_chunk *Chunks = PushZeroArray(Arena, ChunkCount, disasm_chunk);
+    pthread_t *Threads = PushZeroArray(Arena, ThreadCount, pthread_t);
+
+    for(u32 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+    {
+        InitOutput(&Chunks[ChunkIndex].Text, -1);
+    }
+
+    // The pre-pass finds every start, and where the image stops decoding, for a fraction of a full decode
+    boundary_index Index;
+    BuildBoundaryIndex(Image, ImageSize, &Index, Arena);
+
+    for(u64 WaveStart = 0; WaveStart < Index.End;)
+    {
+        parallel_wave Wave = {Image, ImageSize, Chunks, 0, 0};
+
+        for(u64 Start = WaveStart; (Start < Index.End) && (Wave.ChunkCount < ChunkCount);)
+        {
+            disasm_chunk *Chunk = &Chunks[Wave.ChunkCount++];
+            Chunk->Start = Start;
+            Chunk->End = GetNextInstructionStart(&Index, Start + PARALLEL_CHUNK_SIZE);
+            Start = Chunk->End;
+        }
+
+        // The calling thread takes a share of the chunks too
+        for(u32 ThreadIndex = 1; ThreadIndex < ThreadCount; ThreadIndex++)
+        {
+            pthread_create(&Threads[ThreadIndex], 0, ChunkWorker, &Wave);
+        }
+
+        ChunkWorker(&Wave);
+
+        for(u32 ThreadIndex = 1; ThreadIndex < ThreadCount; ThreadIndex++)
+        {
+            pthread_join(Threads[ThreadIndex], 0);
+        }
+
+        for(u32 ChunkIndex = 0; ChunkIndex < Wave.ChunkCount; ChunkIndex++)
+        {
+            AppendBytes(Out, Chunks[ChunkIndex].Text.Base, Chunks[ChunkIndex].Text.Used);
+        }
+
+        WaveStart = Chunks[Wave.ChunkCount - 1].End;
+    }
+
+    for(u32 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+    {
+        FreeOutput(&Chunks[ChunkIndex].Text);
+    }
+}
+
+// NOTE (Pedro): Decodes the image once per thread count with the text thrown away, and reports timings on stderr
+void ReportParallelScaling(u8 *Image, u64 ImageSize, u32 MaxThreadCount, memory_arena *Arena)
+{
+    // Without a handle the buffer would keep the text of every run in memory
+    int NullHandle = open("/dev/null", O_WRONLY);
+    if(NullHandle < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open /dev/null for -scaling\n");
+        return;
+    }
+
+    output_buffer Discard;
+    InitOutput(&Discard, NullHandle);
+
+    fprintf(stderr, "threads     seconds      MB/s   speedup\n");
+
+    double BaseSeconds = 0;
+    for(u32 ThreadCount = 1; ThreadCount <= MaxThreadCount; ThreadCount++)
+    {
+        temporary_memory Temp = BeginTemporaryMemory(Arena);
+
+        double StartTime = GetSeconds();
+        DisAsm8086Parallel(Image, ImageSize, ThreadCount, &Discard, Arena);
+        FlushOutput(&Discard);
+        double Seconds = GetSeconds() - StartTime;
+
+        EndTemporaryMemory(Temp);
+
+        if(ThreadCount == 1)
+        {
+            BaseSeconds = Seconds;
+        }
+
+        fprintf(stderr, "%7u  %10.4f  %8.2f  %7.2fx\n", ThreadCount, Seconds,
+                (ImageSize / (1024.0 * 1024.0)) / Seconds, BaseSeconds / Seconds);
+    }
+
+    FreeOutput(&Discard);
+    close(NullHandle);
+}
@@ -0,0 +1,26 @@
+#ifndef SIM86_PARALLEL_H
+#define SIM86_PARALLEL_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_arena.h"
+
+// NOTE (Pedro): Each worker decodes one chunk. Chunk edges are moved onto real instruction
+// starts with the boundary index, so the chunks' text just goes out one after the other.
+#define PARALLEL_CHUNK_SIZE (1024 * 1024)
+
+// NOTE (Pedro): Chunks handed out per wave for each thread, bounds the text held in memory
+#define PARALLEL_CHUNKS_PER_THREAD 2
+
+typedef struct disasm_chunk
+{
+    u64 Start;          // Instruction starts, from the boundary index
+    u64 End;
+
+    output_buffer Text;
+} disasm_chunk;
+
+void DisAsm8086Parallel(u8 *Image, u64 ImageSize, u32 ThreadCount, output_buffer *Out, memory_arena *Arena);
+void ReportParallelScaling(u8 *Image, u64 ImageSize, u32 MaxThreadCount, memory_arena *Arena);
+
+#endif
@@ -0,0 +1,356 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim86_run.h"
+#include "sim86_loader.h"
+#include "sim86_decode.h"
+#include "sim86_display.h"
+#include "sim86_parallel.h"
+#include "sim86_flow.h"
+#include "sim86_clocks.h"
+#include "sim86_timer.h"
+#include "sim86_snapshot.h"
+
+// NOTE (Pedro): False if either arena couldn't be reserved, the context is freed again
+bool InitRunContext(run_context *Context, int FileHandle)
+{
+    *Context = {};
+    InitOutput(&Context->Out, FileHandle);
+
+    bool Result = InitArena(&Context->Arena, ARENA_IMAGE_RESERVE) &&
+                  InitArena(&Context->ContextArena, ARENA_CONTEXT_RESERVE);
+    if(!Result)
+    {
+        FreeRunContext(Context);
+    }
+
+    return Result;
+}
+
+void FreeRunContext(run_context *Context)
+{
+    FreeOutput(&Context->Out);
+    FreeArena(&Context->Arena);
+    FreeArena(&Context->ContextArena);
+
+    *Context = {};
+}
+
+// NOTE (Pedro): Drops whatever the last image pushed, call before opening the next one
+void BeginImage(run_context *Context)
+{
+    ResetArena(&Context->Arena);
+}
+
+// NOTE (Pedro): With Clocks every text line gets its 8086 clock estimate and the running total
+static void DisAsm8086(image_source *Source, output_buffer *Out, output_format Format, bool Clocks)
+{
+    buffer *Buffer = &Source->Buffer;
+    u64 TotalClocks = 0;
+
+    for(;;)
+    {
+        // Keep a whole encoding in the window before decoding when streaming
+        if((Buffer->Count - Buffer->IndexPtr) < MAX_INSTRUCTION_SIZE)
+        {
+            RefillImage(Source);
+        }
+
+        if(Buffer->IndexPtr >= Buffer->Count)
+        {
+            break;
+        }
+
+        instruction Instruction = ParseInstruction(Buffer);
+        if(Instruction.OpType != op_unknown)
+        {
+            if(Format == Format_Binary)
+            {
+                AppendInstructionRecord(&Instruction, Out);
+            }
+            else if(Format == Format_Json)
+            {
+                AppendInstructionJson(&Instruction, Out);
+            }
+            else if(Clocks)
+            {
+                ReserveOutput(Out, MAX_OUTPUT_LINE);
+                AppendInstruction(&Instruction, Out);
+                AppendInstructionClocks(&Instruction, &TotalClocks, Out);
+                AppendString(Out, "\n");
+            }
+            else
+            {
+                PrintInstruction(&Instruction, Out);
+            }
+        }
+        else
+        {
+            // TODO (PEDRO): Test for unrecognized input; make sure it works
+            //fprintf(stderr, "ERROR: Unrecognized input stream\n");
+            break;
+        }
+    }
+}
+
+// NOTE (Pedro): -resume, the file is a snapshot instead of a program. Its pages are used straight
+// from the mapping, which stays until the image is closed after it has run.
+static bool ResumeSnapshot(machine *Machine, image_source *Source)
+{
+    if(!Source->Mapped)
+    {
+        fprintf(stderr, "ERROR: -resume needs a snapshot file that can be mapped\n");
+        return false;
+    }
+
+    machine_snapshot Snapshot;
+    bool Result = LoadSnapshot(&Snapshot, Source->Mapped, Source->MappedSize);
+    if(Result)
+    {
+        RestoreSnapshot(Machine, &Snapshot);
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): -snapshot, the machine as it stopped. With -limit that is mid-run, and -resume
+// picks it up from there. The file is written next to the target and renamed over it, so a run
+// resumed from that same file keeps reading its mapping, and a crash never leaves half a snapshot.
+static void SaveSnapshot(machine *Machine, char *FileName, memory_arena *Arena)
+{
+    u64 NameSize = strlen(FileName);
+    char *TempName = PushArray(Arena, NameSize + sizeof(".tmp"), char);
+    memcpy(TempName, FileName, NameSize);
+    memcpy(TempName + NameSize, ".tmp", sizeof(".tmp"));
+
+    int FileHandle = open(TempName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(FileHandle < 0)
+    {
+        fprintf(stderr, "ERROR: Could not create snapshot %s\n", TempName);
+        return;
+    }
+
+    machine_snapshot Snapshot;
+    TakeSnapshot(Machine, &Snapshot);
+
+    output_buffer File;
+    InitOutput(&File, FileHandle);
+    u64 Size = AppendSnapshot(&Snapshot, &File);
+    FreeOutput(&File);
+
+    // The output buffer gives up quietly on a failed write, so the size is checked before the rename
+    bool Written = (lseek(FileHandle, 0, SEEK_CUR) == (off_t)Size);
+    if((close(FileHandle) != 0) || !Written || (rename(TempName, FileName) != 0))
+    {
+        fprintf(stderr, "ERROR: Could not write snapshot %s\n", FileName);
+        unlink(TempName);
+    }
+}
+
+// NOTE (Pedro): -lanes runs many copies of the loaded program (or the resumed snapshot), each from
+// its own registers, and prints every lane's final state. The context machine is the scratch machine for lanes that
+// leave lockstep, and runs every lane with -scalarlanes.
+static void ExecuteLanes(run_options *Options, machine *Machine, run_context *Context)
+{
+    output_buffer *Out = &Context->Out;
+
+    lockstep_batch Batch;
+    InitLockstepBatch(&Batch, Options->LaneCount, Machine, &Context->Arena);
+    SeedLaneRegisters(&Batch, Options->LaneSeed);
+    if(Options->InstructionLimit)
+    {
+        Batch.InstructionLimit = Options->InstructionLimit;
+    }
+
+    double StartTime = GetSeconds();
+    if(Options->ScalarLanes)
+    {
+        RunLanesScalar(&Batch, Machine);
+    }
+    else
+    {
+        RunLockstep(&Batch, Machine);
+    }
+    double Seconds = GetSeconds() - StartTime;
+
+    PrintLaneStates(&Batch, Out);
+
+    if(Options->CacheStats)
+    {
+        u64 InstructionCount = 0;
+        for(u32 Lane = 0; Lane < Batch.LaneCount; Lane++)
+        {
+            InstructionCount += Batch.InstructionCount[Lane];
+        }
+
+        if(!Options->ScalarLanes)
+        {
+            PrintLockstepStats(&Batch, Out);
+        }
+        PrintPagePoolStats(&Batch.Pool, Out);
+
+        u64 Microseconds = (u64)(Seconds * 1e6);
+        ReserveOutput(Out, MAX_OUTPUT_LINE);
+        AppendString(Out, "Execution time: ");
+        AppendU64(Out, Microseconds);
+        AppendString(Out, " us, ");
+        AppendU64(Out, Microseconds ? InstructionCount / Microseconds : 0);
+        AppendString(Out, "M instructions/s over every lane\n");
+    }
+}
+
+static void ExecuteImage(run_options *Options, image_source *Source, run_context *Context)
+{
+    output_buffer *Out = &Context->Out;
+    machine *Machine = &Context->Machine;
+
+    if(Machine->Image.Bytes)
+    {
+        ResetMachine(Machine);
+    }
+    else
+    {
+        InitMachine(Machine, &Context->ContextArena);
+    }
+
+    if(Options->UseCache)
+    {
+        if(Context->Cache)
+        {
+            ResetBlockCache(Context->Cache);
+        }
+        else
+        {
+            Context->Cache = CreateBlockCache(&Context->ContextArena);
+        }
+    }
+
+    Machine->InstructionLimit = Options->InstructionLimit;
+    Machine->Dispatch = Options->Dispatch;
+    Machine->Cache = Options->UseCache ? Context->Cache : 0;
+
+    clock_stats ClockStats = {};
+    Machine->Clocks = (Options->Clocks && !Options->LaneCount) ? &ClockStats : 0;
+
+    bool Loaded = Options->Resume ? ResumeSnapshot(Machine, Source) : LoadProgram(Machine, Source);
+    if(Loaded && Options->LaneCount)
+    {
+        ExecuteLanes(Options, Machine, Context);
+    }
+    else if(Loaded)
+    {
+        double StartTime = GetSeconds();
+        ExecuteProgram(Machine);
+        double Seconds = GetSeconds() - StartTime;
+
+        PrintMachineState(Machine, Out);
+
+        if(Machine->Clocks)
+        {
+            PrintClockStats(Machine->Clocks, Out);
+        }
+
+        if(Options->CacheStats)
+        {
+            if(Machine->Cache)
+            {
+                PrintCacheStats(Machine->Cache, Out);
+            }
+            PrintPagePoolStats(&Machine->Pool, Out);
+
+            // Whole microseconds, and instructions per microsecond is millions per second
+            u64 Microseconds = (u64)(Seconds * 1e6);
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, "Execution time: ");
+            AppendU64(Out, Microseconds);
+            AppendString(Out, " us, ");
+            AppendU64(Out, Microseconds ? Machine->InstructionCount / Microseconds : 0);
+            AppendString(Out, "M instructions/s\n");
+        }
+
+        if(Options->SnapshotPath)
+        {
+            SaveSnapshot(Machine, Options->SnapshotPath, &Context->Arena);
+        }
+    }
+
+    Machine->Clocks = 0;
+}
+
+// NOTE (Pedro): Disassembles or executes an opened image into Context->Out, Name goes in the header
+void RunSource(run_options *Options, image_source *Source, char *Name, run_context *Context)
+{
+    output_buffer *Out = &Context->Out;
+    ReserveOutput(Out, strlen(Name) + MAX_OUTPUT_LINE);
+
+    if(Options->Scaling && Source->Mapped)
+    {
+        ReportParallelScaling(Source->Mapped, Source->MappedSize, Options->ThreadCount, &Context->Arena);
+    }
+    else if(Options->Execute)
+    {
+        AppendString(Out, "\nExecuting File: ");
+        AppendString(Out, Name);
+        AppendString(Out, "\n\n");
+
+        ExecuteImage(Options, Source, Context);
+    }
+    else if(Options->Format == Format_Binary)
+    {
+        AppendRecordHeader(Out);
+        DisAsm8086(Source, Out, Format_Binary, false);
+    }
+    else if(Options->Format == Format_Json)
+    {
+        AppendJsonHeader(Name, Out);
+        DisAsm8086(Source, Out, Format_Json, false);
+    }
+    else
+    {
+        AppendString(Out, "\nDisassembling File: ");
+        AppendString(Out, Name);
+        AppendString(Out, "\n\n");
+        AppendString(Out, "Bits 16\n\n");
+
+        // Splitting into chunks needs the whole image up front, streamed input stays sequential.
+        // So does the clock estimate, its running total goes through every line in order.
+        // Following control flow needs the whole image as well, streamed input gets the linear sweep
+        if(Options->Flow && Source->Mapped)
+        {
+            DisAsm8086Flow(Source->Mapped, Source->MappedSize, Options->Clocks, Out, &Context->Arena);
+        }
+        else if((Options->ThreadCount > 1) && Source->Mapped && !Options->Clocks)
+        {
+            DisAsm8086Parallel(Source->Mapped, Source->MappedSize, Options->ThreadCount, Out, &Context->Arena);
+        }
+        else
+        {
+            DisAsm8086(Source, Out, Format_Text, Options->Clocks);
+        }
+    }
+}
+
+// NOTE (Pedro): Returns false if the file can't be opened
+bool RunImage(run_options *Options, char *FileName, run_context *Context)
+{
+    BeginImage(Context);
+
+    image_source Source;
+    if(!OpenImage(&Source, FileName, &Context->Arena))
+    {
+        return false;
+    }
+
+    RunSource(Options, &Source, FileName, Context);
+
+    if(Options->ArenaStats)
+    {
+        PrintArenaStats(&Context->Arena, FileName);
+        PrintArenaStats(&Context->ContextArena, "(context)");
+    }
+
+    CloseImage(&Source);
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef SIM86_RUN_H
+#define SIM86_RUN_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+#include "sim86_execute.h"
+#include "sim86_cache.h"
+#include "sim86_format.h"
+#include "sim86_arena.h"
+#include "sim86_lockstep.h"
+#include "sim86_snapshot.h"
+
+// NOTE (Pedro): What to do with each file, straight from the command line
+typedef struct run_options
+{
+    bool Execute;
+    bool Scaling;
+    bool UseCache;
+    bool CacheStats;
+    execute_dispatch Dispatch;  // -exec back end, Dispatch_Default for the one the build picked
+    bool Clocks;
+    bool Flow;              // Follow control flow from the entry point instead of sweeping every byte
+    bool ArenaStats;        // Arena use of every image on stderr, for sizing
+    output_format Format;   // Disassembly only, execution always prints text
+    u32 ThreadCount;        // Threads for the parallel disassembly of one image
+    u64 InstructionLimit;
+
+    u32 LaneCount;          // -exec this many copies of the program in lockstep, 0 for one plain run
+    u64 LaneSeed;           // Starting registers of every lane but the first
+    bool ScalarLanes;       // Run the lanes one after another on the plain executor, for comparison
+
+    bool Resume;            // Files are snapshots to carry on from, not programs
+    char *SnapshotPath;     // Where -exec leaves a snapshot of the machine as it stopped
+} run_options;
+
+// NOTE (Pedro): State one file needs that the next one can reuse. Batch workers own one each,
+// so the output block, machine memory and block cache are allocated once per thread.
+// Everything an image needs for itself comes from Arena, which is reset as each image starts.
+typedef struct run_context
+{
+    output_buffer Out;
+    machine Machine;        // Memory is allocated by the first -exec run
+    block_cache *Cache;
+
+    memory_arena Arena;         // One image's worth, reset in constant time between images
+    memory_arena ContextArena;  // Machine memory and block cache, as long as the context
+} run_context;
+
+bool InitRunContext(run_context *Context, int FileHandle);
+void FreeRunContext(run_context *Context);
+bool RunImage(run_options *Options, char *FileName, run_context *Context);
+void BeginImage(run_context *Context);
+void RunSource(run_options *Options, image_source *Source, char *Name, run_context *Context);
+
+#endif
@@ -0,0 +1,582 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sim86_server.h"
+#include "sim86_loader.h"
+#include "sim86_stats.h"
+#include "sim86_timer.h"
+
+static volatile sig_atomic_t ServerStopping;
+
+static void StopServer(int Signal)
+{
+    ServerStopping = 1;
+}
+
+// NOTE (Pedro): Both return false if the other end went away before everything was moved
+static bool ReceiveAll(int Handle, void *Dest, u64 Size)
+{
+    u8 *At = (u8 *)Dest;
+    while(Size)
+    {
+        ssize_t Received = read(Handle, At, Size);
+        if(Received <= 0)
+        {
+            if((Received < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            return false;
+        }
+
+        At += Received;
+        Size -= Received;
+    }
+
+    return true;
+}
+
+static bool SendAll(int Handle, void *Source, u64 Size)
+{
+    u8 *At = (u8 *)Source;
+    while(Size)
+    {
+        ssize_t Sent = write(Handle, At, Size);
+        if(Sent <= 0)
+        {
+            if((Sent < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            return false;
+        }
+
+        At += Sent;
+        Size -= Sent;
+    }
+
+    return true;
+}
+
+static bool SendStatus(int Handle, response_status Status)
+{
+    response_header Response = {SERVER_RESPONSE_MAGIC, (u32)Status, 0, 0};
+    bool Result = SendAll(Handle, &Response, sizeof(Response));
+    return Result;
+}
+
+// NOTE (Pedro): Serves the next request on a connection, false once the connection should be
+// closed. The response is formatted behind a header-sized gap in Context->Out so it goes out with
+// a single write.
+static bool ServeRequest(server *Server, int InHandle, int OutHandle, run_context *Context,
+                         u8 **Request, u64 *RequestCapacity)
+{
+    request_header Header;
+    if(!ReceiveAll(InHandle, &Header, sizeof(Header)))
+    {
+        return false;
+    }
+
+    if((Header.Magic != SERVER_REQUEST_MAGIC) || (Header.Version != SERVER_VERSION))
+    {
+        SendStatus(OutHandle, Response_BadRequest);
+        return false;
+    }
+
+    if((Header.NameSize > SERVER_MAX_NAME) || (Header.ImageSize > SERVER_MAX_IMAGE))
+    {
+        SendStatus(OutHandle, Response_TooLarge);
+        return false;
+    }
+
+    // Name and image share one block, the name gets a terminator between them
+    u64 RequestSize = Header.NameSize + 1 + Header.ImageSize;
+    if(RequestSize > *RequestCapacity)
+    {
+        // The request is still on the connection, so it can't go on after this
+        u8 *Grown = (u8 *)realloc(*Request, RequestSize);
+        if(!Grown)
+        {
+            SendStatus(OutHandle, Response_TooLarge);
+            return false;
+        }
+
+        *Request = Grown;
+        *RequestCapacity = RequestSize;
+    }
+
+    char *Name = (char *)*Request;
+    u8 *Image = *Request + Header.NameSize + 1;
+    if(!ReceiveAll(InHandle, Name, Header.NameSize) || !ReceiveAll(InHandle, Image, Header.ImageSize))
+    {
+        return false;
+    }
+    Name[Header.NameSize] = 0;
+
+    double StartTime = GetSeconds();
+
+    run_options Options = {};
+    Options.Execute = (Header.Flags & Request_Execute) != 0;
+    Options.Clocks = (Header.Flags & Request_Clocks) != 0;
+    Options.UseCache = !(Header.Flags & Request_NoCache);
+    Options.CacheStats = (Header.Flags & Request_CacheStats) != 0;
+    Options.Flow = (Header.Flags & Request_Flow) != 0;
+    Options.Format = (Header.Flags & Request_Binary) ? Format_Binary :
+                     (Header.Flags & Request_Json) ? Format_Json : Format_Text;
+    Options.ThreadCount = 1;
+    Options.InstructionLimit = Header.InstructionLimit;
+    if(!Options.InstructionLimit || (Options.InstructionLimit > Server->MaxInstructions))
+    {
+        Options.InstructionLimit = Server->MaxInstructions;
+    }
+
+    output_buffer *Out = &Context->Out;
+    response_header Response = {SERVER_RESPONSE_MAGIC, Response_Ok, 0, 0};
+    Out->Used = 0;
+    AppendBytes(Out, (u8 *)&Response, sizeof(Response));
+
+    // NOTE (Pedro): An image that needs more than the arena or the output can hold fails on its
+    // own instead of taking the server down. Neither is changed by the allocation that failed,
+    // and the next image resets both. Stats builds miss the timings of the blocks the jump leaves.
+    jmp_buf OutOfSpace;
+    if(setjmp(OutOfSpace))
+    {
+        Context->Arena.OutOfSpace = 0;
+        Out->OutOfSpace = 0;
+        bool Result = SendStatus(OutHandle, Response_TooLarge);
+        return Result;
+    }
+    Context->Arena.OutOfSpace = &OutOfSpace;
+    Out->OutOfSpace = &OutOfSpace;
+
+    BeginImage(Context);
+
+    image_source Source;
+    OpenImageFromMemory(&Source, Image, Header.ImageSize);
+    RunSource(&Options, &Source, Name, Context);
+    CloseImage(&Source);
+
+    Context->Arena.OutOfSpace = 0;
+    Out->OutOfSpace = 0;
+
+    u64 Nanoseconds = (u64)((GetSeconds() - StartTime) * 1e9);
+    Response.TextSize = Out->Used - sizeof(Response);
+    Response.ServiceNanoseconds = Nanoseconds;
+    memcpy(Out->Base, &Response, sizeof(Response));
+
+    if(!SendAll(OutHandle, Out->Base, Out->Used))
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&Server->Lock);
+    Server->RequestCount++;
+    Server->TotalNanoseconds += Nanoseconds;
+    if(Nanoseconds > Server->MaxNanoseconds)
+    {
+        Server->MaxNanoseconds = Nanoseconds;
+    }
+    pthread_mutex_unlock(&Server->Lock);
+
+    return true;
+}
+
+// NOTE (Pedro): Workers live as long as the server, so their run_context (output block,
+// machine memory, block cache) and request block stay warm from one request to the next. A
+// worker takes one request off a connection and hands the connection back to the listening
+// thread, so idle clients never hold a worker.
+static void *ServerWorker(void *Param)
+{
+    server_worker *Worker = (server_worker *)Param;
+    server *Server = Worker->Server;
+    run_context *Context = &Worker->Context;
+
+    u8 *Request = 0;
+    u64 RequestCapacity = 0;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&Server->Lock);
+        while(Server->PendingRead == Server->PendingWrite)
+        {
+            pthread_cond_wait(&Server->ConnectionReady, &Server->Lock);
+        }
+        int Handle = Server->Pending[Server->PendingRead++ % SERVER_QUEUE_SIZE];
+        pthread_mutex_unlock(&Server->Lock);
+
+        bool KeepOpen = ServeRequest(Server, Handle, Handle, Context, &Request, &RequestCapacity);
+        if(!KeepOpen)
+        {
+            close(Handle);
+        }
+
+        pthread_mutex_lock(&Server->Lock);
+        if(KeepOpen)
+        {
+            Server->Returned[Server->ReturnedWrite++ % SERVER_QUEUE_SIZE] = Handle;
+        }
+        else
+        {
+            Server->ConnectionCount--;
+        }
+        pthread_mutex_unlock(&Server->Lock);
+
+        if(KeepOpen)
+        {
+            u8 Wake = 0;
+            write(Server->WakeHandles[1], &Wake, 1);
+        }
+
+        STATS_MERGE_THREAD();
+    }
+
+    return 0;
+}
+
+static void PrintServerSummary(server *Server)
+{
+    u64 Count = Server->RequestCount;
+    fprintf(stderr, "Served %llu requests, %.1f us mean, %.1f us max service time\n",
+            (unsigned long long)Count,
+            Count ? (Server->TotalNanoseconds / 1000.0) / Count : 0.0,
+            Server->MaxNanoseconds / 1000.0);
+}
+
+// NOTE (Pedro): "-" serves a single framed stream on stdin/stdout. Otherwise listens on a Unix
+// socket at SocketPath until SIGINT/SIGTERM. This thread watches every open connection and hands
+// each request to one of ThreadCount workers. MaxInstructions caps how long any one request can
+// execute, 0 for SERVER_DEFAULT_MAX_INSTRUCTIONS.
+int RunServer(char *SocketPath, u32 ThreadCount, u64 MaxInstructions)
+{
+    server *Server = (server *)calloc(1, sizeof(server));
+    Server->MaxInstructions = MaxInstructions ? MaxInstructions : SERVER_DEFAULT_MAX_INSTRUCTIONS;
+    pthread_mutex_init(&Server->Lock, 0);
+    pthread_cond_init(&Server->ConnectionReady, 0);
+
+    // A client hanging up mid-response shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    if(strcmp(SocketPath, "-") == 0)
+    {
+        run_context Context;
+        if(!InitRunContext(&Context, -1))
+        {
+            free(Server);
+            return 1;
+        }
+
+        u8 *Request = 0;
+        u64 RequestCapacity = 0;
+        while(ServeRequest(Server, STDIN_FILENO, STDOUT_FILENO, &Context, &Request, &RequestCapacity))
+        {
+        }
+
+        free(Request);
+        FreeRunContext(&Context);
+        PrintServerSummary(Server);
+        free(Server);
+        return 0;
+    }
+
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    if(strlen(SocketPath) >= sizeof(Address.sun_path))
+    {
+        fprintf(stderr, "ERROR: Socket path %s is too long\n", SocketPath);
+        free(Server);
+        return 1;
+    }
+    strcpy(Address.sun_path, SocketPath);
+
+    Server->ListenHandle = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(SocketPath);
+    if((Server->ListenHandle < 0) ||
+       (bind(Server->ListenHandle, (struct sockaddr *)&Address, sizeof(Address)) < 0) ||
+       (listen(Server->ListenHandle, SERVER_QUEUE_SIZE) < 0))
+    {
+        fprintf(stderr, "ERROR: Could not listen on %s: %s\n", SocketPath, strerror(errno));
+        free(Server);
+        return 1;
+    }
+
+    // Both ends non-blocking, a full pipe already has a wake-up in it and the drain stops when empty
+    if(pipe(Server->WakeHandles) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not create the wake-up pipe: %s\n", strerror(errno));
+        close(Server->ListenHandle);
+        free(Server);
+        return 1;
+    }
+    fcntl(Server->WakeHandles[0], F_SETFL, O_NONBLOCK);
+    fcntl(Server->WakeHandles[1], F_SETFL, O_NONBLOCK);
+
+    // No SA_RESTART, so poll comes back with EINTR and the loop sees the flag
+    struct sigaction Action = {};
+    Action.sa_handler = StopServer;
+    sigaction(SIGINT, &Action, 0);
+    sigaction(SIGTERM, &Action, 0);
+
+    if(ThreadCount == 0)
+    {
+        ThreadCount = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    ThreadCount = (ThreadCount < 1) ? 1 : ThreadCount;
+    ThreadCount = (ThreadCount > SERVER_MAX_THREADS) ? SERVER_MAX_THREADS : ThreadCount;
+
+    // Workers live as long as the process, so these are never freed
+    server_worker *Workers = (server_worker *)calloc(ThreadCount, sizeof(server_worker));
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+    {
+        Workers[ThreadIndex].Server = Server;
+        if(!InitRunContext(&Workers[ThreadIndex].Context, -1))
+        {
+            for(u32 FreeIndex = 0; FreeIndex < ThreadIndex; FreeIndex++)
+            {
+                FreeRunContext(&Workers[FreeIndex].Context);
+            }
+            free(Workers);
+
+            close(Server->WakeHandles[0]);
+            close(Server->WakeHandles[1]);
+            close(Server->ListenHandle);
+            unlink(SocketPath);
+            free(Server);
+            return 1;
+        }
+    }
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex++)
+    {
+        pthread_t Thread;
+        pthread_create(&Thread, 0, ServerWorker, &Workers[ThreadIndex]);
+        pthread_detach(Thread);
+    }
+
+    fprintf(stderr, "Listening on %s with %u workers\n", SocketPath, ThreadCount);
+
+    // Connections between requests, only this thread touches them
+    int Idle[SERVER_MAX_CONNECTIONS];
+    u32 IdleCount = 0;
+    struct pollfd Polls[2 + SERVER_MAX_CONNECTIONS];
+
+    while(!ServerStopping)
+    {
+        Polls[0] = {Server->ListenHandle, POLLIN, 0};
+        Polls[1] = {Server->WakeHandles[0], POLLIN, 0};
+        for(u32 IdleIndex = 0; IdleIndex < IdleCount; IdleIndex++)
+        {
+            Polls[2 + IdleIndex] = {Idle[IdleIndex], POLLIN, 0};
+        }
+
+        if(poll(Polls, 2 + IdleCount, -1) < 0)
+        {
+            continue;
+        }
+
+        if(Polls[1].revents & POLLIN)
+        {
+            u8 Drain[64];
+            while(read(Server->WakeHandles[0], Drain, sizeof(Drain)) > 0)
+            {
+            }
+        }
+
+        // A connection with something to read (a request, or the client hanging up) goes to a
+        // worker. Every connection is idle, pending or with a worker, so the queues can't overflow.
+        pthread_mutex_lock(&Server->Lock);
+        u32 StillIdle = 0;
+        for(u32 IdleIndex = 0; IdleIndex < IdleCount; IdleIndex++)
+        {
+            if(Polls[2 + IdleIndex].revents)
+            {
+                Server->Pending[Server->PendingWrite++ % SERVER_QUEUE_SIZE] = Idle[IdleIndex];
+                pthread_cond_signal(&Server->ConnectionReady);
+            }
+            else
+            {
+                Idle[StillIdle++] = Idle[IdleIndex];
+            }
+        }
+        IdleCount = StillIdle;
+
+        while(Server->ReturnedRead != Server->ReturnedWrite)
+        {
+            Idle[IdleCount++] = Server->Returned[Server->ReturnedRead++ % SERVER_QUEUE_SIZE];
+        }
+
+        if(Polls[0].revents & POLLIN)
+        {
+            int Handle = accept(Server->ListenHandle, 0, 0);
+            if((Handle >= 0) && (Server->ConnectionCount < SERVER_MAX_CONNECTIONS))
+            {
+                Idle[IdleCount++] = Handle;
+                Server->ConnectionCount++;
+            }
+            else if(Handle >= 0)
+            {
+                close(Handle);
+            }
+        }
+        pthread_mutex_unlock(&Server->Lock);
+    }
+
+    close(Server->ListenHandle);
+    unlink(SocketPath);
+
+    // Workers may be in the middle of a connection, they go away with the process
+    pthread_mutex_lock(&Server->Lock);
+    PrintServerSummary(Server);
+    pthread_mutex_unlock(&Server->Lock);
+
+    return 0;
+}
+
+static u8 *ReadWholeFile(char *FileName, u64 *Size)
+{
+    int Handle = open(FileName, O_RDONLY);
+    struct stat FileStat;
+    if((Handle < 0) || (fstat(Handle, &FileStat) != 0))
+    {
+        fprintf(stderr, "ERROR: Could not open file %s\n", FileName);
+        if(Handle >= 0)
+        {
+            close(Handle);
+        }
+        return 0;
+    }
+
+    u8 *Result = (u8 *)malloc(FileStat.st_size ? FileStat.st_size : 1);
+    if(!ReceiveAll(Handle, Result, FileStat.st_size))
+    {
+        free(Result);
+        Result = 0;
+    }
+
+    close(Handle);
+    *Size = FileStat.st_size;
+    return Result;
+}
+
+// NOTE (Pedro): Sends each file Repeat times on one connection and writes the first response
+// to stdout. Round trip and server-side times go to stderr.
+int RunClient(char *SocketPath, run_options *Options, char **Paths, u32 PathCount, u32 Repeat)
+{
+    struct sockaddr_un Address = {};
+    Address.sun_family = AF_UNIX;
+    strncpy(Address.sun_path, SocketPath, sizeof(Address.sun_path) - 1);
+
+    int Handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if((Handle < 0) || (connect(Handle, (struct sockaddr *)&Address, sizeof(Address)) < 0))
+    {
+        fprintf(stderr, "ERROR: Could not connect to %s: %s\n", SocketPath, strerror(errno));
+        return 1;
+    }
+
+    u16 Flags = 0;
+    Flags |= Options->Execute ? Request_Execute : 0;
+    Flags |= Options->Clocks ? Request_Clocks : 0;
+    Flags |= Options->UseCache ? 0 : Request_NoCache;
+    Flags |= Options->CacheStats ? Request_CacheStats : 0;
+    Flags |= (Options->Format == Format_Binary) ? Request_Binary : 0;
+    Flags |= (Options->Format == Format_Json) ? Request_Json : 0;
+    Flags |= Options->Flow ? Request_Flow : 0;
+
+    output_buffer Out;
+    InitOutput(&Out, STDOUT_FILENO);
+
+    u8 *Text = 0;
+    u64 TextCapacity = 0;
+    int Result = 0;
+    bool MissingFile = false;   // Reported in the exit status, the rest of the files still go out
+
+    for(u32 PathIndex = 0; (PathIndex < PathCount) && !Result; PathIndex++)
+    {
+        char *Name = Paths[PathIndex];
+        u64 ImageSize;
+        u8 *Image = ReadWholeFile(Name, &ImageSize);
+        if(!Image)
+        {
+            MissingFile = true;
+            continue;
+        }
+
+        // Header, name and image go out in one write
+        u32 NameSize = (u32)strlen(Name);
+        request_header Header = {SERVER_REQUEST_MAGIC, SERVER_VERSION, Flags, NameSize, (u32)ImageSize, Options->InstructionLimit};
+        u64 FrameSize = sizeof(Header) + NameSize + ImageSize;
+        u8 *Frame = (u8 *)malloc(FrameSize);
+        memcpy(Frame, &Header, sizeof(Header));
+        memcpy(Frame + sizeof(Header), Name, NameSize);
+        memcpy(Frame + sizeof(Header) + NameSize, Image, ImageSize);
+
+        double BestRoundTrip = 1e9;
+        double TotalRoundTrip = 0;
+        u64 BestService = ~0ull;
+
+        for(u32 RepeatIndex = 0; RepeatIndex < Repeat; RepeatIndex++)
+        {
+            double StartTime = GetSeconds();
+
+            response_header Response;
+            if(!SendAll(Handle, Frame, FrameSize) || !ReceiveAll(Handle, &Response, sizeof(Response)) ||
+               (Response.Magic != SERVER_RESPONSE_MAGIC) || (Response.Status != Response_Ok))
+            {
+                fprintf(stderr, "ERROR: Request for %s failed\n", Name);
+                Result = 1;
+                break;
+            }
+
+            if(Response.TextSize > TextCapacity)
+            {
+                TextCapacity = Response.TextSize;
+                Text = (u8 *)realloc(Text, TextCapacity);
+            }
+
+            if(!ReceiveAll(Handle, Text, Response.TextSize))
+            {
+                Result = 1;
+                break;
+            }
+
+            double RoundTrip = GetSeconds() - StartTime;
+            TotalRoundTrip += RoundTrip;
+            BestRoundTrip = (RoundTrip < BestRoundTrip) ? RoundTrip : BestRoundTrip;
+            BestService = (Response.ServiceNanoseconds < BestService) ? Response.ServiceNanoseconds : BestService;
+
+            if(RepeatIndex == 0)
+            {
+                AppendBytes(&Out, Text, Response.TextSize);
+            }
+        }
+
+        if(!Result)
+        {
+            fprintf(stderr, "%s: %.1f us mean, %.1f us best round trip, %.1f us best service\n", Name,
+                    (TotalRoundTrip * 1e6) / Repeat, BestRoundTrip * 1e6, BestService / 1000.0);
+        }
+
+        free(Frame);
+        free(Image);
+    }
+
+    FreeOutput(&Out);
+    free(Text);
+    close(Handle);
+
+    if(MissingFile)
+    {
+        Result = 1;
+    }
+
+    return Result;
+}
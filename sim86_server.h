@@ -0,0 +1,98 @@
+#ifndef SIM86_SERVER_H
+#define SIM86_SERVER_H
+
+#include <pthread.h>
+
+#include "sim86.h"
+#include "sim86_run.h"
+
+// NOTE (Pedro): Frames are the little-endian structs below. A request header is followed by
+// NameSize bytes of name (used in the output header) and ImageSize bytes of image, a response
+// header by TextSize bytes of output. A connection carries any number of requests in turn.
+#define SERVER_REQUEST_MAGIC 0x51363853     // "S86Q"
+#define SERVER_RESPONSE_MAGIC 0x52363853    // "S86R"
+#define SERVER_VERSION 1
+
+#define SERVER_MAX_NAME 4096
+#define SERVER_MAX_IMAGE (64 * 1024 * 1024)
+#define SERVER_MAX_THREADS 64
+
+// NOTE (Pedro): Open connections, idle or with a request waiting for a worker. Workers only hold
+// a connection for one request, so the queues never need more room than this.
+#define SERVER_QUEUE_SIZE 256
+#define SERVER_MAX_CONNECTIONS SERVER_QUEUE_SIZE
+
+// NOTE (Pedro): Ceiling on every request's instruction limit when -serve isn't given -limit, so a
+// program that never stops can't keep a worker. A second or two of the slowest loops.
+#define SERVER_DEFAULT_MAX_INSTRUCTIONS 100000000ull
+
+typedef enum request_flags
+{
+    Request_Execute = 0x1,
+    Request_Clocks = 0x2,
+    Request_NoCache = 0x4,
+    Request_CacheStats = 0x8,
+    Request_Binary = 0x10,  // Disassembly as a record file instead of text
+    Request_Json = 0x20,    // Disassembly as JSON Lines
+    Request_Flow = 0x40,    // Control-flow disassembly from the entry point
+} request_flags;
+
+typedef enum response_status
+{
+    Response_Ok,
+    Response_BadRequest,    // Wrong magic or version, the connection is closed after this
+    Response_TooLarge,      // Over SERVER_MAX_NAME or SERVER_MAX_IMAGE, or more than the worker's arena holds
+} response_status;
+
+typedef struct request_header
+{
+    u32 Magic;
+    u16 Version;
+    u16 Flags;              // request_flags
+    u32 NameSize;
+    u32 ImageSize;
+    u64 InstructionLimit;   // 0 for the server's ceiling, never more than it
+} request_header;
+
+typedef struct response_header
+{
+    u32 Magic;
+    u32 Status;             // response_status
+    u64 TextSize;
+    u64 ServiceNanoseconds; // From the whole request being read to the response being ready
+} response_header;
+
+typedef struct server
+{
+    int ListenHandle;
+    int WakeHandles[2];     // Pipe a worker writes to when it hands a connection back
+    u64 MaxInstructions;    // Ceiling on every request's limit so a runaway program can't keep a worker
+
+    pthread_mutex_t Lock;
+    pthread_cond_t ConnectionReady;
+    int Pending[SERVER_QUEUE_SIZE];     // Connections with a request waiting for a worker
+    u32 PendingRead;
+    u32 PendingWrite;
+    int Returned[SERVER_QUEUE_SIZE];    // Connections a worker is done with, to be watched again
+    u32 ReturnedRead;
+    u32 ReturnedWrite;
+    u32 ConnectionCount;
+
+    // Latency totals over every request served, under Lock
+    u64 RequestCount;
+    u64 TotalNanoseconds;
+    u64 MaxNanoseconds;
+} server;
+
+// NOTE (Pedro): The context is set up before the worker's thread starts, so a server that can't
+// reserve one stops before it serves anything
+typedef struct server_worker
+{
+    server *Server;
+    run_context Context;
+} server_worker;
+
+int RunServer(char *SocketPath, u32 ThreadCount, u64 MaxInstructions);
+int RunClient(char *SocketPath, run_options *Options, char **Paths, u32 PathCount, u32 Repeat);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sim86_snapshot.h"
+
+// NOTE (Pedro): What every page missing from a snapshot file points at. Snapshot pages are never
+// owned, so nothing writes to it.
+static u8 SnapshotZeroPage[MEMORY_PAGE_SIZE];
+
+// NOTE (Pedro): The machine gives up owning its pages to the snapshot, so only what it writes
+// from here on gets copied, and that is what the next snapshot or a restore has to look at
+void TakeSnapshot(machine *Machine, machine_snapshot *Snapshot)
+{
+    MaterializeFlags(Machine);
+
+    *Snapshot = {};
+    Snapshot->Regs = Machine->Regs;
+    Snapshot->IP = Machine->IP;
+    Snapshot->Flags = Machine->Flags;
+    Snapshot->ProgramSize = Machine->ProgramSize;
+    Snapshot->InstructionCount = Machine->InstructionCount;
+    Snapshot->Changed = Machine->Memory.Owned;
+
+    ForkMemoryFrom(&Snapshot->Memory, &Machine->Memory, 0);
+}
+
+// NOTE (Pedro): The pages the machine copied since the snapshot (or its last restore) go back to
+// its pool, everything else already matches. Blocks decoded from the same code stay cached.
+void RestoreSnapshot(machine *Machine, machine_snapshot *Snapshot)
+{
+    bool SameCode = (Machine->ProgramSize == Snapshot->ProgramSize) &&
+                    (GetCodeBytes(&Machine->Memory) == GetCodeBytes(&Snapshot->Memory));
+
+    ReleaseMemory(&Machine->Memory);
+    ForkMemoryFrom(&Machine->Memory, &Snapshot->Memory, &Machine->Pool);
+
+    Machine->Regs = Snapshot->Regs;
+    Machine->IP = Snapshot->IP;
+    Machine->Flags = Snapshot->Flags;
+    Machine->LazyFlags = {};
+    Machine->ProgramSize = Snapshot->ProgramSize;
+    Machine->InstructionCount = Snapshot->InstructionCount;
+    Machine->CodeModified = false;
+
+    if(Machine->Cache && !SameCode)
+    {
+        ResetBlockCache(Machine->Cache);
+    }
+}
+
+static bool IsZeroPage(u8 *Page)
+{
+    u64 Bits = 0;
+    for(u32 Index = 0; Index < MEMORY_PAGE_SIZE; Index += sizeof(u64))
+    {
+        u64 Word;
+        memcpy(&Word, Page + Index, sizeof(Word));
+        Bits |= Word;
+    }
+
+    bool Result = (Bits == 0);
+    return Result;
+}
+
+// NOTE (Pedro): Writes the program and every page that isn't zero, so a file holds the whole
+// machine without needing the image it was loaded from. Returns the bytes appended.
+u64 AppendSnapshot(machine_snapshot *Snapshot, output_buffer *Out)
+{
+    paged_memory *Memory = &Snapshot->Memory;
+
+    u32 PageMask = Memory->CodePages;
+    u32 Dirty = Memory->Dirty & ~Memory->CodePages;
+    while(Dirty)
+    {
+        u32 Page = __builtin_ctz(Dirty);
+        if(!IsZeroPage(Memory->Pages[Page]))
+        {
+            PageMask |= 1u << Page;
+        }
+        Dirty &= Dirty - 1;
+    }
+
+    snapshot_file_header Header = {};
+    Header.Magic = SNAPSHOT_FILE_MAGIC;
+    Header.Version = SNAPSHOT_FILE_VERSION;
+    Header.HeaderSize = sizeof(snapshot_file_header);
+    Header.PageSize = MEMORY_PAGE_SIZE;
+    Header.PageMask = PageMask;
+    Header.ProgramSize = Snapshot->ProgramSize;
+    Header.IP = Snapshot->IP;
+    Header.Flags = Snapshot->Flags;
+    Header.Regs = Snapshot->Regs;
+    Header.InstructionCount = Snapshot->InstructionCount;
+
+    AppendBytes(Out, (u8 *)&Header, sizeof(Header));
+    u64 Result = sizeof(Header) + (u64)__builtin_popcount(PageMask) * MEMORY_PAGE_SIZE;
+
+    while(PageMask)
+    {
+        u32 Page = __builtin_ctz(PageMask);
+        AppendBytes(Out, Memory->Pages[Page], MEMORY_PAGE_SIZE);
+        PageMask &= PageMask - 1;
+    }
+
+    return Result;
+}
+
+// NOTE (Pedro): Points the snapshot's pages straight into Bytes, nothing is copied. Bytes is
+// usually a mapped file, it has to stay mapped for as long as anything runs from the snapshot.
+bool LoadSnapshot(machine_snapshot *Snapshot, u8 *Bytes, u64 Size)
+{
+    snapshot_file_header Header;
+    if(Size < sizeof(Header))
+    {
+        fprintf(stderr, "ERROR: Snapshot is too short for its header\n");
+        return false;
+    }
+
+    memcpy(&Header, Bytes, sizeof(Header));
+    if((Header.Magic != SNAPSHOT_FILE_MAGIC) || (Header.Version != SNAPSHOT_FILE_VERSION) ||
+       (Header.HeaderSize != sizeof(Header)) || (Header.PageSize != MEMORY_PAGE_SIZE))
+    {
+        fprintf(stderr, "ERROR: Not a version %u snapshot with %u byte pages\n", SNAPSHOT_FILE_VERSION, MEMORY_PAGE_SIZE);
+        return false;
+    }
+
+    u32 CodePageCount = (Header.ProgramSize + MEMORY_PAGE_MASK) >> MEMORY_PAGE_SHIFT;
+    u32 CodePages = (1u << CodePageCount) - 1;
+    u64 PageCount = __builtin_popcount(Header.PageMask);
+    if((Header.ProgramSize > SEGMENT_SIZE) || (Header.PageMask >> MEMORY_PAGE_COUNT) ||
+       ((Header.PageMask & CodePages) != CodePages) ||
+       (Size < (Header.HeaderSize + PageCount * MEMORY_PAGE_SIZE)))
+    {
+        fprintf(stderr, "ERROR: Snapshot pages don't match its header\n");
+        return false;
+    }
+
+    *Snapshot = {};
+    Snapshot->Regs = Header.Regs;
+    Snapshot->IP = Header.IP;
+    Snapshot->Flags = Header.Flags;
+    Snapshot->ProgramSize = Header.ProgramSize;
+    Snapshot->InstructionCount = Header.InstructionCount;
+    Snapshot->Changed = Header.PageMask;
+
+    paged_memory *Memory = &Snapshot->Memory;
+    u8 *Page = Bytes + Header.HeaderSize;
+    for(u32 Index = 0; Index < MEMORY_PAGE_COUNT; Index++)
+    {
+        if(Header.PageMask & (1u << Index))
+        {
+            Memory->Pages[Index] = Page;
+            Page += MEMORY_PAGE_SIZE;
+        }
+        else
+        {
+            Memory->Pages[Index] = SnapshotZeroPage;
+        }
+    }
+
+    Memory->Dirty = Header.PageMask & ~CodePages;
+    Memory->CodePages = CodePages;
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef SIM86_SNAPSHOT_H
+#define SIM86_SNAPSHOT_H
+
+#include "sim86.h"
+#include "sim86_execute.h"
+#include "sim86_memory.h"
+#include "sim86_output.h"
+
+#define SNAPSHOT_FILE_MAGIC 0x53363853  // "S86S"
+#define SNAPSHOT_FILE_VERSION 1
+
+// NOTE (Pedro): The stored pages follow the header back to back in page order. Pages not in
+// PageMask are zero, the pages covering the program are always stored so they stay contiguous
+// when the file is mapped. Values are little-endian, the way they are in memory.
+typedef struct snapshot_file_header
+{
+    u32 Magic;
+    u16 Version;
+    u16 HeaderSize;
+    u32 PageSize;
+    u32 PageMask;           // Bit per page stored in the file
+    u32 ProgramSize;
+    u16 IP;
+    u16 Flags;
+    regs Regs;
+    u64 InstructionCount;
+} snapshot_file_header;
+
+// NOTE (Pedro): A machine frozen at one point of its run. Its pages are shared with the machine it
+// was taken from, and with the snapshots before it, none of them is written again. Taking one
+// costs nothing but the registers, the machine just copies its next write to any page.
+typedef struct machine_snapshot
+{
+    regs Regs;
+    u16 IP;
+    u16 Flags;              // Materialized when taken
+    u32 ProgramSize;
+    u64 InstructionCount;
+
+    paged_memory Memory;    // Owns nothing
+    u32 Changed;            // Bit per page written since the snapshot before
+} machine_snapshot;
+
+void TakeSnapshot(machine *Machine, machine_snapshot *Snapshot);
+void RestoreSnapshot(machine *Machine, machine_snapshot *Snapshot);
+
+u64 AppendSnapshot(machine_snapshot *Snapshot, output_buffer *Out);
+bool LoadSnapshot(machine_snapshot *Snapshot, u8 *Bytes, u64 Size);
+
+#endif
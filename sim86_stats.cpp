@@ -0,0 +1,241 @@
+#include <pthread.h>
+
+#include "sim86_stats.h"
+#include "sim86_display.h"
+
+#ifdef SIM86_STATS
+
+thread_local run_stats ThreadStats;
+
+static run_stats GlobalStats;
+static pthread_mutex_t GlobalStatsLock = PTHREAD_MUTEX_INITIALIZER;
+static u64 RunStartCycles;
+
+static const char *StageNames[Stage_Count] =
+{
+    "load",
+    "parse",
+    "parse_rm",
+    "print",
+    "execute",
+    "length",
+};
+
+static const char *LayoutNames[STATS_LAYOUT_COUNT] =
+{
+    "none",
+    "reg_rm",
+    "imm_to_rm",
+    "imm_to_reg",
+    "imm_to_acc",
+    "mem_to_acc",
+    "acc_to_mem",
+    "jump",
+};
+
+void BeginStats(void)
+{
+    RunStartCycles = __rdtsc();
+}
+
+// NOTE (Pedro): Speculative chunks of the parallel disassembler are counted too, so with -threads
+// the decode numbers include work that was thrown away at resync
+void MergeThreadStats(void)
+{
+    u64 *Source = (u64 *)&ThreadStats;
+    u64 *Dest = (u64 *)&GlobalStats;
+
+    pthread_mutex_lock(&GlobalStatsLock);
+    for(u32 Index = 0; Index < (sizeof(run_stats) / sizeof(u64)); Index++)
+    {
+        Dest[Index] += Source[Index];
+    }
+    pthread_mutex_unlock(&GlobalStatsLock);
+
+    ThreadStats = {};
+}
+
+static void AppendPercent(output_buffer *Out, u64 Part, u64 Total)
+{
+    u64 Tenths = Total ? (Part * 1000) / Total : 0;
+    AppendU64(Out, Tenths / 10);
+    AppendString(Out, ".");
+    AppendU64(Out, Tenths % 10);
+    AppendString(Out, "%");
+}
+
+static void PrintStatsText(run_stats *Stats, u64 TotalCycles, output_buffer *Out)
+{
+    u64 Instructions = 0;
+    for(u32 Op = 0; Op <= op_unknown; Op++)
+    {
+        Instructions += Stats->OpCounts[Op];
+    }
+
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "\nStats: ");
+    AppendU64(Out, Instructions);
+    AppendString(Out, " instructions decoded, ");
+    AppendU64(Out, TotalCycles);
+    AppendString(Out, " cycles total\n");
+
+    for(u32 Stage = 0; Stage < Stage_Count; Stage++)
+    {
+        stats_timer *Timer = &Stats->Timers[Stage];
+        if(Timer->Hits)
+        {
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, "  ");
+            AppendString(Out, StageNames[Stage]);
+            AppendString(Out, ": ");
+            AppendU64(Out, Timer->Cycles);
+            AppendString(Out, " cycles (");
+            AppendPercent(Out, Timer->Cycles, TotalCycles);
+            AppendString(Out, "), ");
+            AppendU64(Out, Timer->Hits);
+            AppendString(Out, " calls, ");
+            AppendU64(Out, Timer->Cycles / Timer->Hits);
+            AppendString(Out, " cycles/call\n");
+        }
+    }
+
+    for(u32 Op = 0; Op <= op_unknown; Op++)
+    {
+        if(Stats->OpCounts[Op])
+        {
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, "  op ");
+            AppendString(Out, (Op < op_unknown) ? GetMnemonic((operation_types)Op) : "unknown");
+            AppendString(Out, ": ");
+            AppendU64(Out, Stats->OpCounts[Op]);
+            AppendString(Out, " (");
+            AppendPercent(Out, Stats->OpCounts[Op], Instructions);
+            AppendString(Out, ")\n");
+        }
+    }
+
+    u64 ModTotal = Stats->ModCounts[0] + Stats->ModCounts[1] + Stats->ModCounts[2] + Stats->ModCounts[3];
+    for(u32 Mod = 0; Mod < 4; Mod++)
+    {
+        ReserveOutput(Out, MAX_OUTPUT_LINE);
+        AppendString(Out, "  mod ");
+        AppendU32(Out, Mod >> 1);
+        AppendU32(Out, Mod & 1);
+        AppendString(Out, ": ");
+        AppendU64(Out, Stats->ModCounts[Mod]);
+        AppendString(Out, " (");
+        AppendPercent(Out, Stats->ModCounts[Mod], ModTotal);
+        AppendString(Out, ")");
+        if(Mod == 0)
+        {
+            AppendString(Out, ", ");
+            AppendU64(Out, Stats->DirectAddressCount);
+            AppendString(Out, " direct address");
+        }
+        AppendString(Out, "\n");
+    }
+
+    for(u32 Layout = 0; Layout < STATS_LAYOUT_COUNT; Layout++)
+    {
+        if(Stats->LayoutCounts[Layout])
+        {
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, "  layout ");
+            AppendString(Out, LayoutNames[Layout]);
+            AppendString(Out, ": ");
+            AppendU64(Out, Stats->LayoutCounts[Layout]);
+            AppendString(Out, " instructions, ");
+            AppendU64(Out, Stats->LayoutBytes[Layout]);
+            AppendString(Out, " bytes\n");
+        }
+    }
+}
+
+static void PrintStatsJson(run_stats *Stats, u64 TotalCycles, output_buffer *Out)
+{
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "{\"total_cycles\": ");
+    AppendU64(Out, TotalCycles);
+
+    AppendString(Out, ", \"timers\": {");
+    const char *Separator = "";
+    for(u32 Stage = 0; Stage < Stage_Count; Stage++)
+    {
+        ReserveOutput(Out, MAX_OUTPUT_LINE);
+        AppendString(Out, Separator);
+        AppendString(Out, "\"");
+        AppendString(Out, StageNames[Stage]);
+        AppendString(Out, "\": {\"cycles\": ");
+        AppendU64(Out, Stats->Timers[Stage].Cycles);
+        AppendString(Out, ", \"calls\": ");
+        AppendU64(Out, Stats->Timers[Stage].Hits);
+        AppendString(Out, "}");
+        Separator = ", ";
+    }
+
+    AppendString(Out, "}, \"ops\": {");
+    Separator = "";
+    for(u32 Op = 0; Op <= op_unknown; Op++)
+    {
+        if(Stats->OpCounts[Op])
+        {
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, Separator);
+            AppendString(Out, "\"");
+            AppendString(Out, (Op < op_unknown) ? GetMnemonic((operation_types)Op) : "unknown");
+            AppendString(Out, "\": ");
+            AppendU64(Out, Stats->OpCounts[Op]);
+            Separator = ", ";
+        }
+    }
+
+    ReserveOutput(Out, MAX_OUTPUT_LINE);
+    AppendString(Out, "}, \"modrm\": {");
+    for(u32 Mod = 0; Mod < 4; Mod++)
+    {
+        AppendString(Out, (Mod == 0) ? "\"mod" : ", \"mod");
+        AppendU32(Out, Mod >> 1);
+        AppendU32(Out, Mod & 1);
+        AppendString(Out, "\": ");
+        AppendU64(Out, Stats->ModCounts[Mod]);
+    }
+    AppendString(Out, ", \"direct_address\": ");
+    AppendU64(Out, Stats->DirectAddressCount);
+
+    AppendString(Out, "}, \"layouts\": {");
+    Separator = "";
+    for(u32 Layout = 0; Layout < STATS_LAYOUT_COUNT; Layout++)
+    {
+        if(Stats->LayoutCounts[Layout])
+        {
+            ReserveOutput(Out, MAX_OUTPUT_LINE);
+            AppendString(Out, Separator);
+            AppendString(Out, "\"");
+            AppendString(Out, LayoutNames[Layout]);
+            AppendString(Out, "\": {\"instructions\": ");
+            AppendU64(Out, Stats->LayoutCounts[Layout]);
+            AppendString(Out, ", \"bytes\": ");
+            AppendU64(Out, Stats->LayoutBytes[Layout]);
+            AppendString(Out, "}");
+            Separator = ", ";
+        }
+    }
+    AppendString(Out, "}}\n");
+}
+
+void PrintStats(output_buffer *Out, bool Json)
+{
+    u64 TotalCycles = __rdtsc() - RunStartCycles;
+    MergeThreadStats();
+
+    if(Json)
+    {
+        PrintStatsJson(&GlobalStats, TotalCycles, Out);
+    }
+    else
+    {
+        PrintStatsText(&GlobalStats, TotalCycles, Out);
+    }
+}
+
+#endif
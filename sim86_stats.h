@@ -0,0 +1,88 @@
+#ifndef SIM86_STATS_H
+#define SIM86_STATS_H
+
+#include "sim86.h"
+#include "sim86_output.h"
+
+// NOTE (Pedro): Decoder/printer instrumentation for --stats, only compiled with -DSIM86_STATS
+// (make STATS=1). Without it every macro below is empty, the hot paths don't even see a branch.
+#ifdef SIM86_STATS
+
+#include <x86intrin.h>
+
+typedef enum stats_stage
+{
+    Stage_Load,
+    Stage_Parse,
+    Stage_ParseRm,      // Nested inside Stage_Parse
+    Stage_Print,
+    Stage_Execute,
+    Stage_Length,       // Boundary index pre-pass
+    Stage_Count,
+} stats_stage;
+
+#define STATS_LAYOUT_COUNT (Layout_Jump + 1)
+
+typedef struct stats_timer
+{
+    u64 Cycles;
+    u64 Hits;
+} stats_timer;
+
+typedef struct run_stats
+{
+    u64 OpCounts[op_unknown + 1];
+    u64 ModCounts[4];               // Indexed by the mod field
+    u64 DirectAddressCount;         // mod 00, r/m 110
+    u64 LayoutCounts[STATS_LAYOUT_COUNT];
+    u64 LayoutBytes[STATS_LAYOUT_COUNT];
+
+    stats_timer Timers[Stage_Count];
+} run_stats;
+
+// NOTE (Pedro): Every thread counts into its own copy, workers fold theirs into the total on exit
+extern thread_local run_stats ThreadStats;
+
+struct timed_block
+{
+    stats_stage Stage;
+    u64 Start;
+
+    timed_block(stats_stage StageInit)
+    {
+        Stage = StageInit;
+        Start = __rdtsc();
+    }
+
+    ~timed_block()
+    {
+        stats_timer *Timer = &ThreadStats.Timers[Stage];
+        Timer->Cycles += __rdtsc() - Start;
+        Timer->Hits++;
+    }
+};
+
+#define STATS_CONCAT_(A, B) A##B
+#define STATS_CONCAT(A, B) STATS_CONCAT_(A, B)
+
+#define TIMED_BLOCK(Stage) timed_block STATS_CONCAT(TimedBlock_, __LINE__)(Stage)
+#define STATS_COUNT_INSTRUCTION(Op, Layout, Size) \
+    (ThreadStats.OpCounts[Op]++, ThreadStats.LayoutCounts[Layout]++, ThreadStats.LayoutBytes[Layout] += (Size))
+#define STATS_COUNT_MODRM(Mod, Rm) \
+    (ThreadStats.ModCounts[Mod]++, ThreadStats.DirectAddressCount += (((Mod) == 0b00) && ((Rm) == 0b110)))
+#define STATS_MERGE_THREAD() MergeThreadStats()
+
+void BeginStats(void);
+void MergeThreadStats(void);
+void PrintStats(output_buffer *Out, bool Json);
+
+#else
+
+#define TIMED_BLOCK(Stage)
+#define STATS_COUNT_INSTRUCTION(Op, Layout, Size)
+#define STATS_COUNT_MODRM(Mod, Rm)
+#define STATS_MERGE_THREAD()
+
+#endif
+
+#endif
@@ -1,59 +1,292 @@
 #ifndef SIM86_TABLE_H
 #define SIM86_TABLE_H
 
-const char *OpMnemonic[30] =
-{
-    "mov",
-    "add",
-    "sub",
-    "cmp",
-    "jne",
-    "je",
-    "jl",
-    "jle",
-    "jb",
-    "jbe",
-    "jp",
-    "jo",
-    "js",
-    "jnl",
-    "jg",
-    "jnb",
-    "ja",
-    "jnp",
-    "jno",
-    "jns",
-    "LOOP",
-    "LOOPZ",
-    "LOOPNZ",
-    "JCXZ",
-    "ret",
+#include "sim86.h"
+
+static const char *const OpMnemonic[op_unknown + 1] =
+{
+    OPERATION_LIST(LIST_NAME_TEXT)
     "unknown",
 };
 
-const char *Registers[30] =
-{
-    "al",
-    "cl",
-    "dl",
-    "bl",
-    "ah",
-    "ch",
-    "dh",
-    "bh",
-    "ax",
-    "cx",
-    "dx",
-    "bx",
-    "sp",
-    "bp",
-    "si",
-    "di",
-    "bx + si",
-    "bx + di",
-    "bp + si",
-    "bp + di",
+static const char *const Registers[unknown + 1] =
+{
+    REGISTER_LIST(LIST_NAME_TEXT)
     "unknown",
 };
 
+// NOTE (Pedro): One line per encoding, written the way the Intel manual lays them out. The first
+// eight characters are the first byte, high bit first: 0 and 1 must match, d w s are the flag
+// bits, any other letter is a field the layout reads on its own (reg in 1011wreg). After that:
+//   mod reg r/m             ModRM byte
+//   mod 101 r/m             ModRM byte whose reg field picks the operation (a group opcode)
+//   data                    One byte of immediate data
+//   data-if-w=1             Second data byte when w is set
+//   data-if-sw=01           Second data byte when w is set and s isn't
+//   addr-lo addr-hi         16-bit direct address
+//   ip-inc8                 8-bit signed IP increment
+// Everything else about an opcode byte (flags, sizes, group slots) is generated from these
+// lines at compile time, see BuildOpcodeTables.
+typedef struct encoding_spec
+{
+    const char *Pattern;
+    operation_types OpType;
+    opcode_layout Layout;
+} encoding_spec;
+
+static constexpr encoding_spec EncodingSpec[] =
+{
+    {"100010dw mod reg r/m", mov, Layout_RegRm},
+    {"1100011w mod 000 r/m data data-if-w=1", mov, Layout_ImmToRm},
+    {"1011wreg data data-if-w=1", mov, Layout_ImmToReg},
+    {"1010000w addr-lo addr-hi", mov, Layout_MemToAcc},
+    {"1010001w addr-lo addr-hi", mov, Layout_AccToMem},
+
+    {"000000dw mod reg r/m", add, Layout_RegRm},
+    {"100000sw mod 000 r/m data data-if-sw=01", add, Layout_ImmToRm},
+    {"0000010w data data-if-w=1", add, Layout_ImmToAcc},
+
+    {"001010dw mod reg r/m", sub, Layout_RegRm},
+    {"100000sw mod 101 r/m data data-if-sw=01", sub, Layout_ImmToRm},
+    {"0010110w data data-if-w=1", sub, Layout_ImmToAcc},
+
+    {"001110dw mod reg r/m", cmp, Layout_RegRm},
+    {"100000sw mod 111 r/m data data-if-sw=01", cmp, Layout_ImmToRm},
+    {"0011110w data data-if-w=1", cmp, Layout_ImmToAcc},
+
+    {"01110100 ip-inc8", je, Layout_Jump},
+    {"01111100 ip-inc8", jl, Layout_Jump},
+    {"01111110 ip-inc8", jle, Layout_Jump},
+    {"01110010 ip-inc8", jb, Layout_Jump},
+    {"01110110 ip-inc8", jbe, Layout_Jump},
+    {"01111010 ip-inc8", jp, Layout_Jump},
+    {"01110000 ip-inc8", jo, Layout_Jump},
+    {"01111000 ip-inc8", js, Layout_Jump},
+    {"01110101 ip-inc8", jne, Layout_Jump},
+    {"01111101 ip-inc8", jnl, Layout_Jump},
+    {"01111111 ip-inc8", jg, Layout_Jump},
+    {"01110011 ip-inc8", jnb, Layout_Jump},
+    {"01110111 ip-inc8", ja, Layout_Jump},
+    {"01111011 ip-inc8", jnp, Layout_Jump},
+    {"01110001 ip-inc8", jno, Layout_Jump},
+    {"01111001 ip-inc8", jns, Layout_Jump},
+    {"11100010 ip-inc8", loop, Layout_Jump},
+    {"11100001 ip-inc8", loopz, Layout_Jump},
+    {"11100000 ip-inc8", loopnz, Layout_Jump},
+    {"11100011 ip-inc8", jcxz, Layout_Jump},
+};
+
+typedef struct opcode_tables
+{
+    opcode_entry Opcodes[256];
+    operation_types Groups[OpcodeGroup_Count][8];
+} opcode_tables;
+
+static constexpr bool HasToken(const char *Text, const char *Token)
+{
+    for(; *Text; Text++)
+    {
+        u32 Index = 0;
+        while(Token[Index] && (Text[Index] == Token[Index]))
+        {
+            Index++;
+        }
+
+        if(!Token[Index])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static constexpr bool MatchesFirstByte(const char *Pattern, u32 Byte)
+{
+    for(u32 Bit = 0; Bit < 8; Bit++)
+    {
+        u32 Value = (Byte >> (7 - Bit)) & 1;
+        if(((Pattern[Bit] == '0') && Value) || ((Pattern[Bit] == '1') && !Value))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE (Pedro): Value of the d, w or s bit in Byte, 0 when the pattern doesn't have that letter
+static constexpr u32 GetPatternBit(const char *Pattern, u32 Byte, char Letter)
+{
+    for(u32 Bit = 0; Bit < 8; Bit++)
+    {
+        if(Pattern[Bit] == Letter)
+        {
+            return (Byte >> (7 - Bit)) & 1;
+        }
+    }
+
+    return 0;
+}
+
+// NOTE (Pedro): The fixed reg field of "mod 101 r/m", or 8 when the encoding isn't a group
+static constexpr u32 GetGroupReg(const char *Pattern)
+{
+    for(const char *At = Pattern; *At; At++)
+    {
+        if((At[0] == 'm') && (At[1] == 'o') && (At[2] == 'd') && (At[3] == ' '))
+        {
+            u32 Result = 0;
+            for(u32 Index = 4; Index < 7; Index++)
+            {
+                if((At[Index] != '0') && (At[Index] != '1'))
+                {
+                    return 8;
+                }
+
+                Result = (Result << 1) | (At[Index] - '0');
+            }
+
+            return Result;
+        }
+    }
+
+    return 8;
+}
+
+static constexpr bool SameFirstByte(const char *A, const char *B)
+{
+    for(u32 Index = 0; Index < 8; Index++)
+    {
+        if(A[Index] != B[Index])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE (Pedro): Runs at compile time only. Two specs claiming the same opcode byte or group slot
+// throw, which makes the constexpr evaluation and so the build fail instead of shipping a table
+// that depends on spec order.
+static constexpr opcode_tables BuildOpcodeTables()
+{
+    opcode_tables Tables = {};
+    for(u32 Byte = 0; Byte < 256; Byte++)
+    {
+        Tables.Opcodes[Byte] = {op_unknown, Layout_None, 0, 0, 0};
+    }
+
+    for(u32 Group = 0; Group < OpcodeGroup_Count; Group++)
+    {
+        for(u32 Reg = 0; Reg < 8; Reg++)
+        {
+            Tables.Groups[Group][Reg] = op_unknown;
+        }
+    }
+
+    const char *GroupPatterns[OpcodeGroup_Count] = {};
+    u32 GroupCount = 0;
+
+    for(const encoding_spec &Spec : EncodingSpec)
+    {
+        u32 GroupReg = GetGroupReg(Spec.Pattern);
+        u32 Group = 0;
+
+        if(GroupReg < 8)
+        {
+            while((Group < GroupCount) && !SameFirstByte(GroupPatterns[Group], Spec.Pattern))
+            {
+                Group++;
+            }
+
+            if(Group == GroupCount)
+            {
+                if(GroupCount == OpcodeGroup_Count)
+                {
+                    throw "EncodingSpec has more groups than opcode_group";
+                }
+
+                GroupPatterns[GroupCount++] = Spec.Pattern;
+            }
+
+            if(Tables.Groups[Group][GroupReg] != op_unknown)
+            {
+                throw "Two encodings claim the same group slot";
+            }
+
+            Tables.Groups[Group][GroupReg] = Spec.OpType;
+        }
+
+        for(u32 Byte = 0; Byte < 256; Byte++)
+        {
+            if(!MatchesFirstByte(Spec.Pattern, Byte))
+            {
+                continue;
+            }
+
+            u32 D = GetPatternBit(Spec.Pattern, Byte, 'd');
+            u32 W = GetPatternBit(Spec.Pattern, Byte, 'w');
+            u32 S = GetPatternBit(Spec.Pattern, Byte, 's');
+
+            opcode_entry Entry = {};
+            Entry.OpType = (GroupReg < 8) ? (u8)Group : (u8)Spec.OpType;
+            Entry.Layout = Spec.Layout;
+            Entry.Flags = (D ? Opcode_D : 0) | (W ? Opcode_W : 0) | (S ? Opcode_S : 0);
+            Entry.Flags |= HasToken(Spec.Pattern, "mod ") ? Opcode_ModRM : 0;
+            Entry.Flags |= (GroupReg < 8) ? Opcode_Group : 0;
+
+            if(HasToken(Spec.Pattern, "addr-lo addr-hi"))
+            {
+                Entry.DispSize = 2;
+            }
+            else if(HasToken(Spec.Pattern, "ip-inc8"))
+            {
+                Entry.DispSize = 1;
+            }
+
+            if(HasToken(Spec.Pattern, "data"))
+            {
+                Entry.ImmSize = 1;
+                if((HasToken(Spec.Pattern, "data-if-w=1") && W) ||
+                   (HasToken(Spec.Pattern, "data-if-sw=01") && W && !S))
+                {
+                    Entry.ImmSize = 2;
+                }
+            }
+
+            // Group members share their opcode bytes, everything else has to be alone
+            opcode_entry Existing = Tables.Opcodes[Byte];
+            if(Existing.Layout != Layout_None)
+            {
+                bool SameGroup = (Existing.Flags & Opcode_Group) && (Entry.Flags & Opcode_Group) &&
+                                 (Existing.OpType == Entry.OpType) && (Existing.Flags == Entry.Flags) &&
+                                 (Existing.ImmSize == Entry.ImmSize) && (Existing.Layout == Entry.Layout);
+                if(!SameGroup)
+                {
+                    throw "Two encodings claim the same opcode byte";
+                }
+            }
+
+            Tables.Opcodes[Byte] = Entry;
+        }
+    }
+
+    if(GroupCount != OpcodeGroup_Count)
+    {
+        throw "opcode_group has groups EncodingSpec doesn't define";
+    }
+
+    return Tables;
+}
+
+static constexpr opcode_tables GeneratedTables = BuildOpcodeTables();
+
+// NOTE (Pedro): One entry per first byte, so decoding an opcode is a single indexed lookup
+static constexpr const opcode_entry *OpcodeTable = GeneratedTables.Opcodes;
+
+// NOTE (Pedro): Operation picked by the ModRM reg field for group opcodes
+static constexpr const operation_types (*OpcodeGroupTable)[8] = GeneratedTables.Groups;
+
 #endif
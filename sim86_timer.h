@@ -0,0 +1,15 @@
+#ifndef SIM86_TIMER_H
+#define SIM86_TIMER_H
+
+#include <time.h>
+
+static inline double GetSeconds(void)
+{
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+
+    double Result = Time.tv_sec + (Time.tv_nsec * 1e-9);
+    return Result;
+}
+
+#endif